@@ -0,0 +1,52 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <cstddef>
+#include <initializer_list>
+#include <vector>
+
+namespace ipq {
+
+/* non-owning view of a contiguous array, cheap to pass by value. The viewed
+ * elements must outlive the ArrayRef, in particular an ArrayRef made from an
+ * initializer list is only valid until the end of the full expression.
+ */
+template <typename T>
+class ArrayRef {
+  const T* data_ = nullptr;
+  size_t size_ = 0;
+
+ public:
+  using value_type = T;
+  using iterator = const T*;
+
+  ArrayRef() = default;
+  ArrayRef(const T* data, size_t size) : data_(data), size_(size) {}
+  ArrayRef(const T* begin, const T* end) : data_(begin), size_(end - begin) {}
+  template <typename AllocTy>
+  ArrayRef(const std::vector<T, AllocTy>& vec)
+      : data_(vec.data()), size_(vec.size()) {}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+// the lifetime of the list is documented above
+#pragma GCC diagnostic ignored "-Winit-list-lifetime"
+#endif
+  ArrayRef(std::initializer_list<T> list)
+      : data_(list.begin()), size_(list.size()) {}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+  const T* begin() const { return data_; }
+  const T* end() const { return data_ + size_; }
+  const T* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return !size_; }
+  const T& operator[](size_t idx) const {
+    IPQ_ASSERT(idx < size_);
+    return data_[idx];
+  }
+};
+
+}  // namespace ipq
@@ -0,0 +1,224 @@
+#pragma once
+
+#include "array_ref.hpp"
+#include "ip.hpp"
+#include "location.hpp"
+#include "location_names.hpp"
+#include "server.hpp"
+#include "serving_state.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ipq {
+
+/* a binary protocol for bulk lookups, every integer big-endian. A message,
+ * request or response, is an 8 byte header
+ *   u8 type, u8 arg, u16 zero, u32 count
+ * followed by its payload:
+ *
+ *   Lookup  request:  arg 4 or 6, count keys of 4 bytes (IPv4) or 16 bytes
+ *                     (IPv6) each
+ *           response: count records of 16 bytes, in the order of the keys
+ *                     u32 country_id, u32 city_id, u32 range_start,
+ *                     u32 range_end
+ *   Names   request:  no payload
+ *           response: count bytes: u32 countries, then for each country
+ *                     code and name; u32 cities, then for each city
+ *                     province and city name; every string a u16 length
+ *                     and its bytes
+ *   Error   response: arg the ErrorCode, no payload; the connection is
+ *                     closed after it
+ *
+ * The ids of a record index the lists of the Names response, NotFound ids
+ * tell that no range covers the key. The range bounds are IPv4 addresses;
+ * only IPv4-mapped IPv6 keys (::ffff:a.b.c.d) can be found, for the others
+ * the range is empty (start 1, end 0). A key that is not found gets as its
+ * range the largest gap around it holding no data, so that a client may
+ * cache misses as well. A client may send many messages without waiting for
+ * the responses.
+ */
+namespace binary {
+
+enum Type : uint8_t { Lookup = 1, Names = 2, Error = 0xff };
+enum ErrorCode : uint8_t { UnknownType = 1, BadKeyFamily = 2, TooManyKeys = 3 };
+
+constexpr size_t HeaderSize = 8;
+constexpr size_t RecordSize = 16;
+constexpr uint32_t NotFound = UINT32_MAX;
+// keys in one lookup, bounding the memory of one request
+constexpr uint32_t MaxKeys = 1 << 20;
+
+inline uint32_t load32(const char* p) {
+  auto* u = reinterpret_cast<const unsigned char*>(p);
+  return uint32_t(u[0]) << 24 | uint32_t(u[1]) << 16 | uint32_t(u[2]) << 8 |
+         uint32_t(u[3]);
+}
+
+inline void store32(char* p, uint32_t v) {
+  p[0] = char(v >> 24);
+  p[1] = char(v >> 16);
+  p[2] = char(v >> 8);
+  p[3] = char(v);
+}
+
+inline void appendHeader(std::string& out, Type type, uint8_t arg,
+                         uint32_t count) {
+  char header[HeaderSize] = {char(type), char(arg), 0, 0};
+  store32(header + 4, count);
+  out.append(header, HeaderSize);
+}
+
+// a Lookup request for ips, for clients
+inline void appendLookup(std::string& out, ArrayRef<Ip> ips) {
+  appendHeader(out, Lookup, 4, uint32_t(ips.size()));
+  size_t pos = out.size();
+  out.resize(pos + 4 * ips.size());
+  for (Ip ip : ips) {
+    store32(&out[pos], ip);
+    pos += 4;
+  }
+}
+
+}  // namespace binary
+
+/* the server side of the binary protocol for one event loop, a
+ * Server::HandlerTy; the keys of a Lookup are answered as one batch from one
+ * version of the engine
+ */
+class BinaryProtocol {
+  ServingState* state_;
+  ServingReader reader_;
+  std::vector<Ip> ips_;
+  // whether each key is an IPv4 address
+  std::vector<bool> v4_;
+  std::vector<Location> locs_;
+  std::vector<IpRange> ranges_;
+
+  static void appendString(std::string& out, std::string_view str) {
+    str = str.substr(0, UINT16_MAX);
+    out += char(str.size() >> 8);
+    out += char(str.size());
+    out.append(str);
+  }
+
+  void lookup(const char* keys, size_t count, size_t key_size,
+              std::string& out) {
+    ips_.resize(count);
+    v4_.assign(count, true);
+    for (size_t i = 0; i < count; ++i, keys += key_size) {
+      if (key_size == 4) {
+        ips_[i] = binary::load32(keys);
+        continue;
+      }
+      // ::ffff:a.b.c.d
+      static const char mapped[12] = {0, 0, 0, 0, 0,      0,
+                                      0, 0, 0, 0, '\xff', '\xff'};
+      v4_[i] = std::equal(mapped, mapped + 12, keys);
+      ips_[i] = v4_[i] ? binary::load32(keys + 12) : 0;
+    }
+    locs_.resize(count);
+    ranges_.resize(count);
+    reader_.query(ips_, locs_.data(), ranges_.data());
+
+    binary::appendHeader(out, binary::Lookup, 0, uint32_t(count));
+    size_t pos = out.size();
+    out.resize(pos + count * binary::RecordSize);
+    char* record = &out[pos];
+    for (size_t i = 0; i < count; ++i, record += binary::RecordSize) {
+      bool found = v4_[i] && !(locs_[i] == Location());
+      binary::store32(record,
+                      found ? locs_[i].getProvinceCode() : binary::NotFound);
+      binary::store32(record + 4,
+                      found ? locs_[i].getCountryCode() : binary::NotFound);
+      binary::store32(record + 8, v4_[i] ? ranges_[i].start : 1);
+      binary::store32(record + 12, v4_[i] ? ranges_[i].end : 0);
+    }
+  }
+
+  void names(std::string& out) {
+    size_t header = out.size();
+    binary::appendHeader(out, binary::Names, 0, 0);
+    std::shared_lock<std::shared_mutex> lock(state_->names_mutex);
+    auto& names = state_->names;
+    char count[4];
+    binary::store32(count, names.countries());
+    out.append(count, 4);
+    for (uint32_t country = 0; country < names.countries(); ++country) {
+      appendString(out, names.countryCode(country));
+      appendString(out, names.countryName(country));
+    }
+    binary::store32(count, names.cities());
+    out.append(count, 4);
+    for (uint32_t city = 0; city < names.cities(); ++city) {
+      appendString(out, names.province(city));
+      appendString(out, names.cityName(city));
+    }
+    binary::store32(&out[header + 4],
+                    uint32_t(out.size() - header - binary::HeaderSize));
+  }
+
+  static size_t fail(std::string& out, binary::ErrorCode code) {
+    binary::appendHeader(out, binary::Error, code, 0);
+    return Server::Close;
+  }
+
+ public:
+  BinaryProtocol(ServingState& state, ServingReader reader)
+      : state_(&state), reader_(std::move(reader)) {}
+
+  size_t operator()(std::string_view in, std::string& out) {
+    size_t consumed = 0;
+    while (in.size() - consumed >= binary::HeaderSize) {
+      const char* header = in.data() + consumed;
+      uint8_t type = uint8_t(header[0]), arg = uint8_t(header[1]);
+      uint32_t count = binary::load32(header + 4);
+      if (type == binary::Names) {
+        names(out);
+        consumed += binary::HeaderSize;
+        continue;
+      }
+      if (type != binary::Lookup) {
+        return fail(out, binary::UnknownType);
+      }
+      if (arg != 4 && arg != 6) {
+        return fail(out, binary::BadKeyFamily);
+      }
+      if (count > binary::MaxKeys) {
+        return fail(out, binary::TooManyKeys);
+      }
+      size_t key_size = arg == 4 ? 4 : 16;
+      size_t size = binary::HeaderSize + count * key_size;
+      if (in.size() - consumed < size) {
+        break;
+      }
+      lookup(header + binary::HeaderSize, count, key_size, out);
+      consumed += size;
+    }
+    return consumed;
+  }
+};
+
+// a BinaryProtocol for every loop, no handler if the engine has no reader left
+inline Server::HandlerFactoryTy binaryProtocol(ServingState& state) {
+  return [&state](unsigned) -> Server::HandlerTy {
+    auto reader = state.reader();
+    if (!reader) {
+      return nullptr;
+    }
+    auto protocol = std::make_shared<BinaryProtocol>(state, std::move(*reader));
+    return [protocol](std::string_view in, std::string& out) {
+      return (*protocol)(in, out);
+    };
+  };
+}
+
+}  // namespace ipq
@@ -1030,6 +1030,13 @@ class BTreeImpl : P::LeafNodeAllocTy,
     size_ = 0;
   }
 
+  // the allocators are not exchanged, they must compare equal
+  void swap(BTreeImpl &other) {
+    std::swap(internal_height_, other.internal_height_);
+    std::swap(size_, other.size_);
+    std::swap(root_, other.root_);
+  }
+
   size_t size() { return size_; }
   size_t height() {
     return internal_height_;
@@ -99,6 +99,8 @@ class BTreeMap {
 
   void clear() { btree_.clear(); }
 
+  void swap(BTreeMap &other) { btree_.swap(other.btree_); }
+
   std::pair<iterator, bool> insert(const value_type &value) {
     iterator iter(btree_);
     auto res = btree_.add(value, iter.path_);
@@ -131,6 +133,11 @@ class BTreeMap {
     return emplace(std::forward<Args>(args)...);
   }
 
+  template <class... Args>
+  std::pair<iterator, bool> emplace_hint(iterator, Args&&... args ) {
+    return emplace(std::forward<Args>(args)...);
+  }
+
   iterator find(const key_type &key) {
     value_type value{key, ValueTy()};
     iterator ret(btree_);
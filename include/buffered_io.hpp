@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+namespace ipq {
+
+/* reads the lines of a file descriptor in large blocks, without iostreams:
+ * a line is a view of the block buffer, valid until the next call. Before
+ * every read that may block, the caller is told that the input ran dry, the
+ * moment to flush the output of an interactive session.
+ */
+class LineReader {
+  int fd_;
+  std::vector<char> buf_;
+  size_t begin_ = 0, end_ = 0;
+  bool eof_ = false;
+
+ public:
+  explicit LineReader(int fd, size_t block_size = 1 << 20)
+      : fd_(fd), buf_(block_size) {}
+
+  /* the next line without its newline, false at the end of the input; the
+   * last line may lack its newline. on_dry() is called before reading more.
+   */
+  template <typename OnDryTy>
+  bool next(std::string_view& line, OnDryTy on_dry) {
+    size_t scanned = begin_;
+    while (true) {
+      auto* eol = static_cast<char*>(
+          std::memchr(buf_.data() + scanned, '\n', end_ - scanned));
+      if (eol) {
+        line = std::string_view(buf_.data() + begin_,
+                                eol - (buf_.data() + begin_));
+        begin_ = eol - buf_.data() + 1;
+        return true;
+      }
+      if (eof_) {
+        if (begin_ == end_) {
+          return false;
+        }
+        line = std::string_view(buf_.data() + begin_, end_ - begin_);
+        begin_ = end_;
+        return true;
+      }
+      // keep the incomplete line at the start, grow for a very long one
+      std::memmove(buf_.data(), buf_.data() + begin_, end_ - begin_);
+      end_ -= begin_;
+      begin_ = 0;
+      scanned = end_;
+      if (end_ == buf_.size()) {
+        buf_.resize(buf_.size() * 2);
+      }
+      on_dry();
+      ssize_t n;
+      do {
+        n = ::read(fd_, buf_.data() + end_, buf_.size() - end_);
+      } while (n < 0 && errno == EINTR);
+      if (n <= 0) {
+        eof_ = true;
+      } else {
+        end_ += n;
+      }
+    }
+  }
+};
+
+/* output collected in a large buffer and written to a file descriptor only
+ * when flush() is called or the buffer is full
+ */
+class OutputBuffer {
+  int fd_;
+  std::string buf_;
+  size_t capacity_;
+
+ public:
+  explicit OutputBuffer(int fd, size_t capacity = 1 << 20)
+      : fd_(fd), capacity_(capacity) {
+    buf_.reserve(capacity);
+  }
+  OutputBuffer(const OutputBuffer&) = delete;
+  OutputBuffer& operator=(const OutputBuffer&) = delete;
+  ~OutputBuffer() { flush(); }
+
+  void flush() {
+    for (size_t written = 0; written < buf_.size();) {
+      ssize_t n = ::write(fd_, buf_.data() + written, buf_.size() - written);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        // the reader is gone, nothing more can be written
+        break;
+      }
+      written += n;
+    }
+    buf_.clear();
+  }
+
+  OutputBuffer& operator<<(std::string_view str) {
+    buf_.append(str);
+    if (buf_.size() >= capacity_) {
+      flush();
+    }
+    return *this;
+  }
+  OutputBuffer& operator<<(const char* str) {
+    return *this << std::string_view(str);
+  }
+  OutputBuffer& operator<<(const std::string& str) {
+    return *this << std::string_view(str);
+  }
+  OutputBuffer& operator<<(char c) { return *this << std::string_view(&c, 1); }
+  OutputBuffer& operator<<(uint64_t v) {
+    char digits[20];
+    auto res = std::to_chars(digits, digits + sizeof(digits), v);
+    return *this << std::string_view(digits, res.ptr - digits);
+  }
+  OutputBuffer& operator<<(uint32_t v) { return *this << uint64_t(v); }
+  OutputBuffer& operator<<(int v) {
+    return v < 0 ? *this << '-' << uint64_t(-int64_t(v)) : *this << uint64_t(v);
+  }
+};
+
+}  // namespace ipq
@@ -0,0 +1,260 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef IPQ_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef IPQ_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace ipq {
+
+/* reads a gzip or zstd compressed file as a stream of decompressed bytes,
+ * the format is detected from the magic number of the file. Only the buffers
+ * of the decompressor are held in memory, never the whole file.
+ */
+class CompressedReader {
+ public:
+  enum class Format { Unknown, Gzip, Zstd };
+
+ private:
+  Format format_ = Format::Unknown;
+  std::string error_;
+#ifdef IPQ_HAVE_ZLIB
+  gzFile gz_ = nullptr;
+#endif
+#ifdef IPQ_HAVE_ZSTD
+  FILE* file_ = nullptr;
+  ZSTD_DStream* zstd_ = nullptr;
+  std::vector<char> in_buf_;
+  ZSTD_inBuffer in_{nullptr, 0, 0};
+  // the last decompressed frame ended, nothing is buffered in zstd_
+  bool frame_done_ = true;
+  bool eof_ = false;
+#endif
+
+  bool fail(std::string error) {
+    error_ = std::move(error);
+    return false;
+  }
+
+  static Format detect(const unsigned char* magic, size_t size) {
+    if (size >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+      return Format::Gzip;
+    }
+    if (size >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f &&
+        magic[3] == 0xfd) {
+      return Format::Zstd;
+    }
+    return Format::Unknown;
+  }
+
+#ifdef IPQ_HAVE_ZSTD
+  long readZstd(char* buf, size_t size) {
+    ZSTD_outBuffer out{buf, size, 0};
+    while (out.pos < out.size) {
+      if (in_.pos == in_.size && !eof_) {
+        in_.size = std::fread(in_buf_.data(), 1, in_buf_.size(), file_);
+        in_.pos = 0;
+        if (!in_.size) {
+          if (std::ferror(file_)) {
+            fail("read error");
+            return -1;
+          }
+          eof_ = true;
+        }
+      }
+      if (eof_ && frame_done_) {
+        break;
+      }
+      size_t out_before = out.pos;
+      size_t ret = ZSTD_decompressStream(zstd_, &out, &in_);
+      if (ZSTD_isError(ret)) {
+        fail(ZSTD_getErrorName(ret));
+        return -1;
+      }
+      frame_done_ = ret == 0;
+      if (eof_ && !frame_done_ && out.pos == out_before) {
+        fail("truncated zstd stream");
+        return -1;
+      }
+    }
+    return out.pos;
+  }
+#endif
+
+ public:
+  CompressedReader() = default;
+  CompressedReader(const CompressedReader&) = delete;
+  CompressedReader& operator=(const CompressedReader&) = delete;
+  ~CompressedReader() { close(); }
+
+  bool open(const char* path) {
+    close();
+    FILE* file = std::fopen(path, "rb");
+    if (!file) {
+      return fail(std::string("can not open ") + path);
+    }
+    unsigned char magic[4];
+    size_t magic_size = std::fread(magic, 1, sizeof(magic), file);
+    format_ = detect(magic, magic_size);
+    switch (format_) {
+      case Format::Gzip:
+#ifdef IPQ_HAVE_ZLIB
+        std::fclose(file);
+        gz_ = gzopen(path, "rb");
+        if (!gz_) {
+          return fail(std::string("can not open ") + path);
+        }
+        gzbuffer(gz_, 1 << 17);
+        return true;
+#else
+        std::fclose(file);
+        return fail("gzip support not compiled in");
+#endif
+      case Format::Zstd:
+#ifdef IPQ_HAVE_ZSTD
+        std::rewind(file);
+        file_ = file;
+        zstd_ = ZSTD_createDStream();
+        ZSTD_initDStream(zstd_);
+        in_buf_.resize(ZSTD_DStreamInSize());
+        in_ = {in_buf_.data(), 0, 0};
+        frame_done_ = true;
+        eof_ = false;
+        return true;
+#else
+        std::fclose(file);
+        return fail("zstd support not compiled in");
+#endif
+      default:
+        std::fclose(file);
+        return fail(std::string(path) + " is neither gzip nor zstd compressed");
+    }
+  }
+
+  void close() {
+#ifdef IPQ_HAVE_ZLIB
+    if (gz_) {
+      gzclose(gz_);
+      gz_ = nullptr;
+    }
+#endif
+#ifdef IPQ_HAVE_ZSTD
+    if (zstd_) {
+      ZSTD_freeDStream(zstd_);
+      zstd_ = nullptr;
+    }
+    if (file_) {
+      std::fclose(file_);
+      file_ = nullptr;
+    }
+#endif
+    format_ = Format::Unknown;
+  }
+
+  /* decompresses up to size bytes into buf. Returns the number of bytes
+   * stored, less than size only at the end of the stream, or -1 on error.
+   */
+  long read(char* buf, size_t size) {
+    switch (format_) {
+#ifdef IPQ_HAVE_ZLIB
+      case Format::Gzip: {
+        size_t done = 0;
+        while (done < size) {
+          int ret = gzread(gz_, buf + done, unsigned(size - done));
+          if (ret < 0) {
+            int errnum;
+            fail(gzerror(gz_, &errnum));
+            return -1;
+          }
+          if (!ret) {
+            // zlib treats a stream cut short as the end of a file still
+            // being written, with Z_BUF_ERROR left as the error
+            int errnum;
+            gzerror(gz_, &errnum);
+            if (errnum != Z_OK) {
+              fail("truncated gzip stream");
+              return -1;
+            }
+            break;
+          }
+          done += ret;
+        }
+        return done;
+      }
+#endif
+#ifdef IPQ_HAVE_ZSTD
+      case Format::Zstd:
+        return readZstd(buf, size);
+#endif
+      default:
+        fail("no compressed file open");
+        return -1;
+    }
+  }
+
+  Format format() const { return format_; }
+  const std::string& error() const { return error_; }
+};
+
+/* a blocking FIFO of at most capacity items between threads. close() wakes
+ * every waiter: pop() then drains the remaining items before failing.
+ */
+template <typename T>
+class BoundedQueue {
+  std::mutex mutex_;
+  std::condition_variable not_empty_, not_full_;
+  std::deque<T> items_;
+  size_t capacity_;
+  bool closed_ = false;
+
+ public:
+  explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+  // returns false if the queue was closed, item is then dropped
+  bool push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [&] { return closed_ || items_.size() < capacity_; });
+    if (closed_) {
+      return false;
+    }
+    items_.push_back(std::move(item));
+    not_empty_.notify_one();
+    return true;
+  }
+
+  // returns false once the queue is closed and empty
+  bool pop(T& item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [&] { return closed_ || !items_.empty(); });
+    if (items_.empty()) {
+      return false;
+    }
+    item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+};
+
+}  // namespace ipq
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "config.hpp"
+#include "location.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace ipq {
+
+/* per-/16 summary of the countries stored in an IPv4 interval tree, used to
+ * answer "is this ip in one of these countries" without searching the tree.
+ * Plug it into IntervalTree as a listener (country code is the
+ * getProvinceCode() half of Location). For each /16 it keeps the set of
+ * countries having at least one address there and, when one country owns the
+ * whole /16, that country as a fast path. contains() answers Maybe only for
+ * /16s mixing countries of the query with other countries or unstored
+ * addresses, the caller then falls back to IntervalTree::find. Countries with
+ * a code not below MaxCountries are tracked as "other".
+ */
+template <size_t MaxCountries = 256>
+class CountryFilter {
+ public:
+  using CountrySet = std::bitset<MaxCountries>;
+  enum class Answer { No, Yes, Maybe };
+
+ private:
+  static constexpr unsigned int prefix_shift = 16;
+  static constexpr uint32_t prefix_count = uint32_t(1) << (32 - prefix_shift);
+  static constexpr uint32_t prefix_size = uint32_t(1) << prefix_shift;
+  static constexpr uint32_t no_single_country = uint32_t(-1);
+
+  struct Summary {
+    CountrySet countries;
+    // the country owning every address of the /16, or no_single_country
+    uint32_t single = no_single_country;
+    // every address of the /16 is stored, all of them in countries
+    bool complete = false;
+  };
+  struct Counts {
+    // (country, number of stored addresses of the /16 in the country)
+    std::vector<std::pair<uint32_t, uint32_t>> countries;
+    uint32_t covered = 0;
+  };
+
+  std::vector<Summary> summaries_;
+  std::vector<Counts> counts_;
+  bool enabled_ = false;
+
+  void resummarize(uint32_t prefix) {
+    auto& counts = counts_[prefix];
+    auto& summary = summaries_[prefix];
+    summary = Summary();
+    bool other = false;
+    for (auto& country : counts.countries) {
+      if (country.first < MaxCountries) {
+        summary.countries.set(country.first);
+      } else {
+        other = true;
+      }
+    }
+    if (counts.covered == prefix_size) {
+      summary.complete = !other;
+      if (counts.countries.size() == 1 && !other) {
+        summary.single = counts.countries[0].first;
+      }
+    }
+  }
+
+  void add(uint32_t prefix, uint32_t country, uint32_t addresses) {
+    auto& counts = counts_[prefix].countries;
+    auto iter = std::find_if(counts.begin(), counts.end(), [&](auto& c) {
+      return c.first == country;
+    });
+    if (iter == counts.end()) {
+      counts.emplace_back(country, addresses);
+    } else {
+      iter->second += addresses;
+    }
+    counts_[prefix].covered += addresses;
+  }
+
+  void sub(uint32_t prefix, uint32_t country, uint32_t addresses) {
+    auto& counts = counts_[prefix].countries;
+    auto iter = std::find_if(counts.begin(), counts.end(), [&](auto& c) {
+      return c.first == country;
+    });
+    IPQ_ASSERT(iter != counts.end() && iter->second >= addresses);
+    iter->second -= addresses;
+    if (!iter->second) {
+      *iter = counts.back();
+      counts.pop_back();
+    }
+    counts_[prefix].covered -= addresses;
+  }
+
+  template <typename OpTy>
+  void forEachPrefix(uint32_t start, uint32_t end, OpTy op) {
+    for (uint32_t prefix = start >> prefix_shift;; ++prefix) {
+      uint32_t first = std::max(start, prefix << prefix_shift);
+      uint32_t last = std::min(end, (prefix << prefix_shift) | (prefix_size - 1));
+      op(prefix, last - first + 1);
+      resummarize(prefix);
+      if (prefix == end >> prefix_shift) {
+        break;
+      }
+    }
+  }
+
+ public:
+  void enable() {
+    enabled_ = true;
+    summaries_.resize(prefix_count);
+    counts_.resize(prefix_count);
+  }
+  bool enabled() const { return enabled_; }
+
+  void inserted(uint32_t start, uint32_t end, const Location& loc) {
+    if (enabled_) {
+      uint32_t country = loc.getProvinceCode();
+      forEachPrefix(start, end, [&](uint32_t prefix, uint32_t addresses) {
+        add(prefix, country, addresses);
+      });
+    }
+  }
+
+  void erased(uint32_t start, uint32_t end, const Location& loc) {
+    if (enabled_) {
+      uint32_t country = loc.getProvinceCode();
+      forEachPrefix(start, end, [&](uint32_t prefix, uint32_t addresses) {
+        sub(prefix, country, addresses);
+      });
+    }
+  }
+
+  Answer contains(uint32_t ip, const CountrySet& countries) const {
+    IPQ_ASSERT(enabled_);
+    auto& summary = summaries_[ip >> prefix_shift];
+    if (summary.single != no_single_country) {
+      return countries.test(summary.single) ? Answer::Yes : Answer::No;
+    }
+    if ((summary.countries & countries).none()) {
+      return Answer::No;
+    }
+    if (summary.complete && (summary.countries & ~countries).none()) {
+      return Answer::Yes;
+    }
+    return Answer::Maybe;
+  }
+};
+
+}  // namespace ipq
@@ -0,0 +1,300 @@
+#pragma once
+
+#include "config.hpp"
+#include "ip.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace ipq {
+
+/* read-only memory mapping of a whole file
+ */
+class MappedFile {
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+
+ public:
+  MappedFile() = default;
+  explicit MappedFile(const char* path) { open(path); }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile() { close(); }
+
+  bool open(const char* path) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      ::close(fd);
+      return false;
+    }
+    size_ = st.st_size;
+    if (size_) {
+      void* addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr == MAP_FAILED) {
+        ::close(fd);
+        size_ = 0;
+        return false;
+      }
+      madvise(addr, size_, MADV_SEQUENTIAL);
+      data_ = static_cast<const char*>(addr);
+    } else {
+      // an empty file can not be mapped, but it is still a valid file
+      data_ = "";
+    }
+    ::close(fd);
+    return true;
+  }
+
+  void close() {
+    if (data_ && size_) {
+      munmap(const_cast<char*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  // madvise() the whole mapping, for example MADV_RANDOM before lookups
+  void advise(int advice) const {
+    if (data_ && size_) {
+      madvise(const_cast<char*>(data_), size_, advice);
+    }
+  }
+
+  explicit operator bool() const { return data_; }
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+  const char* begin() const { return data_; }
+  const char* end() const { return data_ + size_; }
+};
+
+namespace internal {
+
+/* position of the first c1 or c2 in [p, end), or end
+ */
+inline const char* findEither(const char* p, const char* end, char c1,
+                              char c2) {
+#ifdef __SSE2__
+  const __m128i v1 = _mm_set1_epi8(c1), v2 = _mm_set1_epi8(c2);
+  for (; end - p >= 16; p += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, v1),
+                                              _mm_cmpeq_epi8(chunk, v2)));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; p != end; ++p) {
+    if (*p == c1 || *p == c2) {
+      return p;
+    }
+  }
+  return end;
+}
+
+inline const char* findByte(const char* p, const char* end, char c) {
+  auto ret = static_cast<const char*>(std::memchr(p, c, end - p));
+  return ret ? ret : end;
+}
+
+}  // namespace internal
+
+/* splits a csv buffer into lines of fields, in place. Fields may be quoted
+ * ("a","b") or not (a,b), quoted fields are returned without the quotes.
+ * Lines end with \n or \r\n, empty lines are skipped.
+ */
+class CsvScanner {
+  const char* p_;
+  const char* end_;
+  size_t line_ = 0;
+  bool error_ = false;
+
+ public:
+  CsvScanner(const char* begin, const char* end) : p_(begin), end_(end) {}
+  CsvScanner(std::string_view buf)
+      : CsvScanner(buf.data(), buf.data() + buf.size()) {}
+
+  /* parses the next line, storing at most max_fields fields and counting
+   * all of them in field_count. Returns false at the end of the buffer or on
+   * a malformed line (an unterminated quote, or garbage after a closing
+   * quote), error() tells the two apart.
+   */
+  bool next(std::string_view* fields, size_t max_fields,
+            size_t& field_count) {
+    while (p_ != end_ && (*p_ == '\n' || *p_ == '\r')) {
+      if (*p_ == '\n') {
+        ++line_;
+      }
+      ++p_;
+    }
+    if (p_ == end_) {
+      return false;
+    }
+    ++line_;
+    field_count = 0;
+    while (true) {
+      const char* field_begin;
+      const char* field_end;
+      const char* p;
+      if (*p_ == '"') {
+        field_begin = p_ + 1;
+        field_end = internal::findByte(field_begin, end_, '"');
+        if (field_end == end_) {
+          error_ = true;
+          return false;
+        }
+        p = field_end + 1;
+      } else {
+        field_begin = p_;
+        p = field_end = internal::findEither(p_, end_, ',', '\n');
+        if (field_end != field_begin && field_end[-1] == '\r') {
+          --field_end;
+        }
+      }
+      if (field_count < max_fields) {
+        fields[field_count] = std::string_view(field_begin, field_end - field_begin);
+      }
+      ++field_count;
+      if (p != end_ && *p == '\r') {
+        ++p;
+      }
+      if (p == end_ || *p == '\n') {
+        p_ = p == end_ ? p : p + 1;
+        return true;
+      }
+      if (*p != ',') {
+        error_ = true;
+        return false;
+      }
+      p_ = p + 1;
+      if (p_ == end_ || *p_ == '\n' || *p_ == '\r') {
+        // a trailing comma ends the line with an empty field
+        if (field_count < max_fields) {
+          fields[field_count] = std::string_view();
+        }
+        ++field_count;
+        while (p_ != end_ && *p_ == '\r') {
+          ++p_;
+        }
+        if (p_ != end_) {
+          ++p_;
+        }
+        return true;
+      }
+    }
+  }
+
+  bool error() const { return error_; }
+  // number of the line last returned by next(), starting from 1
+  size_t line() const { return line_; }
+  const char* position() const { return p_; }
+};
+
+/* splits [begin, end) into at most chunks pieces of roughly equal size, each
+ * piece ending right after a newline (or at end). Returns the chunk
+ * boundaries, chunk i is [ret[i], ret[i + 1]).
+ */
+inline std::vector<const char*> splitLines(const char* begin, const char* end,
+                                           size_t chunks) {
+  std::vector<const char*> ret{begin};
+  size_t chunk_size = (end - begin) / std::max<size_t>(chunks, 1) + 1;
+  while (ret.back() != end) {
+    const char* p = ret.back();
+    if (size_t(end - p) <= chunk_size) {
+      ret.push_back(end);
+    } else {
+      const char* newline = internal::findByte(p + chunk_size, end, '\n');
+      ret.push_back(newline == end ? end : newline + 1);
+    }
+  }
+  return ret;
+}
+
+/* one line of the IP2Location DB3 csv:
+ * "start","end","country code","country","province","city"
+ */
+struct Db3Line {
+  uint32_t start_ip, end_ip;
+  std::string_view country_code, country, province, city;
+};
+
+/* strict validation of the DB3 layout: exactly six fields, numeric ip range
+ * in ascending order and not overlapping the previous line, and a country
+ * code of two upper case letters (or "-" for unallocated ranges)
+ */
+class Db3Parser {
+  static constexpr size_t db3_fields = 6;
+  std::string_view fields_[db3_fields + 1];
+  bool first_ = true;
+  uint32_t last_end_ = 0;
+  const char* error_ = nullptr;
+
+  bool fail(const char* error) {
+    error_ = error;
+    return false;
+  }
+
+  static bool validCountryCode(std::string_view code) {
+    if (code == "-") {
+      return true;
+    }
+    return code.size() == 2 && code[0] >= 'A' && code[0] <= 'Z' &&
+           code[1] >= 'A' && code[1] <= 'Z';
+  }
+
+ public:
+  /* reads the next line of scanner into line, returns false at the end of
+   * input or on the first invalid line, error() is set in the latter case
+   */
+  bool next(CsvScanner& scanner, Db3Line& line) {
+    size_t field_count;
+    if (!scanner.next(fields_, db3_fields + 1, field_count)) {
+      return scanner.error() ? fail("malformed csv line") : false;
+    }
+    if (field_count != db3_fields) {
+      return fail("expected 6 fields");
+    }
+    if (!parseUint32(fields_[0], line.start_ip) ||
+        !parseUint32(fields_[1], line.end_ip)) {
+      return fail("ip range is not a 32-bit decimal number");
+    }
+    if (line.start_ip > line.end_ip) {
+      return fail("range start is greater than range end");
+    }
+    if (!first_ && line.start_ip <= last_end_) {
+      return fail("range is not after the previous range");
+    }
+    if (!validCountryCode(fields_[2])) {
+      return fail("invalid country code");
+    }
+    first_ = false;
+    last_end_ = line.end_ip;
+    line.country_code = fields_[2];
+    line.country = fields_[3];
+    line.province = fields_[4];
+    line.city = fields_[5];
+    return true;
+  }
+
+  const char* error() const { return error_; }
+};
+
+}  // namespace ipq
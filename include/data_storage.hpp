@@ -1,50 +1,193 @@
 #pragma once
 
+#include "array_ref.hpp"
 #include "config.hpp"
+#include "interval_tree.hpp"
 #include "ip.hpp"
 #include "location.hpp"
 #include "member_detecter.hpp"
 
+#include <memory>
 #include <utility>
 
-#include <vector>
-
 namespace ipq {
+
+IPQ_DEFINE_HAS_MEMBER(query);
+IPQ_DEFINE_HAS_MEMBER(queryBatch);
+IPQ_DEFINE_HAS_MEMBER(queryRange);
+IPQ_DEFINE_HAS_MEMBER(queryRangeBatch);
+IPQ_DEFINE_HAS_MEMBER(find);
+IPQ_DEFINE_HAS_MEMBER(find_range);
+IPQ_DEFINE_HAS_MEMBER(update);
+IPQ_DEFINE_HAS_MEMBER(remove);
+IPQ_DEFINE_HAS_MEMBER(updateBlocking);
+IPQ_DEFINE_HAS_MEMBER(batchUpdateBlocking);
+IPQ_DEFINE_HAS_MEMBER(batch_update);
+IPQ_DEFINE_HAS_MEMBER(reader);
+
+// an update of an ip range, a removal if loc is empty
+using IpRangeUpdate = IntervalUpdate<Ip, Location>;
+
+/* the queries of one query thread of an engine that has readers, see
+ * DataStorateConcept::reader()
+ */
+class DataStorageReader {
+public:
+  virtual ~DataStorageReader() = default;
+  virtual void query(ArrayRef<Ip> ips, Location* out) = 0;
+  virtual void query(ArrayRef<Ip> ips, Location* out, IpRange* ranges) = 0;
+};
+
+/* type-erased storage of ip ranges. Queries are not const: a btree may
+ * reshape itself during a lookup. A query for an ip outside every range
+ * returns the default (non-existing) Location.
+ *
+ * The queries with ranges also give the bounds of what they find: the
+ * stored range holding ip, or when ip is in none the largest gap around it
+ * that holds no range. Engines that can not tell the whole range give a
+ * smaller one holding ip, at worst [ip, ip]; every ip of it has the same
+ * answer.
+ */
 class DataStorateConcept {
 public:
-  virtual Location query(Ip ip) const = 0;
-  virtual void updateBlocking(Ip, Location) = 0;
-  virtual void batchUpdateBlocking(ArrayRef<std::pair<Ip, Location>>) = 0;
+  virtual ~DataStorateConcept() = default;
+  virtual Location query(Ip ip) = 0;
+  // out[i] = query(ips[i]), one virtual call for the whole batch
+  virtual void query(ArrayRef<Ip> ips, Location* out) = 0;
+  virtual Location query(Ip ip, IpRange& range) = 0;
+  virtual void query(ArrayRef<Ip> ips, Location* out, IpRange* ranges) = 0;
+  virtual void updateBlocking(Ip start, Ip end, Location loc) = 0;
+  virtual void batchUpdateBlocking(ArrayRef<IpRangeUpdate> updates) = 0;
+
+  /* whether the engine has readers, which query from threads of their own
+   * without locks while one thread updates. An engine without them must be
+   * queried and updated by one thread at a time.
+   */
+  virtual bool hasReaders() const { return false; }
+  // a reader for one more query thread, nullptr if there are no more
+  virtual std::unique_ptr<DataStorageReader> reader() { return nullptr; }
+};
+
+// a DataStorageReader over the reader type of an engine
+template <class ReaderT>
+class DataStorageReaderModel : public DataStorageReader {
+  ReaderT reader_;
+
+public:
+  explicit DataStorageReaderModel(ReaderT reader)
+      : reader_(std::move(reader)) {}
+
+  void query(ArrayRef<Ip> ips, Location* out) override {
+    reader_.query(ips, out);
+  }
+  void query(ArrayRef<Ip> ips, Location* out, IpRange* ranges) override {
+    reader_.query(ips, out, ranges);
+  }
 };
 
+/* adapts a storage implementation to DataStorateConcept, using the best
+ * member ImplT has for each operation: its own query()/queryBatch()/
+ * queryRange()/queryRangeBatch()/updateBlocking()/batchUpdateBlocking(),
+ * otherwise the IntervalTree interface (find(), find_range(), update()/
+ * remove(), batch_update()). ImplT has readers if it has a reader()
+ * returning an optional reader, as RcuStore does.
+ */
 template <class ImplT>
 class DataStorageModel : public DataStorateConcept, private ImplT {
 public:
-  Location query(Ip ip) const override;
-  void updateBlocking(Ip ip, Location loc) override {
-    if constexpr (IPQ_HAS_MEMBER(ImplT, updateBlocking)) {
-      this->ImplT::updateBlocking(loc, ip);
-    } else if
-      constepxr(IPQ_HAS_MEMBER(ImplT, batchUpdateBlocking)) {
-        this->ImplT::batchUpdateBlocking({std::make_pair(ip, loc)});
+  template <typename... ArgTys>
+  explicit DataStorageModel(ArgTys&&... args)
+      : ImplT(std::forward<ArgTys>(args)...) {}
+
+  ImplT& impl() { return *this; }
+
+  Location query(Ip ip) override {
+    if constexpr (IPQ_HAS_MEMBER(ImplT, query)) {
+      return this->ImplT::query(ip);
+    } else if constexpr (IPQ_HAS_MEMBER(ImplT, find)) {
+      auto* loc = this->ImplT::find(ip);
+      return loc ? *loc : Location();
+    } else {
+      IPQ_ASSERT(false && "method not implemented");
+      return Location();
+    }
+  }
+
+  void query(ArrayRef<Ip> ips, Location* out) override {
+    if constexpr (IPQ_HAS_MEMBER(ImplT, queryBatch)) {
+      this->ImplT::queryBatch(ips, out);
+    } else {
+      for (Ip ip : ips) {
+        *out++ = DataStorageModel::query(ip);
+      }
+    }
+  }
+
+  Location query(Ip ip, IpRange& range) override {
+    if constexpr (IPQ_HAS_MEMBER(ImplT, queryRange)) {
+      return this->ImplT::queryRange(ip, range);
+    } else if constexpr (IPQ_HAS_MEMBER(ImplT, find_range)) {
+      auto* loc = this->ImplT::find_range(ip, range.start, range.end);
+      return loc ? *loc : Location();
+    } else {
+      range = {ip, ip};
+      return DataStorageModel::query(ip);
+    }
+  }
+
+  void query(ArrayRef<Ip> ips, Location* out, IpRange* ranges) override {
+    if constexpr (IPQ_HAS_MEMBER(ImplT, queryRangeBatch)) {
+      this->ImplT::queryRangeBatch(ips, out, ranges);
+    } else {
+      for (Ip ip : ips) {
+        *out++ = DataStorageModel::query(ip, *ranges++);
       }
-    else {
+    }
+  }
+
+  void updateBlocking(Ip start, Ip end, Location loc) override {
+    if constexpr (IPQ_HAS_MEMBER(ImplT, updateBlocking)) {
+      this->ImplT::updateBlocking(start, end, loc);
+    } else if constexpr (IPQ_HAS_MEMBER(ImplT, update)) {
+      this->ImplT::update(start, end, loc);
+    } else if constexpr (IPQ_HAS_MEMBER(ImplT, batchUpdateBlocking)) {
+      this->ImplT::batchUpdateBlocking({IpRangeUpdate{start, end, loc}});
+    } else {
       IPQ_ASSERT(false && "method not implemented");
     }
   }
-  void batchUpdateBlocking(ArrayRef<std::pair<Ip, Location>> updates) override {
+
+  void batchUpdateBlocking(ArrayRef<IpRangeUpdate> updates) override {
     if constexpr (IPQ_HAS_MEMBER(ImplT, batchUpdateBlocking)) {
       this->ImplT::batchUpdateBlocking(updates);
-    } else if
-      constepxr(IPQ_HAS_MEMBER(ImplT, updateBlocking)) {
-        for (auto u : updates) {
-          this->ImplT::updateBlocking(u.first, u.second);
+    } else if constexpr (IPQ_HAS_MEMBER(ImplT, batch_update)) {
+      this->ImplT::batch_update(updates);
+    } else if constexpr (IPQ_HAS_MEMBER(ImplT, update) &&
+                         IPQ_HAS_MEMBER(ImplT, remove)) {
+      for (auto& u : updates) {
+        if (u.val) {
+          this->ImplT::update(u.start, u.end, *u.val);
+        } else {
+          this->ImplT::remove(u.start, u.end);
         }
       }
-    else {
+    } else {
       IPQ_ASSERT(false && "method not implemented");
     }
   }
-};
-}; // namespace ipq
 
+  bool hasReaders() const override { return IPQ_HAS_MEMBER(ImplT, reader); }
+
+  std::unique_ptr<DataStorageReader> reader() override {
+    if constexpr (IPQ_HAS_MEMBER(ImplT, reader)) {
+      auto reader = this->ImplT::reader();
+      if (reader) {
+        using ReaderT = typename decltype(reader)::value_type;
+        return std::unique_ptr<DataStorageReader>(
+            new DataStorageReaderModel<ReaderT>(std::move(*reader)));
+      }
+    }
+    return nullptr;
+  }
+};
+}  // namespace ipq
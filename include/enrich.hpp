@@ -0,0 +1,208 @@
+#pragma once
+
+#include "array_ref.hpp"
+#include "csv_scanner.hpp"
+#include "ip.hpp"
+#include "location.hpp"
+#include "location_names.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace ipq {
+
+struct EnrichStats {
+  size_t lines = 0, found = 0, invalid = 0;
+};
+
+/* bulk enrichment of a file of addresses, one per line as parseIpLines takes
+ * them, into a tsv with for every input line, in input order:
+ *   line<TAB>country_code<TAB>country_name<TAB>province<TAB>city
+ * with "-" for the four names of a line that is not found or holds no
+ * address.
+ *
+ * The input is mapped and cut into line-aligned chunks that worker threads
+ * take in turn. A worker runs every chunk through parse, lookup and format,
+ * a batch of lines at a time so that each batch stays in cache across the
+ * three steps; lookup(ArrayRef<Ip> ips, Location* out) is called from all
+ * workers at once. The calling thread writes the formatted chunks in order,
+ * each with one large write; workers stay at most a few chunks ahead of it,
+ * which bounds the memory to a few chunks per thread.
+ */
+class Enricher {
+  struct Chunk {
+    std::string out;
+    EnrichStats stats;
+    bool done = false;
+  };
+
+  // the names columns of every country and city, rendered once
+  std::vector<std::string> countries_, cities_;
+  unsigned threads_;
+  size_t chunk_bytes_;
+
+  static constexpr size_t BatchBytes = 64 << 10;
+  static constexpr const char* Missing = "-\t-\t-\t-\n";
+
+  template <typename LookupTy>
+  void enrichChunk(const char* begin, const char* end, LookupTy& lookup,
+                   Chunk& chunk) const {
+    std::vector<Ip> ips;
+    std::vector<uint8_t> valid;
+    std::vector<Location> locs;
+    chunk.out.reserve(size_t(end - begin) * 3);
+    auto batches = splitLines(begin, end, size_t(end - begin) / BatchBytes);
+    for (size_t b = 0; b + 1 < batches.size(); ++b) {
+      std::string_view text(batches[b], batches[b + 1] - batches[b]);
+      ips.clear();
+      valid.clear();
+      size_t lines = parseIpLines(text, ips, valid);
+      locs.resize(lines);
+      lookup(ArrayRef<Ip>(ips), locs.data());
+      const char* p = text.data();
+      const char* text_end = p + text.size();
+      for (size_t i = 0; i < lines; ++i) {
+        auto eol = static_cast<const char*>(std::memchr(p, '\n', text_end - p));
+        eol = eol ? eol : text_end;
+        size_t len = eol - p;
+        len -= len && p[len - 1] == '\r';
+        chunk.out.append(p, len);
+        chunk.out += '\t';
+        p = eol == text_end ? text_end : eol + 1;
+        if (!valid[i]) {
+          ++chunk.stats.invalid;
+        } else if (!(locs[i] == Location())) {
+          ++chunk.stats.found;
+          chunk.out += countries_[locs[i].getProvinceCode()];
+          chunk.out += '\t';
+          chunk.out += cities_[locs[i].getCountryCode()];
+          chunk.out += '\n';
+          continue;
+        }
+        chunk.out += Missing;
+      }
+      chunk.stats.lines += lines;
+    }
+  }
+
+  static bool writeAll(int fd, const std::string& data) {
+    for (size_t written = 0; written < data.size();) {
+      ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+      written += n;
+    }
+    return true;
+  }
+
+ public:
+  // names must not change while the Enricher is used
+  Enricher(const LocationNames& names, unsigned threads,
+           size_t chunk_bytes = 1 << 20)
+      : threads_(std::max(1u, threads)),
+        chunk_bytes_(std::max<size_t>(chunk_bytes, 1)) {
+    for (uint32_t country = 0; country < names.countries(); ++country) {
+      countries_.push_back(std::string(names.countryCode(country)) + '\t' +
+                           std::string(names.countryName(country)));
+    }
+    for (uint32_t city = 0; city < names.cities(); ++city) {
+      cities_.push_back(std::string(names.province(city)) + '\t' +
+                        std::string(names.cityName(city)));
+    }
+  }
+
+  /* enriches the file at in_path into a new file at out_path, false with
+   * error set if either can not be opened or the output can not be written
+   */
+  template <typename LookupTy>
+  bool run(const char* in_path, const char* out_path, LookupTy lookup,
+           EnrichStats& stats, std::string& error) const {
+    MappedFile in(in_path);
+    if (!in) {
+      error = std::string("can not open ") + in_path;
+      return false;
+    }
+    int fd = ::open(out_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      error = std::string("can not create ") + out_path;
+      return false;
+    }
+    auto bounds = splitLines(in.begin(), in.end(),
+                             std::max<size_t>(threads_, in.size() / chunk_bytes_));
+    std::vector<Chunk> chunks(bounds.size() - 1);
+    // chunks handed out, and written by the calling thread
+    size_t next = 0, written = 0;
+    const size_t window = 2 * size_t(threads_);
+    bool failed = false;
+    std::mutex mutex;
+    std::condition_variable taken_cv, done_cv;
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < std::min<size_t>(threads_, chunks.size()); ++t) {
+      workers.emplace_back([&]() {
+        while (true) {
+          size_t i;
+          {
+            std::unique_lock<std::mutex> lock(mutex);
+            taken_cv.wait(lock, [&]() {
+              return failed || next >= chunks.size() ||
+                     next < written + window;
+            });
+            if (failed || next >= chunks.size()) {
+              return;
+            }
+            i = next++;
+          }
+          enrichChunk(bounds[i], bounds[i + 1], lookup, chunks[i]);
+          std::lock_guard<std::mutex> lock(mutex);
+          chunks[i].done = true;
+          done_cv.notify_all();
+        }
+      });
+    }
+    stats = EnrichStats();
+    for (size_t i = 0; i < chunks.size() && !failed; ++i) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [&]() { return chunks[i].done; });
+      }
+      Chunk& chunk = chunks[i];
+      if (!writeAll(fd, chunk.out)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        failed = true;
+      }
+      stats.lines += chunk.stats.lines;
+      stats.found += chunk.stats.found;
+      stats.invalid += chunk.stats.invalid;
+      chunk.out = std::string();
+      std::lock_guard<std::mutex> lock(mutex);
+      ++written;
+      taken_cv.notify_all();
+    }
+    taken_cv.notify_all();
+    for (auto& worker : workers) {
+      worker.join();
+    }
+    if (::close(fd) < 0 || failed) {
+      error = std::string("can not write ") + out_path;
+      return false;
+    }
+    return true;
+  }
+};
+
+}  // namespace ipq
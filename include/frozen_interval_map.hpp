@@ -0,0 +1,154 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ipq {
+
+/* read-only interval map over uint32_t keys, laid out for lookups: sorted
+ * arrays of range starts, ends and values, plus a jump table giving for every
+ * /16 the first range starting in it, so that a lookup is one table access
+ * and a binary search among the ranges starting in one /16. The map either
+ * owns its arrays (build()) or views arrays stored elsewhere, for example in
+ * a mapped ipqdb file (view()).
+ */
+class FrozenIntervalMap {
+ public:
+  static constexpr unsigned int prefix_shift = 16;
+  static constexpr size_t prefix_entries = (size_t(1) << (32 - prefix_shift)) + 1;
+
+ private:
+  const uint32_t* starts_ = nullptr;
+  const uint32_t* ends_ = nullptr;
+  const uint32_t* values_ = nullptr;
+  // prefix_[p] is the number of ranges starting before p << prefix_shift
+  const uint32_t* prefix_ = nullptr;
+  size_t size_ = 0;
+  std::vector<uint32_t> owned_;
+
+  // index of the last range starting at or before key, or size_
+  size_t lastStartingBefore(uint32_t key) const {
+    size_t prefix = key >> prefix_shift;
+    const uint32_t* first = starts_ + prefix_[prefix];
+    const uint32_t* last = starts_ + prefix_[prefix + 1];
+    size_t idx = std::upper_bound(first, last, key) - starts_;
+    return idx ? idx - 1 : size_;
+  }
+
+ public:
+  FrozenIntervalMap() = default;
+  FrozenIntervalMap(const FrozenIntervalMap&) = delete;
+  FrozenIntervalMap& operator=(const FrozenIntervalMap&) = delete;
+
+  /* fills prefix (prefix_entries entries) for the sorted starts
+   */
+  static void buildPrefixIndex(const uint32_t* starts, size_t size,
+                               uint32_t* prefix) {
+    size_t idx = 0;
+    for (size_t p = 0; p + 1 < prefix_entries; ++p) {
+      uint32_t prefix_start = uint32_t(p) << prefix_shift;
+      while (idx < size && starts[idx] < prefix_start) {
+        ++idx;
+      }
+      prefix[p] = idx;
+    }
+    prefix[prefix_entries - 1] = size;
+  }
+
+  /* builds an owning map from ranges, a sequence of (start, end, value)
+   * sorted by start and not overlapping, given as the callback
+   * for_each_range(emit) calling emit(start, end, value) for each range
+   */
+  template <typename ForEachTy>
+  void build(size_t size, ForEachTy for_each_range) {
+    owned_.assign(3 * size + prefix_entries, 0);
+    uint32_t* starts = owned_.data();
+    uint32_t* ends = starts + size;
+    uint32_t* values = ends + size;
+    uint32_t* prefix = values + size;
+    size_t idx = 0;
+    for_each_range([&](uint32_t start, uint32_t end, uint32_t value) {
+      IPQ_ASSERT(idx < size);
+      IPQ_ASSERT(!idx || ends[idx - 1] < start);
+      starts[idx] = start;
+      ends[idx] = end;
+      values[idx] = value;
+      ++idx;
+    });
+    IPQ_ASSERT(idx == size);
+    buildPrefixIndex(starts, size, prefix);
+    view(starts, ends, values, prefix, size);
+  }
+
+  void view(const uint32_t* starts, const uint32_t* ends,
+            const uint32_t* values, const uint32_t* prefix, size_t size) {
+    starts_ = starts;
+    ends_ = ends;
+    values_ = values;
+    prefix_ = prefix;
+    size_ = size;
+  }
+
+  /* the index of the range containing key, or size()
+   */
+  size_t findIndex(uint32_t key) const {
+    if (!prefix_) {
+      return size_;
+    }
+    size_t idx = lastStartingBefore(key);
+    return idx == size_ || ends_[idx] < key ? size_ : idx;
+  }
+
+  /* the value of the range containing key, or nullptr
+   */
+  const uint32_t* find(uint32_t key) const {
+    size_t idx = findIndex(key);
+    return idx == size_ ? nullptr : values_ + idx;
+  }
+
+  /* find(key), with [start, end] set to the range containing key, or when
+   * there is none to the largest gap around key that no range intersects
+   */
+  const uint32_t* findRange(uint32_t key, uint32_t& start,
+                            uint32_t& end) const {
+    size_t idx = prefix_ ? lastStartingBefore(key) : size_;
+    if (idx != size_ && key <= ends_[idx]) {
+      start = starts_[idx];
+      end = ends_[idx];
+      return values_ + idx;
+    }
+    size_t next = idx == size_ ? 0 : idx + 1;
+    start = idx == size_ ? 0 : ends_[idx] + 1;
+    end = next < size_ ? starts_[next] - 1 : UINT32_MAX;
+    return nullptr;
+  }
+
+  /* calls callback(start, end, value) for every range intersecting
+   * [key1, key2], in ascending order of start
+   */
+  template <typename CallbackTy>
+  void for_each_overlapping(uint32_t key1, uint32_t key2,
+                            CallbackTy callback) const {
+    if (!prefix_) {
+      return;
+    }
+    size_t idx = lastStartingBefore(key1);
+    if (idx == size_ || ends_[idx] < key1) {
+      idx = idx == size_ ? 0 : idx + 1;
+    }
+    for (; idx < size_ && starts_[idx] <= key2; ++idx) {
+      callback(starts_[idx], ends_[idx], values_[idx]);
+    }
+  }
+
+  size_t size() const { return size_; }
+  uint32_t start(size_t idx) const { return starts_[idx]; }
+  uint32_t end(size_t idx) const { return ends_[idx]; }
+  uint32_t value(size_t idx) const { return values_[idx]; }
+};
+
+}  // namespace ipq
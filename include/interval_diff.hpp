@@ -0,0 +1,115 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace ipq {
+
+/* the edit turning one set of ranges into another, found by walking both in
+ * order of start. Ranges are given as iterators over
+ * (start, (end, value)) pairs, the layout of IntervalTree::keys, sorted by
+ * start and not overlapping.
+ *
+ * The edit is the minimal sequence of update(start, end, value) and
+ * remove(start, end) operations, in ascending order of start: points whose
+ * value is the same on both sides are left out, and neighbouring points
+ * getting the same new value (or being removed) are joined into one
+ * operation, whatever the range boundaries on either side. An update of
+ * points that all were empty before is an addition, otherwise it is a change.
+ */
+template <typename KeyTy, typename ValTy>
+struct IntervalDiff {
+  struct Stats {
+    size_t added = 0, changed = 0, removed = 0;
+  };
+
+  /* calls on_update(start, end, value, added) and on_remove(start, end) for
+   * every operation of the edit from [old_iter, old_end) to
+   * [new_iter, new_end)
+   */
+  template <typename OldIterTy, typename NewIterTy, typename UpdateTy,
+            typename RemoveTy>
+  static Stats diff(OldIterTy old_iter, OldIterTy old_end, NewIterTy new_iter,
+                    NewIterTy new_end, UpdateTy on_update,
+                    RemoveTy on_remove) {
+    // 64-bit positions, so that the end of the key space can be stepped over
+    using PosTy = uint64_t;
+    enum class Op { None, Update, Remove };
+    Stats stats;
+    Op op = Op::None;
+    PosTy op_start = 0, op_end = 0;
+    const ValTy* op_val = nullptr;
+    bool op_added = false;
+    auto flush = [&]() {
+      if (op == Op::Update) {
+        on_update(KeyTy(op_start), KeyTy(op_end), *op_val, op_added);
+        ++(op_added ? stats.added : stats.changed);
+      } else if (op == Op::Remove) {
+        on_remove(KeyTy(op_start), KeyTy(op_end));
+        ++stats.removed;
+      }
+      op = Op::None;
+    };
+
+    PosTy pos = 0;
+    while (old_iter != old_end || new_iter != new_end) {
+      bool in_old = old_iter != old_end && PosTy(old_iter->first) <= pos;
+      bool in_new = new_iter != new_end && PosTy(new_iter->first) <= pos;
+      if (!in_old && !in_new) {
+        // a gap on both sides
+        flush();
+        pos = std::min(
+            old_iter != old_end ? PosTy(old_iter->first) : UINT64_MAX,
+            new_iter != new_end ? PosTy(new_iter->first) : UINT64_MAX);
+        continue;
+      }
+      // the segment [pos, seg_end] lies in no more than one range per side
+      PosTy seg_end = UINT64_MAX;
+      if (old_iter != old_end) {
+        seg_end = in_old ? PosTy(old_iter->second.first)
+                         : PosTy(old_iter->first) - 1;
+      }
+      if (new_iter != new_end) {
+        seg_end = std::min(seg_end, in_new ? PosTy(new_iter->second.first)
+                                           : PosTy(new_iter->first) - 1);
+      }
+      if (in_new && (!in_old || !(old_iter->second.second ==
+                                  new_iter->second.second))) {
+        const ValTy& val = new_iter->second.second;
+        if (op == Op::Update && op_end + 1 == pos && *op_val == val) {
+          op_added = op_added && !in_old;
+        } else {
+          flush();
+          op = Op::Update;
+          op_start = pos;
+          op_val = &val;
+          op_added = !in_old;
+        }
+        op_end = seg_end;
+      } else if (!in_new) {
+        if (op != Op::Remove || op_end + 1 != pos) {
+          flush();
+          op = Op::Remove;
+          op_start = pos;
+        }
+        op_end = seg_end;
+      } else {
+        flush();
+      }
+      if (in_old && PosTy(old_iter->second.first) == seg_end) {
+        ++old_iter;
+      }
+      if (in_new && PosTy(new_iter->second.first) == seg_end) {
+        ++new_iter;
+      }
+      pos = seg_end + 1;
+    }
+    flush();
+    return stats;
+  }
+};
+
+}  // namespace ipq
@@ -1,68 +1,339 @@
 #pragma once
 
+#include "array_ref.hpp"
+#include "config.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
 #include <map>
+#include <optional>
+#include <queue>
 #include <utility>
+#include <vector>
 
 namespace ipq {
-template <typename KeyTy, typename ValTy, typename MapTy>
+template <typename IterTy>
+struct IteratorRange {
+  IterTy first, last;
+  IterTy begin() { return first; }
+  IterTy end() { return last; }
+};
+
+/* IntervalTree reports every range it stores or drops to its listener, a
+ * listener keeps secondary indexes derived from the tree up to date. Shrinking
+ * a range is reported as erasing the old range and inserting the new one.
+ */
+template <typename KeyTy, typename ValTy>
+struct NullIntervalListener {
+  void inserted(KeyTy, KeyTy, const ValTy&) {}
+  void erased(KeyTy, KeyTy, const ValTy&) {}
+};
+
+/* forwards the notifications to several listeners, get<ListenerTy>() gives
+ * access to one of them
+ */
+template <typename... ListenerTys>
+struct IntervalListeners : ListenerTys... {
+  template <typename KeyTy, typename ValTy>
+  void inserted(KeyTy start, KeyTy end, const ValTy& val) {
+    (this->ListenerTys::inserted(start, end, val), ...);
+  }
+  template <typename KeyTy, typename ValTy>
+  void erased(KeyTy start, KeyTy end, const ValTy& val) {
+    (this->ListenerTys::erased(start, end, val), ...);
+  }
+  template <typename ListenerTy>
+  ListenerTy& get() {
+    return *this;
+  }
+};
+
+/* one element of IntervalTree::batch_update(): stores val in [start, end],
+ * or removes [start, end] if val is empty; start <= end
+ */
+template <typename KeyTy, typename ValTy>
+struct IntervalUpdate {
+  KeyTy start, end;
+  std::optional<ValTy> val;
+};
+
+template <typename KeyTy, typename ValTy, typename MapTy,
+          typename ListenerTy = NullIntervalListener<KeyTy, ValTy>>
 struct IntervalTree {
   MapTy keys;
+  ListenerTy listener;
+  using iterator = typename MapTy::iterator;
 
- public:
-  ValTy* find(KeyTy key) {
+ private:
+  /* the first stored range whose end is not less than key, all ranges before
+   * it end before key
+   */
+  iterator firstEndingAfter(KeyTy key) {
     auto iter = keys.upper_bound(key);
-    if (iter == keys.begin()) {
-      return nullptr;
-    }
-    --iter;
-    if (key <= iter->second.first) {
-      return &iter->second.second;
-    } else {
-      return nullptr;
+    if (iter != keys.begin()) {
+      --iter;
+      if (iter->second.first < key) {
+        ++iter;
+      }
     }
+    return iter;
   }
 
-  void update(KeyTy key1, KeyTy key2, ValTy val) {
+  iterator eraseRange(iterator iter) {
+    listener.erased(iter->first, iter->second.first, iter->second.second);
+    return keys.erase(iter);
+  }
+
+  iterator emplaceRange(KeyTy key1, const std::pair<KeyTy, ValTy>& range) {
+    auto iter = keys.emplace(key1, range).first;
+    listener.inserted(key1, range.first, range.second);
+    return iter;
+  }
+
+  /* drop [key1, key2] from the stored ranges, trimming the ranges that
+   * partially overlap it
+   */
+  void cut(KeyTy key1, KeyTy key2) {
     auto iter = keys.lower_bound(key1);
-    if (iter != keys.end()) {
-    }
     while (iter != keys.end() && iter->second.first <= key2) {
-      iter = keys.erase(iter);
+      iter = eraseRange(iter);
     }
     if (iter != keys.end() && iter->first <= key2) {
       auto old_val = iter->second;
-      keys.erase(iter);
-      iter = keys.emplace(key2 + 1, old_val).first;
+      eraseRange(iter);
+      iter = emplaceRange(key2 + 1, old_val);
     }
-    iter = keys.emplace(key1, std::make_pair(key2, val)).first;
     if (iter != keys.begin() && (--iter)->second.first >= key1) {
       auto old_val = iter->second;
+      listener.erased(iter->first, old_val.first, old_val.second);
       iter->second.first = key1 - 1;
+      listener.inserted(iter->first, key1 - 1, old_val.second);
       if (old_val.first > key2) {
-        keys.emplace(key2 + 1, old_val);
+        emplaceRange(key2 + 1, old_val);
+      }
+    }
+  }
+
+  /* the disjoint pieces of updates, sorted, each key getting the last
+   * update covering it. Sweeps the updates in order of start, keeping those
+   * covering the current key in a heap by position in updates.
+   */
+  static std::vector<IntervalUpdate<KeyTy, ValTy>> disjointPieces(
+      ArrayRef<IntervalUpdate<KeyTy, ValTy>> updates) {
+    std::vector<size_t> order(updates.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return updates[a].start < updates[b].start;
+    });
+    std::vector<IntervalUpdate<KeyTy, ValTy>> pieces;
+    std::vector<size_t> piece_origin;
+    // 64-bit positions, so that the end of the key space can be stepped over
+    using PosTy = uint64_t;
+    std::priority_queue<size_t> active;
+    size_t next = 0;
+    PosTy pos = 0;
+    while (next < order.size() || !active.empty()) {
+      if (active.empty()) {
+        pos = updates[order[next]].start;
+      }
+      for (; next < order.size() && updates[order[next]].start <= pos; ++next) {
+        active.push(order[next]);
+      }
+      while (!active.empty() && PosTy(updates[active.top()].end) < pos) {
+        active.pop();
+      }
+      if (active.empty()) {
+        continue;
+      }
+      size_t top = active.top();
+      PosTy end = updates[top].end;
+      if (next < order.size()) {
+        end = std::min(end, PosTy(updates[order[next]].start) - 1);
+      }
+      if (!pieces.empty() && piece_origin.back() == top &&
+          PosTy(pieces.back().end) + 1 == pos) {
+        pieces.back().end = end;
+      } else {
+        pieces.push_back({KeyTy(pos), KeyTy(end), updates[top].val});
+        piece_origin.push_back(top);
+      }
+      pos = end + 1;
+    }
+    return pieces;
+  }
+
+  /* batch_update() of many sorted, disjoint updates: builds the new map in
+   * key order from the old ranges and the updates, then swaps it in. The
+   * listener sees the same notifications as with cut() and emplaceRange().
+   */
+  void rebuild(const std::vector<IntervalUpdate<KeyTy, ValTy>>& updates) {
+    MapTy merged;
+    auto emit = [&](KeyTy start, KeyTy end, const ValTy& val, bool notify) {
+      merged.emplace_hint(merged.end(), start, std::make_pair(end, val));
+      if (notify) {
+        listener.inserted(start, end, val);
+      }
+    };
+    // the old range being merged, its start moves up as updates cut it
+    auto iter = keys.begin();
+    bool has_old = false, touched = false;
+    KeyTy old_start{}, old_end{};
+    std::optional<ValTy> old_val;
+    auto next_old = [&]() {
+      has_old = iter != keys.end();
+      if (has_old) {
+        old_start = iter->first;
+        old_end = iter->second.first;
+        old_val = iter->second.second;
+        touched = false;
+        ++iter;
+      }
+    };
+    next_old();
+    for (auto& u : updates) {
+      while (has_old && old_end < u.start) {
+        emit(old_start, old_end, *old_val, touched);
+        next_old();
+      }
+      while (has_old && old_start <= u.end) {
+        if (!touched) {
+          listener.erased(old_start, old_end, *old_val);
+          touched = true;
+        }
+        if (old_start < u.start) {
+          emit(old_start, u.start - 1, *old_val, true);
+        }
+        if (old_end > u.end) {
+          old_start = u.end + 1;
+          break;
+        }
+        next_old();
+      }
+      if (u.val) {
+        emit(u.start, u.end, *u.val, true);
       }
     }
+    while (has_old) {
+      emit(old_start, old_end, *old_val, touched);
+      next_old();
+    }
+    keys.swap(merged);
+  }
+
+ public:
+  ValTy* find(KeyTy key) {
+    auto iter = keys.upper_bound(key);
+    if (iter == keys.begin()) {
+      return nullptr;
+    }
+    --iter;
+    if (key <= iter->second.first) {
+      return &iter->second.second;
+    } else {
+      return nullptr;
+    }
+  }
+
+  /* find(key), with [start, end] set to the stored range containing key,
+   * or when there is none to the largest gap around key that no stored range
+   * intersects
+   */
+  ValTy* find_range(KeyTy key, KeyTy& start, KeyTy& end) {
+    auto iter = keys.upper_bound(key);
+    end = iter == keys.end() ? std::numeric_limits<KeyTy>::max()
+                             : iter->first - 1;
+    if (iter == keys.begin()) {
+      start = std::numeric_limits<KeyTy>::min();
+      return nullptr;
+    }
+    --iter;
+    if (key <= iter->second.first) {
+      start = iter->first;
+      end = iter->second.first;
+      return &iter->second.second;
+    }
+    start = iter->second.first + 1;
+    return nullptr;
+  }
+
+  void update(KeyTy key1, KeyTy key2, ValTy val) {
+    cut(key1, key2);
+    emplaceRange(key1, std::make_pair(key2, val));
   }
 
   void remove(KeyTy key1, KeyTy key2) {
-    auto iter = keys.lower_bound(key1);
-    while (iter != keys.end() && iter->second.first <= key2) {
-      iter = keys.erase(iter);
+    cut(key1, key2);
+  }
+
+  /* stores [key1, key2] after every stored range, key1 must be greater than
+   * the end of the last range. Used to bulk build the tree from sorted,
+   * non-overlapping ranges with hinted insertion instead of update().
+   */
+  void append(KeyTy key1, KeyTy key2, ValTy val) {
+    IPQ_ASSERT(keys.empty() || (--keys.end())->second.first < key1);
+    keys.emplace_hint(keys.end(), key1, std::make_pair(key2, val));
+    listener.inserted(key1, key2, val);
+  }
+
+  /* applies updates as if update()/remove() was called for each of them in
+   * order, so a later update wins where two overlap; every update must have
+   * start <= end. The updates are sorted and made disjoint first, then
+   * merged into the tree in one ordered pass: a batch touching a large part
+   * of the tree rebuilds it by walking the old ranges and the updates side
+   * by side, a smaller one updates in key order.
+   */
+  void batch_update(ArrayRef<IntervalUpdate<KeyTy, ValTy>> updates) {
+    std::vector<IntervalUpdate<KeyTy, ValTy>> sorted;
+    sorted.reserve(updates.size());
+    for (auto& u : updates) {
+      IPQ_ASSERT(u.start <= u.end);
+      sorted.push_back(u);
     }
-    if (iter != keys.end() && iter->first <= key2) {
-      auto old_val = iter->second;
-      keys.erase(iter);
-      iter = keys.emplace(key2 + 1, old_val).first;
+    std::sort(sorted.begin(), sorted.end(),
+              [](const auto& a, const auto& b) { return a.start < b.start; });
+    bool disjoint = true;
+    for (size_t i = 1; i < sorted.size() && disjoint; ++i) {
+      disjoint = sorted[i - 1].end < sorted[i].start;
     }
-    if (iter != keys.begin() && (--iter)->second.first >= key1) {
-      auto old_val = iter->second;
-      iter->second.first = key1 - 1;
-      if (old_val.first > key2) {
-        keys.emplace(key2 + 1, old_val);
+    if (!disjoint) {
+      sorted = disjointPieces(updates);
+    }
+    if (sorted.size() * 4 < keys.size()) {
+      for (auto& u : sorted) {
+        cut(u.start, u.end);
+        if (u.val) {
+          emplaceRange(u.start, std::make_pair(u.end, *u.val));
+        }
       }
+    } else {
+      rebuild(sorted);
     }
   }
 
+  /* calls callback(start, end, val) for every stored range intersecting
+   * [key1, key2], in ascending order of start
+   */
+  template <typename CallbackTy>
+  void for_each_overlapping(KeyTy key1, KeyTy key2, CallbackTy callback) {
+    auto iter = firstEndingAfter(key1);
+    auto last = keys.end();
+    for (; iter != last && iter->first <= key2; ++iter) {
+      callback(iter->first, iter->second.first, iter->second.second);
+    }
+  }
+
+  /* iterator form of for_each_overlapping, the elements are the underlying
+   * (start, (end, val)) pairs. As with the underlying map, modifying the tree
+   * invalidates the range.
+   */
+  IteratorRange<iterator> overlapping(KeyTy key1, KeyTy key2) {
+    return {firstEndingAfter(key1), keys.upper_bound(key2)};
+  }
+
   size_t size() {
     return keys.size();
   }
@@ -0,0 +1,334 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace ipq {
+
+// an IPv4 address in host byte order
+using Ip = uint32_t;
+
+// an IPv6 address, its bytes in network order
+using Ip6 = std::array<uint8_t, 16>;
+
+// the addresses from start to end, both included
+struct IpRange {
+  Ip start = 0, end = 0;
+};
+
+/* parses a decimal number in [0, 2^32), the whole string must be digits
+ */
+inline bool parseUint32(std::string_view str, uint32_t& ret) {
+  if (str.empty() || str.size() > 10) {
+    return false;
+  }
+  uint64_t v = 0;
+  for (char c : str) {
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    v = v * 10 + (c - '0');
+  }
+  if (v > UINT32_MAX) {
+    return false;
+  }
+  ret = v;
+  return true;
+}
+
+namespace internal {
+
+/* a dotted quad of exactly four decimal octets up to 255, without leading
+ * zeros ("01.2.3.4" would be octal to inet_aton), as inet_pton accepts it
+ */
+inline bool parseDottedQuadScalar(std::string_view str, Ip& ip) {
+  uint32_t ret = 0;
+  size_t p = 0;
+  for (int octet = 0; octet < 4; ++octet) {
+    if (octet && (p >= str.size() || str[p++] != '.')) {
+      return false;
+    }
+    size_t start = p;
+    uint32_t v = 0;
+    for (; p < str.size() && p - start < 4 && str[p] >= '0' && str[p] <= '9';
+         ++p) {
+      v = v * 10 + (str[p] - '0');
+    }
+    size_t digits = p - start;
+    if (!digits || digits > 3 || v > 255 || (digits > 1 && str[start] == '0')) {
+      return false;
+    }
+    ret = (ret << 8) | v;
+  }
+  if (p != str.size()) {
+    return false;
+  }
+  ip = ret;
+  return true;
+}
+
+#ifdef __SSE2__
+/* the dotted quad in the first len bytes of chunk, 7 <= len <= 15, what
+ * follows them is ignored. Every byte is classified at once, the layout of
+ * the octets is checked on the masks and the octets are summed up without
+ * branches on the characters.
+ */
+inline bool parseDottedQuadSse2(__m128i chunk, unsigned len, Ip& ip) {
+  const unsigned in = (1u << len) - 1;
+  __m128i digits = _mm_sub_epi8(chunk, _mm_set1_epi8('0'));
+  // as unsigned bytes, digits are exactly those up to 9
+  __m128i is_digit =
+      _mm_cmpeq_epi8(_mm_min_epu8(digits, _mm_set1_epi8(9)), digits);
+  unsigned digit_mask = unsigned(_mm_movemask_epi8(is_digit)) & in;
+  unsigned dots =
+      unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('.')))) &
+      in;
+  // exactly three dots: three bits cleared leave none, two leave one
+  unsigned two = dots & (dots - 1);
+  two &= two - 1;
+  if ((digit_mask | dots) != in || !two || (two & (two - 1))) {
+    return false;
+  }
+  // a 0 starting an octet and followed by a digit
+  unsigned zeros =
+      unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('0'))));
+  unsigned starts = 1 | dots << 1;
+  if (starts & zeros & digit_mask >> 1) {
+    return false;
+  }
+  unsigned p1 = __builtin_ctz(dots);
+  dots &= dots - 1;
+  unsigned p2 = __builtin_ctz(dots);
+  dots &= dots - 1;
+  unsigned p3 = __builtin_ctz(dots);
+  const unsigned begin[4] = {0, p1 + 1, p2 + 1, p3 + 1};
+  const unsigned size[4] = {p1, p2 - p1 - 1, p3 - p2 - 1, len - p3 - 1};
+  alignas(16) uint8_t d[16];
+  _mm_store_si128(reinterpret_cast<__m128i*>(d), digits);
+  uint32_t ret = 0;
+  bool ok = true;
+  for (int octet = 0; octet < 4; ++octet) {
+    unsigned b = begin[octet], n = size[octet], last = b + n - 1;
+    // the tens and hundreds are read anyway and weighted by 0 if missing
+    uint32_t v = d[last & 15] + (n > 1) * 10 * d[(last - 1) & 15] +
+                 (n > 2) * 100 * d[b & 15];
+    ok &= n - 1 < 3 && v <= 255;
+    ret = ret << 8 | (v & 255);
+  }
+  if (ok) {
+    ip = ret;
+  }
+  return ok;
+}
+#endif
+
+// a dotted quad, on the SSE2 path from two overlapping loads of str
+inline bool parseDottedQuad(std::string_view str, Ip& ip) {
+#ifdef __SSE2__
+  size_t size = str.size();
+  if (size < 7 || size > 15) {
+    return false;
+  }
+  uint64_t lo = 0, hi = 0;
+  if (size == 7) {
+    std::memcpy(&lo, str.data(), 7);
+  } else {
+    std::memcpy(&lo, str.data(), 8);
+  }
+  if (size > 8) {
+    // the bytes from 8 on, the last 8 shifted down past those before
+    std::memcpy(&hi, str.data() + size - 8, 8);
+    hi >>= (16 - size) * 8;
+  }
+  return parseDottedQuadSse2(_mm_set_epi64x(int64_t(hi), int64_t(lo)),
+                             unsigned(size), ip);
+#else
+  return parseDottedQuadScalar(str, ip);
+#endif
+}
+
+inline int hexDigit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  c |= 0x20;
+  return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+}  // namespace internal
+
+/* parses an IPv6 address as inet_pton does: eight groups of up to four hex
+ * digits, one run of zero groups written as "::", and the last two groups
+ * optionally written as a dotted quad ("::ffff:1.2.3.4"); false if str is
+ * none
+ */
+inline bool parseIp6(std::string_view str, Ip6& ip) {
+  uint8_t bytes[16] = {};
+  size_t pos = 0, p = 0;
+  // where "::" stands, -1 if it does not
+  int gap = -1;
+  if (str.size() >= 2 && str[0] == ':') {
+    if (str[1] != ':') {
+      return false;
+    }
+    gap = 0;
+    p = 2;
+  }
+  while (p < str.size()) {
+    size_t start = p;
+    uint32_t v = 0;
+    int digit;
+    for (; p < str.size() && (digit = internal::hexDigit(str[p])) >= 0; ++p) {
+      if (p - start == 4) {
+        return false;
+      }
+      v = v << 4 | uint32_t(digit);
+    }
+    if (p < str.size() && str[p] == '.') {
+      // a dotted quad ends the address
+      Ip v4;
+      if (pos > 12 || !internal::parseDottedQuadScalar(str.substr(start), v4)) {
+        return false;
+      }
+      for (int i = 0; i < 4; ++i) {
+        bytes[pos++] = uint8_t(v4 >> (24 - 8 * i));
+      }
+      p = str.size();
+      break;
+    }
+    if (p == start || pos == 16) {
+      return false;
+    }
+    bytes[pos++] = uint8_t(v >> 8);
+    bytes[pos++] = uint8_t(v);
+    if (p == str.size()) {
+      break;
+    }
+    if (str[p] != ':' || ++p == str.size()) {
+      return false;
+    }
+    if (str[p] == ':') {
+      if (gap >= 0) {
+        return false;
+      }
+      gap = int(pos);
+      ++p;
+    }
+  }
+  if (gap >= 0) {
+    // the gap stands for at least one group
+    if (pos == 16) {
+      return false;
+    }
+    size_t tail = pos - gap;
+    std::memmove(bytes + 16 - tail, bytes + gap, tail);
+    std::memset(bytes + gap, 0, 16 - tail - gap);
+  } else if (pos != 16) {
+    return false;
+  }
+  std::memcpy(ip.data(), bytes, 16);
+  return true;
+}
+
+// the IPv4 address of an IPv4-mapped IPv6 one (::ffff:a.b.c.d)
+inline bool mappedIpv4(const Ip6& ip6, Ip& ip) {
+  static const uint8_t mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+  if (std::memcmp(ip6.data(), mapped, 12)) {
+    return false;
+  }
+  ip = Ip(ip6[12]) << 24 | Ip(ip6[13]) << 16 | Ip(ip6[14]) << 8 | Ip(ip6[15]);
+  return true;
+}
+
+// appends ip to out as a dotted quad
+inline void appendIp(std::string& out, Ip ip) {
+  char text[16];
+  char* p = text;
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    unsigned octet = ip >> shift & 255;
+    if (octet >= 100) {
+      *p++ = char('0' + octet / 100);
+    }
+    if (octet >= 10) {
+      *p++ = char('0' + octet / 10 % 10);
+    }
+    *p++ = char('0' + octet % 10);
+    *p++ = '.';
+  }
+  out.append(text, p - text - 1);
+}
+
+/* parses an address written as a dotted quad ("127.0.0.1"), as a decimal
+ * number ("2130706433") or as an IPv4-mapped IPv6 address
+ * ("::ffff:127.0.0.1"); false if str is none of them. Nothing is allocated,
+ * dotted quads take the SSE2 path where it is available.
+ */
+inline bool parseIp(std::string_view str, Ip& ip) {
+  if (str.empty()) {
+    return false;
+  }
+  if (std::memchr(str.data(), '.', str.size())) {
+    if (internal::parseDottedQuad(str, ip)) {
+      return true;
+    }
+  } else if (parseUint32(str, ip)) {
+    return true;
+  }
+  Ip6 ip6;
+  return std::memchr(str.data(), ':', str.size()) && parseIp6(str, ip6) &&
+         mappedIpv4(ip6, ip);
+}
+
+/* parses a buffer of addresses, one per line as parseIp takes them; lines
+ * end with \n or \r\n, the last newline may be missing. Appends for every
+ * line its address to ips (0 if there is none) and to valid whether it held
+ * one, returns the number of lines. Where 16 bytes are left in the buffer a
+ * dotted quad is parsed straight from the vector that found its line end.
+ */
+inline size_t parseIpLines(std::string_view text, std::vector<Ip>& ips,
+                           std::vector<uint8_t>& valid) {
+  const char* p = text.data();
+  const char* end = p + text.size();
+  size_t lines = 0;
+  for (; p != end; ++lines) {
+    Ip ip = 0;
+    bool ok = false;
+    const char* eol = nullptr;
+#ifdef __SSE2__
+    if (end - p >= 16) {
+      __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      unsigned newlines = unsigned(
+          _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n'))));
+      if (newlines) {
+        unsigned len = __builtin_ctz(newlines);
+        eol = p + len;
+        len -= len && p[len - 1] == '\r';
+        ok = (len >= 7 && internal::parseDottedQuadSse2(chunk, len, ip)) ||
+             parseIp(std::string_view(p, len), ip);
+      }
+    }
+#endif
+    if (!eol) {
+      eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+      eol = eol ? eol : end;
+      size_t len = eol - p;
+      len -= len && p[len - 1] == '\r';
+      ok = parseIp(std::string_view(p, len), ip);
+    }
+    ips.push_back(ok ? ip : 0);
+    valid.push_back(ok);
+    p = eol == end ? end : eol + 1;
+  }
+  return lines;
+}
+
+}  // namespace ipq
@@ -0,0 +1,380 @@
+#pragma once
+
+#include "config.hpp"
+#include "csv_scanner.hpp"
+#include "frozen_interval_map.hpp"
+#include "location.hpp"
+#include "location_names.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace ipq {
+
+/* the compiled database (.ipqdb) format. A page-sized header is followed by
+ * page-aligned sections of uint32_t arrays, in host byte order:
+ *   starts, ends, range locations: the ranges, sorted by start
+ *   prefix index: the FrozenIntervalMap jump table
+ *   locations: (country id, city id) per location id
+ *   countries: (code string, name string) per country id
+ *   cities: (province string, city string) per city id
+ *   string offsets, string bytes: the names, string i spans
+ *     [offsets[i], offsets[i + 1]) of the bytes
+ * The header and every section carry a checksum. The file is only read
+ * through a mapping, so opening it costs no parsing and no tree building.
+ */
+namespace ipqdb {
+
+constexpr char Magic[8] = {'I', 'P', 'Q', 'D', 'B', '\r', '\n', '\x1a'};
+constexpr uint32_t Version = 1;
+constexpr uint32_t PageSize = 4096;
+constexpr uint32_t ByteOrderMark = 0x01020304;
+
+enum SectionKind : uint32_t {
+  Starts,
+  Ends,
+  RangeLocations,
+  PrefixIndex,
+  Locations,
+  Countries,
+  Cities,
+  StringOffsets,
+  StringBytes,
+  SectionCount
+};
+
+struct Section {
+  uint64_t offset, size, checksum;
+};
+
+struct Header {
+  char magic[8];
+  uint32_t version, page_size, byte_order, section_count;
+  uint64_t file_size, ranges;
+  Section sections[SectionCount];
+  // checksum of the header bytes before this field
+  uint64_t checksum;
+};
+static_assert(sizeof(Header) <= PageSize, "ipqdb header must fit in a page");
+
+inline uint64_t checksum(const void* data, size_t size) {
+  // word-wise multiply-xorshift, with the tail bytes folded in one by one
+  const char* p = static_cast<const char*>(data);
+  uint64_t h = 0x9e3779b97f4a7c15ull ^ size;
+  for (; size >= 8; p += 8, size -= 8) {
+    uint64_t w;
+    std::memcpy(&w, p, 8);
+    h = (h ^ w) * 0xff51afd7ed558ccdull;
+    h ^= h >> 32;
+  }
+  for (; size; ++p, --size) {
+    h = (h ^ uint8_t(*p)) * 0xc4ceb9fe1a85ec53ull;
+  }
+  return h ^ (h >> 29);
+}
+
+inline uint64_t alignToPage(uint64_t offset) {
+  return (offset + PageSize - 1) / PageSize * PageSize;
+}
+
+}  // namespace ipqdb
+
+/* builds the image of a compiled database in memory from sorted,
+ * non-overlapping ranges and the names of their locations
+ */
+class IpqdbWriter {
+  std::vector<uint32_t> starts_, ends_, range_locs_, locations_;
+  std::unordered_map<uint64_t, uint32_t> location_ids_;
+
+ public:
+  void add(uint32_t start, uint32_t end, const Location& loc) {
+    IPQ_ASSERT(starts_.empty() || ends_.back() < start);
+    auto res = location_ids_.emplace(loc.getLoc(), location_ids_.size());
+    if (res.second) {
+      locations_.push_back(loc.getProvinceCode());
+      locations_.push_back(loc.getCountryCode());
+    }
+    starts_.push_back(start);
+    ends_.push_back(end);
+    range_locs_.push_back(res.first->second);
+  }
+
+  std::vector<char> image(const LocationNames& names) const {
+    StringInterner strings;
+    std::vector<uint32_t> countries, cities, string_offsets{0};
+    for (uint32_t c = 0; c < names.countries(); ++c) {
+      countries.push_back(strings.intern(names.countryCode(c)));
+      countries.push_back(strings.intern(names.countryName(c)));
+    }
+    for (uint32_t c = 0; c < names.cities(); ++c) {
+      cities.push_back(strings.intern(names.province(c)));
+      cities.push_back(strings.intern(names.cityName(c)));
+    }
+    std::string bytes;
+    for (uint32_t s = 0; s < strings.size(); ++s) {
+      bytes += strings.get(s);
+      string_offsets.push_back(bytes.size());
+    }
+    std::vector<uint32_t> prefix(FrozenIntervalMap::prefix_entries);
+    FrozenIntervalMap::buildPrefixIndex(starts_.data(), starts_.size(),
+                                        prefix.data());
+
+    const void* data[ipqdb::SectionCount];
+    size_t sizes[ipqdb::SectionCount];
+    auto set = [&](ipqdb::SectionKind kind, const std::vector<uint32_t>& v) {
+      data[kind] = v.data();
+      sizes[kind] = v.size() * sizeof(uint32_t);
+    };
+    set(ipqdb::Starts, starts_);
+    set(ipqdb::Ends, ends_);
+    set(ipqdb::RangeLocations, range_locs_);
+    set(ipqdb::PrefixIndex, prefix);
+    set(ipqdb::Locations, locations_);
+    set(ipqdb::Countries, countries);
+    set(ipqdb::Cities, cities);
+    set(ipqdb::StringOffsets, string_offsets);
+    data[ipqdb::StringBytes] = bytes.data();
+    sizes[ipqdb::StringBytes] = bytes.size();
+
+    ipqdb::Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, ipqdb::Magic, sizeof(header.magic));
+    header.version = ipqdb::Version;
+    header.page_size = ipqdb::PageSize;
+    header.byte_order = ipqdb::ByteOrderMark;
+    header.section_count = ipqdb::SectionCount;
+    header.ranges = starts_.size();
+    uint64_t offset = ipqdb::PageSize;
+    for (uint32_t kind = 0; kind < ipqdb::SectionCount; ++kind) {
+      header.sections[kind] = {offset, sizes[kind],
+                               ipqdb::checksum(data[kind], sizes[kind])};
+      offset = ipqdb::alignToPage(offset + sizes[kind]);
+    }
+    header.file_size = offset;
+    header.checksum =
+        ipqdb::checksum(&header, offsetof(ipqdb::Header, checksum));
+
+    std::vector<char> ret(header.file_size, 0);
+    std::memcpy(ret.data(), &header, sizeof(header));
+    for (uint32_t kind = 0; kind < ipqdb::SectionCount; ++kind) {
+      if (sizes[kind]) {
+        std::memcpy(ret.data() + header.sections[kind].offset, data[kind],
+                    sizes[kind]);
+      }
+    }
+    return ret;
+  }
+
+  /* writes the database to path, through a temporary file renamed over path
+   * so that readers never see a partial file
+   */
+  bool write(const char* path, const LocationNames& names,
+             std::string& error) const {
+    std::vector<char> buf = image(names);
+    std::string tmp_path = std::string(path) + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      error = "can not create " + tmp_path;
+      return false;
+    }
+    size_t written = 0;
+    while (written < buf.size()) {
+      ssize_t res = ::write(fd, buf.data() + written, buf.size() - written);
+      if (res <= 0) {
+        ::close(fd);
+        error = "can not write " + tmp_path;
+        return false;
+      }
+      written += res;
+    }
+    if (::fsync(fd) < 0 || ::close(fd) < 0 ||
+        std::rename(tmp_path.c_str(), path) < 0) {
+      error = "can not write " + std::string(path);
+      return false;
+    }
+    return true;
+  }
+
+  size_t ranges() const { return starts_.size(); }
+};
+
+/* a compiled database opened for queries, viewing a mapped file (open()) or
+ * an image already in memory (attach())
+ */
+class FrozenDb {
+  MappedFile file_;
+  const char* data_ = nullptr;
+  const ipqdb::Header* header_ = nullptr;
+  FrozenIntervalMap ranges_;
+
+  template <typename T>
+  const T* section(ipqdb::SectionKind kind) const {
+    return reinterpret_cast<const T*>(data_ + header_->sections[kind].offset);
+  }
+  size_t entries(ipqdb::SectionKind kind) const {
+    return header_->sections[kind].size / sizeof(uint32_t);
+  }
+
+  /* whether every id and offset that lookups and loadNames() follow stays
+   * inside its section, which the checksums alone do not tell
+   */
+  bool validContents() const {
+    using namespace ipqdb;
+    auto below = [&](SectionKind kind, size_t first, size_t stride,
+                     size_t limit) {
+      const uint32_t* v = section<uint32_t>(kind);
+      for (size_t i = first; i < entries(kind); i += stride) {
+        if (v[i] >= limit) {
+          return false;
+        }
+      }
+      return true;
+    };
+    auto non_decreasing = [&](SectionKind kind, size_t limit) {
+      const uint32_t* v = section<uint32_t>(kind);
+      for (size_t i = 0; i < entries(kind); ++i) {
+        if (v[i] > limit || (i && v[i] < v[i - 1])) {
+          return false;
+        }
+      }
+      return true;
+    };
+    size_t strings = entries(StringOffsets) - 1;
+    return below(RangeLocations, 0, 1, locations()) &&
+           below(Locations, 0, 2, entries(Countries) / 2) &&
+           below(Locations, 1, 2, entries(Cities) / 2) &&
+           below(Countries, 0, 1, strings) && below(Cities, 0, 1, strings) &&
+           non_decreasing(StringOffsets, header_->sections[StringBytes].size) &&
+           non_decreasing(PrefixIndex, header_->ranges);
+  }
+
+ public:
+  bool open(const char* path, std::string& error) {
+    if (!file_.open(path)) {
+      error = std::string("can not open ") + path;
+      return false;
+    }
+    if (!attach(file_.data(), file_.size(), error)) {
+      return false;
+    }
+    // the checksums read the file sequentially, lookups jump around
+    file_.advise(MADV_RANDOM);
+    return true;
+  }
+
+  /* validates the image at data (which must stay valid) and serves queries
+   * from it. The checksums of the sections, a read of the whole image, may
+   * be skipped for an image that was checked when it was made and can not
+   * change since, such as one published by SharedDbPublisher.
+   */
+  bool attach(const char* data, size_t size, std::string& error,
+              bool check_sections = true) {
+    using namespace ipqdb;
+    auto header = reinterpret_cast<const Header*>(data);
+    if (size < sizeof(Header) ||
+        std::memcmp(header->magic, Magic, sizeof(Magic))) {
+      error = "not an ipqdb file";
+      return false;
+    }
+    if (header->version != Version || header->byte_order != ByteOrderMark ||
+        header->page_size != PageSize ||
+        header->section_count != SectionCount) {
+      error = "unsupported ipqdb version or byte order";
+      return false;
+    }
+    if (header->checksum != checksum(header, offsetof(Header, checksum)) ||
+        header->file_size != size) {
+      error = "corrupted ipqdb header";
+      return false;
+    }
+    for (uint32_t kind = 0; kind < SectionCount; ++kind) {
+      auto& s = header->sections[kind];
+      if (s.offset % PageSize || s.offset > size || s.size > size - s.offset ||
+          (kind != StringBytes && s.size % sizeof(uint32_t))) {
+        error = "corrupted ipqdb section table";
+        return false;
+      }
+      if (check_sections && s.checksum != checksum(data + s.offset, s.size)) {
+        error = "ipqdb section checksum mismatch";
+        return false;
+      }
+    }
+    data_ = data;
+    header_ = header;
+    size_t n = header->ranges;
+    if (entries(Starts) != n || entries(Ends) != n ||
+        entries(RangeLocations) != n ||
+        entries(PrefixIndex) != FrozenIntervalMap::prefix_entries ||
+        entries(Locations) % 2 || entries(Countries) % 2 ||
+        entries(Cities) % 2 || !entries(StringOffsets)) {
+      error = "inconsistent ipqdb sections";
+      header_ = nullptr;
+      return false;
+    }
+    if (!validContents()) {
+      error = "corrupted ipqdb contents";
+      header_ = nullptr;
+      return false;
+    }
+    ranges_.view(section<uint32_t>(Starts), section<uint32_t>(Ends),
+                 section<uint32_t>(RangeLocations),
+                 section<uint32_t>(PrefixIndex), n);
+    return true;
+  }
+
+  /* interns the names of the database into names, in id order, so that the
+   * ids of locations() are valid in names when names is empty
+   */
+  void loadNames(LocationNames& names) const {
+    using namespace ipqdb;
+    const uint32_t* offsets = section<uint32_t>(StringOffsets);
+    const char* bytes = section<char>(StringBytes);
+    auto str = [&](uint32_t id) {
+      return std::string_view(bytes + offsets[id],
+                              offsets[id + 1] - offsets[id]);
+    };
+    const uint32_t* countries = section<uint32_t>(Countries);
+    for (size_t c = 0; c < entries(Countries) / 2; ++c) {
+      names.country(str(countries[2 * c]), str(countries[2 * c + 1]));
+    }
+    const uint32_t* cities = section<uint32_t>(Cities);
+    for (size_t c = 0; c < entries(Cities) / 2; ++c) {
+      names.city(str(cities[2 * c]), str(cities[2 * c + 1]));
+    }
+  }
+
+  Location location(uint32_t location_id) const {
+    const uint32_t* locations = section<uint32_t>(ipqdb::Locations);
+    return Location(locations[2 * location_id], locations[2 * location_id + 1]);
+  }
+
+  size_t locations() const { return entries(ipqdb::Locations) / 2; }
+
+  // ranges map to location ids
+  const FrozenIntervalMap& ranges() const { return ranges_; }
+
+  // the whole image viewed, empty before open() or attach()
+  std::string_view image() const {
+    return header_ ? std::string_view(data_, header_->file_size)
+                   : std::string_view();
+  }
+
+  bool find(uint32_t ip, Location& loc) const {
+    const uint32_t* location_id = ranges_.find(ip);
+    if (location_id) {
+      loc = location(*location_id);
+    }
+    return location_id;
+  }
+};
+
+}  // namespace ipq
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "config.hpp"
+#include "interval_tree.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace ipq {
+
+/* joins several range datasets over the same key space into one partition.
+ * Ranges are first added per dataset (later ranges overwrite earlier ones, as
+ * with IntervalTree::update), build() then merges the boundaries of all
+ * datasets, so that every segment of the partition carries the tuple of
+ * per-dataset payload indices. One find() then returns the payloads of all
+ * datasets. Identical tuples are stored once, and adjacent segments with the
+ * same tuple are merged. MapTy maps KeyTy to std::pair<KeyTy, uint32_t>.
+ */
+template <typename KeyTy, typename MapTy>
+class JoinedIntervals {
+ public:
+  static constexpr uint32_t NoPayload = uint32_t(-1);
+
+ private:
+  using IntTree = IntervalTree<KeyTy, uint32_t, MapTy>;
+  size_t datasets_;
+  std::vector<IntTree> staging_;
+  IntTree segments_;
+  // datasets_ payload indices per row
+  std::vector<uint32_t> rows_;
+
+  uint32_t rowOf(const std::vector<uint32_t>& tuple,
+                 std::map<std::vector<uint32_t>, uint32_t>& row_ids) {
+    auto res = row_ids.emplace(tuple, rows_.size() / datasets_);
+    if (res.second) {
+      rows_.insert(rows_.end(), tuple.begin(), tuple.end());
+    }
+    return res.first->second;
+  }
+
+ public:
+  explicit JoinedIntervals(size_t datasets)
+      : datasets_(datasets), staging_(datasets) {}
+
+  size_t datasets() const { return datasets_; }
+
+  void add(size_t dataset, KeyTy start, KeyTy end, uint32_t payload) {
+    IPQ_ASSERT(dataset < datasets_);
+    staging_[dataset].update(start, end, payload);
+  }
+
+  void build() {
+    using Iter = typename IntTree::iterator;
+    std::vector<Iter> heads, lasts;
+    for (auto& tree : staging_) {
+      heads.push_back(tree.keys.begin());
+      lasts.push_back(tree.keys.end());
+    }
+    std::map<std::vector<uint32_t>, uint32_t> row_ids;
+    std::vector<uint32_t> tuple(datasets_);
+    bool pending = false;
+    KeyTy pending_start = KeyTy(), pending_end = KeyTy();
+    uint32_t pending_row = 0;
+    auto flush = [&]() {
+      if (pending) {
+        segments_.update(pending_start, pending_end, pending_row);
+      }
+    };
+    auto next_start = [&](bool& found) {
+      KeyTy ret = std::numeric_limits<KeyTy>::max();
+      found = false;
+      for (size_t d = 0; d < datasets_; ++d) {
+        if (heads[d] != lasts[d] && (!found || heads[d]->first < ret)) {
+          ret = heads[d]->first;
+          found = true;
+        }
+      }
+      return ret;
+    };
+    bool found;
+    KeyTy cur = next_start(found);
+    while (found) {
+      KeyTy seg_end = std::numeric_limits<KeyTy>::max();
+      for (size_t d = 0; d < datasets_; ++d) {
+        tuple[d] = NoPayload;
+        if (heads[d] == lasts[d]) {
+          continue;
+        }
+        if (heads[d]->first > cur) {
+          seg_end = std::min<KeyTy>(seg_end, heads[d]->first - 1);
+        } else {
+          tuple[d] = heads[d]->second.second;
+          seg_end = std::min(seg_end, heads[d]->second.first);
+        }
+      }
+      uint32_t row = rowOf(tuple, row_ids);
+      if (pending && row == pending_row && pending_end + 1 == cur) {
+        pending_end = seg_end;
+      } else {
+        flush();
+        pending = true;
+        pending_start = cur;
+        pending_end = seg_end;
+        pending_row = row;
+      }
+      for (size_t d = 0; d < datasets_; ++d) {
+        if (heads[d] != lasts[d] && heads[d]->second.first == seg_end) {
+          ++heads[d];
+        }
+      }
+      if (seg_end == std::numeric_limits<KeyTy>::max()) {
+        break;
+      }
+      cur = seg_end + 1;
+      KeyTy next = next_start(found);
+      if (found && next > cur) {
+        cur = next;
+      }
+    }
+    flush();
+    staging_.clear();
+  }
+
+  /* the datasets() payload indices of the segment containing key, NoPayload
+   * for the datasets not covering key; nullptr when no dataset covers key
+   */
+  const uint32_t* find(KeyTy key) {
+    uint32_t* row = segments_.find(key);
+    if (!row) {
+      return nullptr;
+    }
+    return rows_.data() + size_t(*row) * datasets_;
+  }
+
+  size_t size() { return segments_.size(); }
+
+  size_t rows() const { return rows_.size() / datasets_; }
+};
+
+}  // namespace ipq
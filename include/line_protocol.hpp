@@ -0,0 +1,306 @@
+#pragma once
+
+#include "ip.hpp"
+#include "location.hpp"
+#include "location_names.hpp"
+#include "range_cache.hpp"
+#include "server.hpp"
+#include "serving_state.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ipq {
+
+/* splits line into its words, separated by blanks, storing up to max of
+ * them; returns the number of words, max + 1 if there are more
+ */
+inline size_t splitWords(std::string_view line, std::string_view* words,
+                         size_t max) {
+  size_t count = 0;
+  for (size_t p = 0; p < line.size();) {
+    size_t start = line.find_first_not_of(" \t\r", p);
+    if (start == line.npos) {
+      break;
+    }
+    size_t end = std::min(line.find_first_of(" \t\r", start), line.size());
+    if (count == max) {
+      return max + 1;
+    }
+    words[count++] = line.substr(start, end - start);
+    p = end;
+  }
+  return count;
+}
+
+/* the commands of the text protocol, shared by the stdin loop of ipq and
+ * LineProtocol: the number of arguments each takes, how many of the leading
+ * ones are addresses, and whether LineProtocol serves it (the others need
+ * the tree and its indexes, which only the stdin loop has)
+ */
+struct CommandSpec {
+  std::string_view name;
+  size_t arguments, ip_arguments;
+  bool served;
+};
+
+constexpr CommandSpec Commands[] = {
+    {"query", 1, 1, true},           {"range", 1, 1, true},
+    {"update", 6, 2, true},          {"delete", 2, 2, true},
+    {"quit", 0, 0, true},            {"overlap", 2, 2, false},
+    {"in", 2, 1, false},             {"ranges", 1, 0, false},
+    {"count", 1, 0, false},          {"count_city", 3, 0, false},
+    {"delete_country", 1, 0, false}, {"batch", 1, 0, false},
+    {"reload", 1, 0, false},         {"flush", 0, 0, false},
+    {"cache_stats", 0, 0, false},    {"publish", 0, 0, false}};
+
+// the spec of the command called name, nullptr if there is none
+inline const CommandSpec* findCommand(std::string_view name) {
+  for (const CommandSpec& spec : Commands) {
+    if (spec.name == name) {
+      return &spec;
+    }
+  }
+  return nullptr;
+}
+
+/* one request of the text protocol, a line of whitespace separated words:
+ *   query ip
+ *   range ip
+ *   update ip1 ip2 country_code country_name province city
+ *   delete ip1 ip2
+ *   quit
+ * ips are dotted quads, decimal numbers or IPv4-mapped IPv6 addresses, as
+ * parseIp takes them. The names point into the line.
+ */
+struct Command {
+  enum class Kind { Query, Range, Update, Delete, Quit, Empty, Invalid } kind;
+  Ip ip1 = 0, ip2 = 0;
+  std::string_view code, country, province, city;
+  // what is wrong with an Invalid command
+  const char* error = nullptr;
+
+  static Command parse(std::string_view line) {
+    std::string_view words[8];
+    size_t count = splitWords(line, words, 8);
+    if (count > 8) {
+      return invalid("too many words");
+    }
+    Command cmd;
+    if (!count) {
+      cmd.kind = Kind::Empty;
+      return cmd;
+    }
+    std::string_view name = words[0];
+    const CommandSpec* spec = findCommand(name);
+    if (!spec || !spec->served || count != spec->arguments + 1) {
+      return invalid("unknown command or wrong number of arguments");
+    }
+    size_t ips = spec->ip_arguments;
+    if (name == "query") {
+      cmd.kind = Kind::Query;
+    } else if (name == "range") {
+      cmd.kind = Kind::Range;
+    } else if (name == "update") {
+      cmd.kind = Kind::Update;
+      cmd.code = words[3];
+      cmd.country = words[4];
+      cmd.province = words[5];
+      cmd.city = words[6];
+    } else if (name == "delete") {
+      cmd.kind = Kind::Delete;
+    } else {
+      cmd.kind = Kind::Quit;
+    }
+    for (size_t i = 0; i < ips; ++i) {
+      Ip6 ip6;
+      if (!parseIp(words[i + 1], i ? cmd.ip2 : cmd.ip1)) {
+        return invalid(parseIp6(words[i + 1], ip6)
+                           ? "ipv6 address not supported"
+                           : "invalid ip");
+      }
+    }
+    if (ips > 1 && cmd.ip1 > cmd.ip2) {
+      return invalid("range start is greater than range end");
+    }
+    return cmd;
+  }
+
+ private:
+  Command() = default;
+  static Command invalid(const char* error) {
+    Command cmd;
+    cmd.kind = Kind::Invalid;
+    cmd.error = error;
+    return cmd;
+  }
+};
+
+/* the server side of the text protocol for one event loop, a
+ * Server::HandlerTy. Every line gets one response line:
+ *   country_code<TAB>country_name<TAB>province<TAB>city  or  not found
+ *   start<TAB>end<TAB>  and the query response, for range
+ *   ok                                    for update and delete
+ *   error: what                           for an invalid request
+ * and quit closes the connection. The range response gives the bounds of
+ * the range holding the ip, or if it is not found of the largest gap around
+ * it, as dotted quads: a client may answer every ip in them by itself.
+ * Consecutive queries are looked up as one batch, through a RangeCache if
+ * the state has the caches enabled.
+ */
+class LineProtocol {
+  static constexpr size_t MaxLine = 4096;
+
+  ServingState* state_;
+  ServingReader reader_;
+  std::optional<RangeCache> cache_;
+  std::vector<Ip> ips_;
+  // whether the query of ips_[i] is a range request
+  std::vector<uint8_t> with_range_;
+  size_t range_requests_ = 0;
+  std::vector<Location> locs_;
+  std::vector<IpRange> ranges_;
+
+  void answerQueries(std::string& out) {
+    if (ips_.empty()) {
+      return;
+    }
+    locs_.resize(ips_.size());
+    ranges_.resize(ips_.size());
+    if (cache_) {
+      cache_->query(ips_, locs_.data(), ranges_.data(),
+                    [this](ArrayRef<Ip> ips, Location* locs, IpRange* ranges) {
+                      reader_.query(ips, locs, ranges);
+                    });
+      // the cache keeps ranges cut to its blocks
+      for (size_t i = 0; range_requests_ && i < ips_.size(); ++i) {
+        if (with_range_[i]) {
+          reader_.query(ArrayRef<Ip>(&ips_[i], 1), &locs_[i], &ranges_[i]);
+        }
+      }
+    } else if (range_requests_) {
+      reader_.query(ips_, locs_.data(), ranges_.data());
+    } else {
+      reader_.query(ips_, locs_.data());
+    }
+    std::shared_lock<std::shared_mutex> lock(state_->names_mutex);
+    auto& names = state_->names;
+    for (size_t i = 0; i < locs_.size(); ++i) {
+      const Location& loc = locs_[i];
+      if (with_range_[i]) {
+        appendIp(out, ranges_[i].start);
+        out += '\t';
+        appendIp(out, ranges_[i].end);
+        out += '\t';
+      }
+      if (loc == Location()) {
+        out += "not found\n";
+        continue;
+      }
+      uint32_t country = loc.getProvinceCode(), city = loc.getCountryCode();
+      out += names.countryCode(country);
+      out += '\t';
+      out += names.countryName(country);
+      out += '\t';
+      out += names.province(city);
+      out += '\t';
+      out += names.cityName(city);
+      out += '\n';
+    }
+    ips_.clear();
+    with_range_.clear();
+    range_requests_ = 0;
+  }
+
+  void apply(const IpRangeUpdate& update) {
+    std::lock_guard<std::mutex> lock(state_->engine_mutex);
+    state_->engine->batchUpdateBlocking({update});
+    state_->cache_epochs.invalidate(update.start, update.end);
+  }
+
+ public:
+  LineProtocol(ServingState& state, ServingReader reader)
+      : state_(&state), reader_(std::move(reader)) {
+    if (state.cache_prefix) {
+      cache_.emplace(state.cache_epochs, state.cache_prefix);
+    }
+  }
+  LineProtocol(const LineProtocol&) = delete;
+  LineProtocol& operator=(const LineProtocol&) = delete;
+  ~LineProtocol() {
+    if (cache_) {
+      std::lock_guard<std::mutex> lock(state_->cache_stats_mutex);
+      state_->cache_stats += cache_->stats();
+    }
+  }
+
+  size_t operator()(std::string_view in, std::string& out) {
+    size_t consumed = 0;
+    while (true) {
+      size_t eol = in.find('\n', consumed);
+      if (eol == in.npos) {
+        break;
+      }
+      Command cmd = Command::parse(in.substr(consumed, eol - consumed));
+      consumed = eol + 1;
+      if (cmd.kind == Command::Kind::Query ||
+          cmd.kind == Command::Kind::Range) {
+        bool range = cmd.kind == Command::Kind::Range;
+        ips_.push_back(cmd.ip1);
+        with_range_.push_back(range);
+        range_requests_ += range;
+        continue;
+      }
+      answerQueries(out);
+      if (cmd.kind == Command::Kind::Update) {
+        Location loc;
+        {
+          std::unique_lock<std::shared_mutex> lock(state_->names_mutex);
+          loc = state_->names.location(cmd.code, cmd.country, cmd.province,
+                                       cmd.city);
+        }
+        apply({cmd.ip1, cmd.ip2, loc});
+        out += "ok\n";
+      } else if (cmd.kind == Command::Kind::Delete) {
+        apply({cmd.ip1, cmd.ip2, std::nullopt});
+        out += "ok\n";
+      } else if (cmd.kind == Command::Kind::Quit) {
+        return Server::Close;
+      } else if (cmd.kind == Command::Kind::Invalid) {
+        out += "error: ";
+        out += cmd.error;
+        out += '\n';
+      }
+    }
+    answerQueries(out);
+    if (in.size() - consumed > MaxLine) {
+      out += "error: line too long\n";
+      return Server::Close;
+    }
+    return consumed;
+  }
+};
+
+// a LineProtocol for every loop, no handler if the engine has no reader left
+inline Server::HandlerFactoryTy lineProtocol(ServingState& state) {
+  return [&state](unsigned) -> Server::HandlerTy {
+    auto reader = state.reader();
+    if (!reader) {
+      return nullptr;
+    }
+    auto protocol = std::make_shared<LineProtocol>(state, std::move(*reader));
+    return [protocol](std::string_view in, std::string& out) {
+      return (*protocol)(in, out);
+    };
+  };
+}
+
+}  // namespace ipq
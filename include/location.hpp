@@ -27,15 +27,16 @@ class Location {
   friend struct SegmentTreeTrait<Location>;
 
  public:
+  Location() : loc(NonExistLoc) {}
   Location(uint64_t loc) : loc(loc) {
   }
   Location(uint64_t prov, uint64_t city) {
     loc = (prov & shifted_province_mask) << province_shift |(city & country_mask);
   }
-  uint64_t getLoc() { return loc; }
+  uint64_t getLoc() const { return loc; }
   void setLoc(uint64_t nloc) { loc = nloc; }
 
-  uint64_t getProvinceCode() {
+  uint64_t getProvinceCode() const {
     return (loc >> province_shift) & shifted_province_mask;
   }
 
@@ -44,7 +45,7 @@ class Location {
     loc = (prov << province_shift) | (loc & country_mask);
   }
 
-  uint64_t getCountryCode() { return loc & country_mask; }
+  uint64_t getCountryCode() const { return loc & country_mask; }
 
   void setCountryCOde(uint64_t cou) {
     IPQ_ASSERT(!(cou & country_mask));
@@ -57,7 +58,7 @@ class Location {
     return country_names[getProvinceCode()][getCountryCode()];
   }
 
-  bool operator==(Location& rhs) const { return loc == rhs.loc; }
+  bool operator==(const Location& rhs) const { return loc == rhs.loc; }
 };
 
 template <>
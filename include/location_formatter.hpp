@@ -0,0 +1,69 @@
+#pragma once
+
+#include "location.hpp"
+#include "location_names.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ipq {
+
+/* the text a query prints for a Location, pre-rendered: the country line of
+ * every country and the city line of every city are formatted once, when
+ * first printed, into one arena, so that printing a Location is two copies.
+ * The names of an id never change, so the lines stay valid as names grow.
+ */
+class LocationFormatter {
+  const LocationNames* names_;
+  std::string countries_, cities_;
+  // line i is [offsets[i], offsets[i + 1])
+  std::vector<uint32_t> country_offsets_{0}, city_offsets_{0};
+
+  std::string_view line(const std::string& arena,
+                        const std::vector<uint32_t>& offsets, uint32_t id) {
+    return std::string_view(arena).substr(offsets[id],
+                                          offsets[id + 1] - offsets[id]);
+  }
+
+ public:
+  explicit LocationFormatter(const LocationNames& names) : names_(&names) {}
+
+  // "country code: XX country name: Name\n"
+  std::string_view country(uint32_t country) {
+    while (country_offsets_.size() <= country + size_t(1)) {
+      uint32_t id = country_offsets_.size() - 1;
+      countries_.append("country code: ");
+      countries_.append(names_->countryCode(id));
+      countries_.append(" country name: ");
+      countries_.append(names_->countryName(id));
+      countries_ += '\n';
+      country_offsets_.push_back(countries_.size());
+    }
+    return line(countries_, country_offsets_, country);
+  }
+
+  // "province: Province city : City\n"
+  std::string_view city(uint32_t city) {
+    while (city_offsets_.size() <= city + size_t(1)) {
+      uint32_t id = city_offsets_.size() - 1;
+      cities_.append("province: ");
+      cities_.append(names_->province(id));
+      cities_.append(" city : ");
+      cities_.append(names_->cityName(id));
+      cities_ += '\n';
+      city_offsets_.push_back(cities_.size());
+    }
+    return line(cities_, city_offsets_, city);
+  }
+
+  // appends the two lines of loc to out
+  template <typename OutTy>
+  void print(OutTy& out, const Location& loc) {
+    out << country(loc.getProvinceCode()) << city(loc.getCountryCode());
+  }
+};
+
+}  // namespace ipq
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "config.hpp"
+#include "location.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <set>
+
+namespace ipq {
+
+/* secondary index from Location to the starts of the ranges mapped to it.
+ * Plug it into IntervalTree as the listener and update()/remove() keep it up
+ * to date. Locations are ordered by their 64-bit code, whose high half is the
+ * country code, so the locations of one country are adjacent in the index.
+ * The index is optional at runtime, a disabled index ignores all
+ * notifications.
+ */
+template <typename KeyTy>
+class LocationIndex {
+  std::map<uint64_t, std::set<KeyTy>> ranges_;
+  bool enabled_ = false;
+
+  static uint64_t countryBegin(uint64_t country) {
+    return Location(country, 0).getLoc();
+  }
+
+ public:
+  void enable() { enabled_ = true; }
+  bool enabled() const { return enabled_; }
+
+  void inserted(KeyTy start, KeyTy, const Location& loc) {
+    if (enabled_) {
+      ranges_[loc.getLoc()].insert(start);
+    }
+  }
+
+  void erased(KeyTy start, KeyTy, const Location& loc) {
+    if (!enabled_) {
+      return;
+    }
+    auto iter = ranges_.find(loc.getLoc());
+    IPQ_ASSERT(iter != ranges_.end());
+    iter->second.erase(start);
+    if (iter->second.empty()) {
+      ranges_.erase(iter);
+    }
+  }
+
+  size_t count(const Location& loc) const {
+    auto iter = ranges_.find(loc.getLoc());
+    return iter == ranges_.end() ? 0 : iter->second.size();
+  }
+
+  size_t countCountry(uint64_t country) const {
+    size_t ret = 0;
+    for_each_country_location(
+        country, [&](const Location&, const std::set<KeyTy>& starts) {
+          ret += starts.size();
+        });
+    return ret;
+  }
+
+  /* calls callback(start) for every range mapped to loc, in ascending order
+   */
+  template <typename CallbackTy>
+  void for_each_range(const Location& loc, CallbackTy callback) const {
+    auto iter = ranges_.find(loc.getLoc());
+    if (iter != ranges_.end()) {
+      for (KeyTy start : iter->second) {
+        callback(start);
+      }
+    }
+  }
+
+  /* calls callback(loc, starts) for every location of the country that has
+   * at least one range
+   */
+  template <typename CallbackTy>
+  void for_each_country_location(uint64_t country,
+                                 CallbackTy callback) const {
+    auto iter = ranges_.lower_bound(countryBegin(country));
+    auto last = ranges_.lower_bound(countryBegin(country + 1));
+    for (; iter != last; ++iter) {
+      callback(Location(iter->first), iter->second);
+    }
+  }
+
+  size_t size() const { return ranges_.size(); }
+};
+
+}  // namespace ipq
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "config.hpp"
+#include "location.hpp"
+#include "string_interner.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace ipq {
+
+/* the names behind Location codes. A Location carries the interned ids
+ * directly: its country half (getProvinceCode()) is the id of the country
+ * code, its city half (getCountryCode()) is the id of the (province, city)
+ * pair. Every name is stored once, in one arena.
+ */
+class LocationNames {
+  // country code -> country id
+  StringInterner countries_;
+  // country id -> name id
+  std::vector<uint32_t> country_names_;
+  // country, province and city names
+  StringInterner names_;
+  // (province name id, city name id) -> city id
+  PairInterner cities_;
+
+ public:
+  static constexpr uint32_t NotFound = StringInterner::NotFound;
+
+  /* id of the country, the name given when the code is first seen is kept
+   */
+  uint32_t country(std::string_view code, std::string_view name) {
+    uint32_t id = countries_.intern(code);
+    if (id == country_names_.size()) {
+      country_names_.push_back(names_.intern(name));
+    }
+    return id;
+  }
+
+  uint32_t city(std::string_view province, std::string_view city) {
+    return cities_.intern(names_.intern(province), names_.intern(city));
+  }
+
+  Location location(std::string_view code, std::string_view country_name,
+                    std::string_view province, std::string_view city_name) {
+    return Location(country(code, country_name), city(province, city_name));
+  }
+
+  uint32_t findCountry(std::string_view code) const {
+    return countries_.find(code);
+  }
+
+  uint32_t findCity(std::string_view province, std::string_view city) const {
+    uint32_t province_id = names_.find(province), city_id = names_.find(city);
+    if (province_id == NotFound || city_id == NotFound) {
+      return NotFound;
+    }
+    return cities_.find(province_id, city_id);
+  }
+
+  std::string_view countryCode(uint32_t country) const {
+    return countries_.get(country);
+  }
+  std::string_view countryName(uint32_t country) const {
+    return names_.get(country_names_[country]);
+  }
+  std::string_view province(uint32_t city) const {
+    return names_.get(cities_.get(city).first);
+  }
+  std::string_view cityName(uint32_t city) const {
+    return names_.get(cities_.get(city).second);
+  }
+
+  uint32_t countries() const { return countries_.size(); }
+  uint32_t cities() const { return cities_.size(); }
+
+  size_t memory() const {
+    return countries_.memory() + names_.memory() + cities_.memory() +
+           country_names_.capacity() * sizeof(uint32_t);
+  }
+};
+
+}  // namespace ipq
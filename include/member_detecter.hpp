@@ -0,0 +1,17 @@
+#pragma once
+
+#include <type_traits>
+
+/* compile time detection of members: IPQ_DEFINE_HAS_MEMBER(name) declares
+ * the trait at namespace scope, then IPQ_HAS_MEMBER(Type, name) is a
+ * constant expression telling whether Type has an accessible, non-overloaded
+ * member called name, for use in if constexpr.
+ */
+#define IPQ_DEFINE_HAS_MEMBER(name)                                        \
+  template <typename T, typename = void>                                   \
+  struct ipq_has_member_##name : std::false_type {};                       \
+  template <typename T>                                                    \
+  struct ipq_has_member_##name<T, std::void_t<decltype(&T::name)>>         \
+      : std::true_type {}
+
+#define IPQ_HAS_MEMBER(type, name) (ipq_has_member_##name<type>::value)
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <sys/mman.h>
+
+namespace ipq {
+
+/* allocates every array in its own anonymous mapping reserved without swap
+ * (MAP_NORESERVE): the kernel only backs the pages that are written, so a
+ * SegmentTree over the whole ip space costs memory in proportion to the
+ * nodes it actually uses. Pages read before being written are zero.
+ */
+template <typename T>
+struct MmapAllocator {
+  using value_type = T;
+
+  MmapAllocator() = default;
+  template <typename U>
+  MmapAllocator(const MmapAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    void* addr = ::mmap(nullptr, n * sizeof(T), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T*>(addr);
+  }
+
+  void deallocate(T* ptr, size_t n) { ::munmap(ptr, n * sizeof(T)); }
+
+  template <typename U>
+  bool operator==(const MmapAllocator<U>&) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const MmapAllocator<U>&) const {
+    return false;
+  }
+};
+
+}  // namespace ipq
@@ -0,0 +1,313 @@
+#pragma once
+
+#include "array_ref.hpp"
+#include "config.hpp"
+#include "data_storage.hpp"
+#include "frozen_interval_map.hpp"
+#include "interval_tree.hpp"
+#include "ip.hpp"
+#include "location.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ipq {
+
+// the updates over an OverlaySnapshot, removals are non-existing Locations
+using OverlayDelta =
+    IntervalTree<Ip, Location, std::map<Ip, std::pair<Ip, Location>>>;
+
+// the Location of ip in delta, nullptr if delta has no range containing it
+inline const Location* findInDelta(const OverlayDelta& delta, Ip ip) {
+  auto iter = delta.keys.upper_bound(ip);
+  if (iter == delta.keys.begin() || ip > (--iter)->second.first) {
+    return nullptr;
+  }
+  return &iter->second.second;
+}
+
+/* the Location of ip in delta laid over the layers below it, nullptr if
+ * there is none, with range set to the range found or to a gap around ip.
+ * below(ip, range) looks up the layers under delta the same way. A range
+ * from below is cut where the delta ranges around it override it; a gap is
+ * a tombstone of the delta or a gap from below cut by the delta ranges
+ * around it.
+ */
+template <typename BelowTy>
+const Location* findInLayers(const OverlayDelta& delta, Ip ip, IpRange& range,
+                             BelowTy below) {
+  auto next = delta.keys.upper_bound(ip);
+  auto prev = next;
+  if (prev != delta.keys.begin() && ip <= (--prev)->second.first) {
+    range = {prev->first, prev->second.first};
+    return prev->second.second == Location() ? nullptr : &prev->second.second;
+  }
+  const Location* loc = below(ip, range);
+  if (next != delta.keys.begin()) {
+    range.start = std::max(range.start, prev->second.first + 1);
+  }
+  if (next != delta.keys.end()) {
+    range.end = std::min(range.end, next->first - 1);
+  }
+  return loc;
+}
+
+/* the Location of ip from step(ip, range), a lookup as findInLayers does
+ * it, Location() if there is none. When nothing is found range is widened
+ * over the gaps step finds next to it, up to the largest gap around ip.
+ */
+template <typename StepTy>
+Location findWithBounds(Ip ip, IpRange& range, StepTy step) {
+  if (const Location* loc = step(ip, range)) {
+    return *loc;
+  }
+  IpRange next;
+  while (range.start > 0 && !step(range.start - 1, next)) {
+    range.start = next.start;
+  }
+  while (range.end < UINT32_MAX && !step(range.end + 1, next)) {
+    range.end = next.end;
+  }
+  return Location();
+}
+
+/* an immutable set of ranges laid out for lookups, the ranges referring to
+ * a table of the distinct Locations
+ */
+struct OverlaySnapshot {
+  FrozenIntervalMap ranges;
+  std::vector<Location> locations;
+
+  const Location* find(Ip ip) const {
+    const uint32_t* id = ranges.find(ip);
+    return id ? &locations[*id] : nullptr;
+  }
+
+  // find(ip), range set to the range found or to the gap around ip
+  const Location* find(Ip ip, IpRange& range) const {
+    const uint32_t* id = ranges.findRange(ip, range.start, range.end);
+    return id ? &locations[*id] : nullptr;
+  }
+
+  // find(ip, range) of snapshot, which may be null
+  static const Location* find(const OverlaySnapshot* snapshot, Ip ip,
+                              IpRange& range) {
+    range = {0, UINT32_MAX};
+    return snapshot ? snapshot->find(ip, range) : nullptr;
+  }
+
+  /* the ranges of snapshot (may be null) with delta applied over them: both
+   * are walked in order of start, a snapshot range is cut where it meets a
+   * delta range
+   */
+  static std::shared_ptr<const OverlaySnapshot> merge(
+      const OverlaySnapshot* snapshot, const OverlayDelta& delta) {
+    // 64-bit positions, so that the end of the ip space can be stepped over
+    using PosTy = uint64_t;
+    std::vector<Ip> starts, ends;
+    std::vector<uint32_t> values;
+    auto result = std::make_shared<OverlaySnapshot>();
+    std::unordered_map<uint64_t, uint32_t> location_ids;
+    auto emit = [&](PosTy start, PosTy end, const Location& loc) {
+      auto res = location_ids.emplace(loc.getLoc(), result->locations.size());
+      if (res.second) {
+        result->locations.push_back(loc);
+      }
+      starts.push_back(Ip(start));
+      ends.push_back(Ip(end));
+      values.push_back(res.first->second);
+    };
+
+    const FrozenIntervalMap* old = snapshot ? &snapshot->ranges : nullptr;
+    size_t idx = 0, old_size = old ? old->size() : 0;
+    // the points of the snapshot below done are emitted or overridden
+    PosTy done = 0;
+    auto emit_old = [&](PosTy until) {
+      for (; idx < old_size && old->start(idx) < until; ++idx) {
+        PosTy start = std::max<PosTy>(old->start(idx), done);
+        PosTy end = std::min<PosTy>(old->end(idx), until - 1);
+        if (start <= end) {
+          emit(start, end, snapshot->locations[old->value(idx)]);
+        }
+        if (old->end(idx) >= until) {
+          break;
+        }
+      }
+    };
+    for (auto& range : delta.keys) {
+      emit_old(range.first);
+      if (!(range.second.second == Location())) {
+        emit(range.first, range.second.first, range.second.second);
+      }
+      done = PosTy(range.second.first) + 1;
+      while (idx < old_size && old->end(idx) < done) {
+        ++idx;
+      }
+    }
+    emit_old(PosTy(1) << 32);
+
+    result->ranges.build(starts.size(), [&](auto emit_range) {
+      for (size_t i = 0; i < starts.size(); ++i) {
+        emit_range(starts[i], ends[i], values[i]);
+      }
+    });
+    return result;
+  }
+};
+
+/* LSM-like storage of ip ranges: an immutable snapshot laid out for lookups
+ * (a FrozenIntervalMap) holds the bulk of the ranges, a small mutable delta
+ * (an IntervalTree) the updates since. A removal is stored in the delta as a
+ * tombstone, a range of the non-existing Location. A lookup asks the delta
+ * first and falls back to the snapshot.
+ *
+ * Once the delta holds compact_threshold ranges it is sealed and folded into
+ * a new snapshot by a background thread, while a fresh delta takes the new
+ * updates; lookups then ask the fresh delta, the sealed one and the snapshot
+ * in turn. The new snapshot replaces the old one and the sealed delta at the
+ * start of the next operation after the compaction is done.
+ *
+ * Queries and updates must come from one thread.
+ */
+class OverlayStore {
+  using DeltaTy = OverlayDelta;
+  using Snapshot = OverlaySnapshot;
+
+  std::shared_ptr<const Snapshot> snapshot_;
+  std::shared_ptr<const DeltaTy> sealed_;
+  DeltaTy delta_;
+  size_t compact_threshold_;
+
+  std::thread compactor_;
+  std::atomic<bool> compacted_{false};
+  std::shared_ptr<const Snapshot> compacted_snapshot_;
+
+  // waits for the compaction and replaces the snapshot and the sealed delta
+  void install() {
+    compactor_.join();
+    compacted_ = false;
+    snapshot_ = std::move(compacted_snapshot_);
+    sealed_.reset();
+  }
+
+  // installs the result of a finished compaction
+  void poll() {
+    if (compacted_.load(std::memory_order_acquire)) {
+      install();
+    }
+  }
+
+  void maybeCompact() {
+    if (delta_.keys.size() >= compact_threshold_) {
+      compact();
+    }
+  }
+
+ public:
+  explicit OverlayStore(size_t compact_threshold = 1 << 16)
+      : compact_threshold_(std::max<size_t>(compact_threshold, 1)) {}
+
+  OverlayStore(const OverlayStore&) = delete;
+  OverlayStore& operator=(const OverlayStore&) = delete;
+
+  ~OverlayStore() {
+    if (compactor_.joinable()) {
+      compactor_.join();
+    }
+  }
+
+  Location query(Ip ip) {
+    poll();
+    if (Location* loc = delta_.find(ip)) {
+      return *loc;
+    }
+    if (sealed_) {
+      if (const Location* loc = findInDelta(*sealed_, ip)) {
+        return *loc;
+      }
+    }
+    if (snapshot_) {
+      if (const Location* loc = snapshot_->find(ip)) {
+        return *loc;
+      }
+    }
+    return Location();
+  }
+
+  /* query(ip), range set to the range found, or when nothing is found to
+   * the largest gap around ip
+   */
+  Location queryRange(Ip ip, IpRange& range) {
+    poll();
+    auto snapshot = [this](Ip ip, IpRange& range) {
+      return Snapshot::find(snapshot_.get(), ip, range);
+    };
+    auto sealed = [&](Ip ip, IpRange& range) {
+      return sealed_ ? findInLayers(*sealed_, ip, range, snapshot)
+                     : snapshot(ip, range);
+    };
+    return findWithBounds(ip, range, [&](Ip ip, IpRange& range) {
+      return findInLayers(delta_, ip, range, sealed);
+    });
+  }
+
+  void updateBlocking(Ip start, Ip end, Location loc) {
+    poll();
+    delta_.update(start, end, loc);
+    maybeCompact();
+  }
+
+  void batchUpdateBlocking(ArrayRef<IpRangeUpdate> updates) {
+    poll();
+    std::vector<IpRangeUpdate> tombstoned(updates.begin(), updates.end());
+    for (auto& u : tombstoned) {
+      if (!u.val) {
+        u.val = Location();
+      }
+    }
+    delta_.batch_update(tombstoned);
+    maybeCompact();
+  }
+
+  /* seals the delta and starts folding it into a new snapshot, unless a
+   * compaction is running already
+   */
+  void compact() {
+    if (compactor_.joinable() || delta_.keys.empty()) {
+      return;
+    }
+    auto sealed = std::make_shared<DeltaTy>();
+    sealed->keys.swap(delta_.keys);
+    sealed_ = sealed;
+    compactor_ = std::thread(
+        [this](std::shared_ptr<const Snapshot> snapshot,
+               std::shared_ptr<const DeltaTy> delta) {
+          compacted_snapshot_ = Snapshot::merge(snapshot.get(), *delta);
+          compacted_.store(true, std::memory_order_release);
+        },
+        snapshot_, sealed_);
+  }
+
+  // waits for the running compaction, if any, and installs its snapshot
+  void waitCompaction() {
+    if (compactor_.joinable()) {
+      install();
+    }
+  }
+
+  size_t deltaSize() const { return delta_.keys.size(); }
+  size_t snapshotSize() const {
+    return snapshot_ ? snapshot_->ranges.size() : 0;
+  }
+  bool compacting() const { return compactor_.joinable(); }
+};
+
+}  // namespace ipq
@@ -0,0 +1,213 @@
+#pragma once
+
+#include "array_ref.hpp"
+#include "ip.hpp"
+#include "location.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace ipq {
+
+/* the epochs shared by the RangeCaches of all threads: a counter for every
+ * /16 of the ip space, bumped by the writer for each /16 an update or delete
+ * touches, once the change is visible to readers. A cache entry keeps the
+ * epoch of its /16 read before its lookup, and is used only while that epoch
+ * is unchanged.
+ */
+class RangeCacheEpochs {
+ public:
+  static constexpr unsigned RegionBits = 16;
+
+ private:
+  std::unique_ptr<std::atomic<uint32_t>[]> epochs_;
+
+ public:
+  RangeCacheEpochs()
+      : epochs_(new std::atomic<uint32_t>[size_t(1) << RegionBits]()) {}
+
+  uint32_t epoch(Ip ip) const {
+    return epochs_[ip >> (32 - RegionBits)].load(std::memory_order_acquire);
+  }
+
+  // drops every cached result in [start, end], after the change is published
+  void invalidate(Ip start, Ip end) {
+    for (size_t region = start >> (32 - RegionBits);
+         region <= end >> (32 - RegionBits); ++region) {
+      epochs_[region].fetch_add(1, std::memory_order_release);
+    }
+  }
+};
+
+struct RangeCacheStats {
+  // hits include the negative hits, ips found not to be in any range
+  uint64_t hits = 0, negative_hits = 0, misses = 0;
+
+  double hitRate() const {
+    uint64_t lookups = hits + misses;
+    return lookups ? double(hits) / double(lookups) : 0;
+  }
+
+  RangeCacheStats& operator+=(const RangeCacheStats& other) {
+    hits += other.hits;
+    negative_hits += other.negative_hits;
+    misses += other.misses;
+    return *this;
+  }
+};
+
+/* a small set-associative cache of lookup results for one thread, in front
+ * of a lookup giving the bounds of what it finds (RcuStore::Reader::query,
+ * IntervalTree::find_range). The ip space is cut into blocks of prefix_bits
+ * (a /24 by default, at most a /16), each block mapping to one set of Ways
+ * entries. An entry holds a range found, or the gap around an ip not found
+ * with Location(), cut to the block of the ip looked up: every ip of the
+ * block inside it hits, without a lookup. A hit moves its entry one way
+ * forward, a new entry goes first and pushes the last one out, so that the
+ * hot ranges of skewed traffic stay.
+ *
+ * Entries are invalidated through the epochs of RangeCacheEpochs, which must
+ * outlive the cache.
+ */
+class RangeCache {
+ public:
+  static constexpr unsigned Ways = 4;
+
+ private:
+  struct Entry {
+    // empty until filled
+    Ip start = 1, end = 0;
+    uint32_t epoch = 0;
+    Location loc;
+  };
+
+  const RangeCacheEpochs* epochs_;
+  unsigned block_shift_, set_bits_;
+  std::vector<Entry> entries_;
+  RangeCacheStats stats_;
+  // the misses of a batch
+  std::vector<Ip> miss_ips_;
+  std::vector<size_t> miss_idx_;
+  std::vector<uint32_t> miss_epochs_;
+  std::vector<Location> miss_locs_;
+  std::vector<IpRange> miss_ranges_;
+
+  Entry* set(Ip ip) {
+    uint32_t block = ip >> block_shift_;
+    size_t set = (block * 0x9e3779b1u) >> (32 - set_bits_);
+    return &entries_[set * Ways];
+  }
+
+ public:
+  /* a cache of at least entries entries, rounded up to a power of two of
+   * sets
+   */
+  explicit RangeCache(const RangeCacheEpochs& epochs, unsigned prefix_bits = 24,
+                      size_t entries = 4096)
+      : epochs_(&epochs),
+        block_shift_(32 - std::clamp(prefix_bits, RangeCacheEpochs::RegionBits,
+                                     32u)),
+        set_bits_(1) {
+    while ((size_t(Ways) << set_bits_) < entries && set_bits_ < 24) {
+      ++set_bits_;
+    }
+    entries_.resize(size_t(Ways) << set_bits_);
+  }
+
+  /* the cached result for ip: true with loc (Location() if ip is in no
+   * range) and the range or gap holding ip, cut to the block of ip
+   */
+  bool find(Ip ip, Location& loc, IpRange& range) {
+    Entry* ways = set(ip);
+    for (unsigned w = 0; w < Ways; ++w) {
+      Entry& entry = ways[w];
+      if (ip < entry.start || ip > entry.end) {
+        continue;
+      }
+      if (entry.epoch != epochs_->epoch(ip)) {
+        break;
+      }
+      loc = entry.loc;
+      range = {entry.start, entry.end};
+      if (w) {
+        std::swap(ways[w - 1], entry);
+      }
+      ++stats_.hits;
+      stats_.negative_hits += loc == Location();
+      return true;
+    }
+    ++stats_.misses;
+    return false;
+  }
+
+  /* caches the result of a lookup of ip: loc and the range or gap holding
+   * ip, epoch read from the epochs before the lookup. range is cut to the
+   * block of ip.
+   */
+  void insert(Ip ip, uint32_t epoch, const Location& loc, IpRange& range) {
+    Ip block_mask = (Ip(1) << block_shift_) - 1;
+    range.start = std::max(range.start, ip & ~block_mask);
+    range.end = std::min(range.end, ip | block_mask);
+    Entry* ways = set(ip);
+    std::move_backward(ways, ways + Ways - 1, ways + Ways);
+    ways[0].start = range.start;
+    ways[0].end = range.end;
+    ways[0].epoch = epoch;
+    ways[0].loc = loc;
+  }
+
+  /* the Location of ip from the cache, or else from lookup(ip, range), which
+   * sets range to the range or gap holding ip; range is set either way, cut
+   * to the block of ip
+   */
+  template <typename LookupTy>
+  Location query(Ip ip, IpRange& range, LookupTy lookup) {
+    Location loc;
+    if (find(ip, loc, range)) {
+      return loc;
+    }
+    uint32_t epoch = epochs_->epoch(ip);
+    loc = lookup(ip, range);
+    insert(ip, epoch, loc, range);
+    return loc;
+  }
+
+  /* query() of every ip of ips into out and ranges, the misses looked up
+   * with one call lookup(ArrayRef<Ip> ips, Location* out, IpRange* ranges)
+   */
+  template <typename LookupTy>
+  void query(ArrayRef<Ip> ips, Location* out, IpRange* ranges,
+             LookupTy lookup) {
+    miss_ips_.clear();
+    miss_idx_.clear();
+    miss_epochs_.clear();
+    for (size_t i = 0; i < ips.size(); ++i) {
+      if (!find(ips[i], out[i], ranges[i])) {
+        miss_ips_.push_back(ips[i]);
+        miss_idx_.push_back(i);
+        miss_epochs_.push_back(epochs_->epoch(ips[i]));
+      }
+    }
+    if (miss_ips_.empty()) {
+      return;
+    }
+    miss_locs_.resize(miss_ips_.size());
+    miss_ranges_.resize(miss_ips_.size());
+    lookup(ArrayRef<Ip>(miss_ips_), miss_locs_.data(), miss_ranges_.data());
+    for (size_t m = 0; m < miss_ips_.size(); ++m) {
+      insert(miss_ips_[m], miss_epochs_[m], miss_locs_[m], miss_ranges_[m]);
+      out[miss_idx_[m]] = miss_locs_[m];
+      ranges[miss_idx_[m]] = miss_ranges_[m];
+    }
+  }
+
+  const RangeCacheStats& stats() const { return stats_; }
+  void resetStats() { stats_ = RangeCacheStats(); }
+};
+
+}  // namespace ipq
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace ipq {
+
+/* a pointer to an immutable T, read by many threads without locks and
+ * replaced by one writer (read-copy-update). The writer publishes a new
+ * version with one atomic store; the versions it replaces are retired and
+ * freed once no reader can still see them, tracked with epochs:
+ *
+ * every reader thread owns a slot. Entering a read section, a reader stores
+ * the current global epoch in its slot and then loads the pointer; leaving
+ * it, it clears its slot. Publishing stores the new pointer, then advances
+ * the global epoch and tags the old version with the new epoch. A reader
+ * whose slot holds that epoch or a later one has loaded the pointer after it
+ * was replaced, so the old version is freed once every slot is clear or at
+ * least at its tag. All of this is sequentially consistent.
+ */
+template <typename T, size_t MaxReaders = 128>
+class RcuCell {
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<bool> used{false};
+  };
+
+  std::atomic<const T*> current_;
+  std::atomic<uint64_t> epoch_{1};
+  Slot slots_[MaxReaders];
+  // writer side: replaced versions and the epoch they were retired at
+  std::vector<std::pair<const T*, uint64_t>> retired_;
+
+ public:
+  /* the view of one reader thread, valid until the next read() of the same
+   * reader. Holding it keeps the version it points to alive.
+   */
+  class ReadGuard {
+    std::atomic<uint64_t>* slot_;
+    const T* ptr_;
+
+   public:
+    ReadGuard(std::atomic<uint64_t>& slot, const std::atomic<uint64_t>& epoch,
+              const std::atomic<const T*>& current)
+        : slot_(&slot) {
+      slot.store(epoch.load());
+      ptr_ = current.load();
+    }
+    ReadGuard(const ReadGuard&) = delete;
+    ReadGuard& operator=(const ReadGuard&) = delete;
+    ~ReadGuard() { slot_->store(0); }
+
+    const T* get() const { return ptr_; }
+    const T* operator->() const { return ptr_; }
+    const T& operator*() const { return *ptr_; }
+  };
+
+  // a registered reader, owned by one thread at a time
+  class Reader {
+    RcuCell* cell_ = nullptr;
+    Slot* slot_ = nullptr;
+
+   public:
+    Reader(RcuCell& cell, Slot& slot) : cell_(&cell), slot_(&slot) {}
+    Reader(Reader&& other)
+        : cell_(std::exchange(other.cell_, nullptr)),
+          slot_(std::exchange(other.slot_, nullptr)) {}
+    Reader& operator=(Reader&& other) {
+      std::swap(cell_, other.cell_);
+      std::swap(slot_, other.slot_);
+      return *this;
+    }
+    ~Reader() {
+      if (slot_) {
+        slot_->used.store(false);
+      }
+    }
+
+    // read sections do not nest
+    ReadGuard read() const {
+      IPQ_ASSERT(!slot_->epoch.load(std::memory_order_relaxed));
+      return ReadGuard(slot_->epoch, cell_->epoch_, cell_->current_);
+    }
+  };
+
+  explicit RcuCell(std::unique_ptr<const T> initial)
+      : current_(initial.release()) {}
+  RcuCell(const RcuCell&) = delete;
+  RcuCell& operator=(const RcuCell&) = delete;
+
+  // there must be no reader left
+  ~RcuCell() {
+    delete current_.load();
+    for (auto& version : retired_) {
+      delete version.first;
+    }
+  }
+
+  // a free reader slot, none if MaxReaders readers exist already
+  std::optional<Reader> reader() {
+    for (auto& slot : slots_) {
+      bool used = false;
+      if (slot.used.compare_exchange_strong(used, true)) {
+        return Reader(*this, slot);
+      }
+    }
+    return std::nullopt;
+  }
+
+  // the current version, for the writer
+  const T* get() const { return current_.load(); }
+
+  /* writer side: makes next the current version, the replaced one is freed
+   * by this or a later publish() or reclaim() once no reader sees it
+   */
+  void publish(std::unique_ptr<const T> next) {
+    const T* old = current_.exchange(next.release());
+    retired_.emplace_back(old, epoch_.fetch_add(1) + 1);
+    reclaim();
+  }
+
+  // frees the retired versions no reader can see, returns how many are left
+  size_t reclaim() {
+    if (retired_.empty()) {
+      return 0;
+    }
+    uint64_t oldest = UINT64_MAX;
+    for (auto& slot : slots_) {
+      uint64_t epoch = slot.epoch.load();
+      if (epoch) {
+        oldest = std::min(oldest, epoch);
+      }
+    }
+    size_t kept = 0;
+    for (auto& version : retired_) {
+      if (version.second <= oldest) {
+        delete version.first;
+      } else {
+        retired_[kept++] = version;
+      }
+    }
+    retired_.resize(kept);
+    return kept;
+  }
+
+  // waits until every retired version is freed
+  void synchronize() {
+    while (reclaim()) {
+      std::this_thread::yield();
+    }
+  }
+};
+
+}  // namespace ipq
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "array_ref.hpp"
+#include "data_storage.hpp"
+#include "ip.hpp"
+#include "location.hpp"
+#include "overlay_store.hpp"
+#include "rcu.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace ipq {
+
+/* storage of ip ranges queried by many threads without locks: readers see
+ * an immutable version published through an RcuCell, the only writer
+ * applies updates to its own copy and publishes a new version after each
+ * update. A version is a snapshot (OverlaySnapshot) shared with the other
+ * versions and a small delta of the updates since, so that publishing costs
+ * a copy of the delta; once the delta holds compact_threshold ranges the
+ * writer folds it into a new snapshot before publishing.
+ */
+class RcuStore {
+  struct Version {
+    std::shared_ptr<const OverlaySnapshot> snapshot;
+    OverlayDelta delta;
+
+    Location find(Ip ip) const {
+      if (const Location* loc = findInDelta(delta, ip)) {
+        return *loc;
+      }
+      if (snapshot) {
+        if (const Location* loc = snapshot->find(ip)) {
+          return *loc;
+        }
+      }
+      return Location();
+    }
+
+    /* find(ip), range set to the bounds of the range found. When nothing is
+     * found, range is the largest gap around ip.
+     */
+    Location find(Ip ip, IpRange& range) const {
+      return findWithBounds(ip, range, [this](Ip ip, IpRange& range) {
+        return findInLayers(delta, ip, range, [this](Ip ip, IpRange& range) {
+          return OverlaySnapshot::find(snapshot.get(), ip, range);
+        });
+      });
+    }
+  };
+  using CellTy = RcuCell<Version>;
+
+  CellTy cell_;
+  // the writer's copies of the current version
+  std::shared_ptr<const OverlaySnapshot> snapshot_;
+  OverlayDelta delta_;
+  size_t compact_threshold_;
+
+  void publish() {
+    if (delta_.keys.size() >= compact_threshold_) {
+      snapshot_ = OverlaySnapshot::merge(snapshot_.get(), delta_);
+      delta_.keys.clear();
+    }
+    cell_.publish(
+        std::unique_ptr<const Version>(new Version{snapshot_, delta_}));
+  }
+
+ public:
+  // the queries of one thread
+  class Reader {
+    CellTy::Reader reader_;
+
+   public:
+    explicit Reader(CellTy::Reader reader) : reader_(std::move(reader)) {}
+
+    Location query(Ip ip) const { return reader_.read()->find(ip); }
+
+    // out[i] = query(ips[i]), all from the same version
+    void query(ArrayRef<Ip> ips, Location* out) const {
+      auto version = reader_.read();
+      for (Ip ip : ips) {
+        *out++ = version->find(ip);
+      }
+    }
+
+    // query(ips, out) with ranges[i] the bounds of the range of ips[i]
+    void query(ArrayRef<Ip> ips, Location* out, IpRange* ranges) const {
+      auto version = reader_.read();
+      for (Ip ip : ips) {
+        *out++ = version->find(ip, *ranges++);
+      }
+    }
+  };
+
+  explicit RcuStore(size_t compact_threshold = 4096)
+      : cell_(std::unique_ptr<const Version>(new Version())),
+        compact_threshold_(compact_threshold) {}
+
+  // a reader for one more query thread, none if there are too many
+  std::optional<Reader> reader() {
+    auto reader = cell_.reader();
+    if (!reader) {
+      return std::nullopt;
+    }
+    return Reader(std::move(*reader));
+  }
+
+  // the writer side, from one thread; the writer reads without a read
+  // section, as only it frees versions
+  Location query(Ip ip) { return cell_.get()->find(ip); }
+
+  // query(ip), range set as Reader::query sets the ranges
+  Location queryRange(Ip ip, IpRange& range) {
+    return cell_.get()->find(ip, range);
+  }
+
+  void updateBlocking(Ip start, Ip end, Location loc) {
+    delta_.update(start, end, loc);
+    publish();
+  }
+
+  void batchUpdateBlocking(ArrayRef<IpRangeUpdate> updates) {
+    std::vector<IpRangeUpdate> tombstoned(updates.begin(), updates.end());
+    for (auto& u : tombstoned) {
+      if (!u.val) {
+        u.val = Location();
+      }
+    }
+    delta_.batch_update(tombstoned);
+    publish();
+  }
+
+  size_t deltaSize() const { return delta_.keys.size(); }
+};
+
+}  // namespace ipq
@@ -1,5 +1,8 @@
 #pragma once
 
+#include "config.hpp"
+
+#include <cstddef>
 #include <memory>
 
 namespace ipq {
@@ -17,8 +20,11 @@ struct SegmentTreeTrait {
 };
 
 template <typename ValueTy, typename AllocTy = std::allocator<ValueTy>>
-class SegmentTree : AllocTy::template rebind<ValueTy>::other {
+class SegmentTree
+    : std::allocator_traits<AllocTy>::template rebind_alloc<ValueTy> {
   using Trait = SegmentTreeTrait<ValueTy>;
+  using NodeAllocTy =
+      typename std::allocator_traits<AllocTy>::template rebind_alloc<ValueTy>;
   size_t left_edge_, right_edge_;
   ValueTy* storage_;
 
@@ -46,19 +52,37 @@ class SegmentTree : AllocTy::template rebind<ValueTy>::other {
   }
 
  public:
-  SegmentTree(size_t left, size_t right, const AllocTy& alloc = std::allocator<ValueTy>())
-      : AllocTy(alloc), left_edge_(left), right_edge_(right) {
-    size_t s = 2 * size();
-    storage_ = this->AllocTy::allocate(s);
+  /* only the root is initialized, values are pushed down to the children
+   * before they are read
+   */
+  SegmentTree(size_t left, size_t right, const AllocTy& alloc = AllocTy())
+      : NodeAllocTy(alloc), left_edge_(left), right_edge_(right) {
+    storage_ = this->NodeAllocTy::allocate(2 * size());
     Trait::initialNonExist(storage_);
   }
 
+  SegmentTree(const SegmentTree&) = delete;
+  SegmentTree& operator=(const SegmentTree&) = delete;
+
+  ~SegmentTree() { this->NodeAllocTy::deallocate(storage_, 2 * size()); }
+
   size_t size() { return right_edge_ - left_edge_ + 1; }
 
   /* use const ValueTy* as a work-around for std::optional
    */
   const ValueTy* find(size_t point) {
-    size_t pos = 0, left = left_edge_, right = right_edge_;
+    size_t left, right;
+    return find_range(point, left, right);
+  }
+
+  /* find(point), with [left, right] set to the segment of the node holding
+   * the value of point: every point in it has that value, but neighbouring
+   * nodes may hold the same one, so it is not always the largest such range
+   */
+  const ValueTy* find_range(size_t point, size_t& left, size_t& right) {
+    size_t pos = 0;
+    left = left_edge_;
+    right = right_edge_;
     while (left < right) {
       if (!Trait::isUnmarkValue(storage_[pos])) {
         break;
@@ -135,7 +159,7 @@ class SegmentTree : AllocTy::template rebind<ValueTy>::other {
           return;
         }
       }
-      assert(le == re);
+      IPQ_ASSERT(le == re);
       if (le == re) {
         storage_[pos] = val;
       }
@@ -162,7 +186,7 @@ class SegmentTree : AllocTy::template rebind<ValueTy>::other {
           return;
         }
       }
-      assert(le == re);
+      IPQ_ASSERT(le == re);
       if (le == re) {
         storage_[pos] = val;
       }
@@ -0,0 +1,425 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace ipq {
+
+/* the listening sockets of an endpoint, "tcp:host:port" (empty host for
+ * every address, port 0 for any free port) or "unix:path": one socket per
+ * event loop for TCP, each bound with SO_REUSEPORT so that the kernel spreads
+ * new connections over the loops, and one socket shared by the loops for a
+ * unix endpoint
+ */
+class Listeners {
+  std::vector<int> fds_;
+  bool unix_ = false;
+  std::string unix_path_;
+  uint16_t port_ = 0;
+
+  static bool fail(std::string& error, const std::string& what) {
+    error = what + ": " + std::strerror(errno);
+    return false;
+  }
+
+  // a listening socket for endpoint, -1 on error
+  int listenOn(const std::string& endpoint, std::string& error) {
+    int fd = -1;
+    if (endpoint.compare(0, 5, "unix:") == 0) {
+      unix_ = true;
+      unix_path_ = endpoint.substr(5);
+      sockaddr_un addr{};
+      addr.sun_family = AF_UNIX;
+      if (unix_path_.empty() || unix_path_.size() >= sizeof(addr.sun_path)) {
+        error = "invalid unix socket path: " + unix_path_;
+        return -1;
+      }
+      std::memcpy(addr.sun_path, unix_path_.data(), unix_path_.size());
+      // a socket left over by an earlier server is replaced
+      struct stat st;
+      if (::stat(unix_path_.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        ::unlink(unix_path_.c_str());
+      }
+      fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&addr),
+                           sizeof(addr)) < 0) {
+        fail(error, "bind " + endpoint);
+        if (fd >= 0) {
+          ::close(fd);
+        }
+        return -1;
+      }
+    } else if (endpoint.compare(0, 4, "tcp:") == 0) {
+      size_t colon = endpoint.rfind(':');
+      if (colon < 4) {
+        error = "invalid endpoint " + endpoint + ", expected tcp:host:port";
+        return -1;
+      }
+      std::string host = endpoint.substr(4, colon - 4);
+      std::string port =
+          port_ ? std::to_string(port_) : endpoint.substr(colon + 1);
+      addrinfo hints{}, *addrs = nullptr;
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+      int res = ::getaddrinfo(host.empty() ? nullptr : host.c_str(),
+                              port.c_str(), &hints, &addrs);
+      if (res) {
+        error = "invalid endpoint " + endpoint + ": " + ::gai_strerror(res);
+        return -1;
+      }
+      fd = ::socket(addrs->ai_family,
+                    SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      int one = 1;
+      if (fd < 0 ||
+          ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+          ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0 ||
+          ::bind(fd, addrs->ai_addr, addrs->ai_addrlen) < 0) {
+        fail(error, "bind " + endpoint);
+        ::freeaddrinfo(addrs);
+        if (fd >= 0) {
+          ::close(fd);
+        }
+        return -1;
+      }
+      ::freeaddrinfo(addrs);
+      // the port picked for port 0 is used by the other loops too
+      sockaddr_storage bound;
+      socklen_t len = sizeof(bound);
+      ::getsockname(fd, reinterpret_cast<sockaddr*>(&bound), &len);
+      port_ = ntohs(bound.ss_family == AF_INET6
+                        ? reinterpret_cast<sockaddr_in6*>(&bound)->sin6_port
+                        : reinterpret_cast<sockaddr_in*>(&bound)->sin_port);
+    } else {
+      error = "invalid endpoint " + endpoint +
+              ", expected tcp:host:port or unix:path";
+      return -1;
+    }
+    if (::listen(fd, SOMAXCONN) < 0) {
+      fail(error, "listen " + endpoint);
+      ::close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+ public:
+  Listeners() = default;
+  Listeners(const Listeners&) = delete;
+  Listeners& operator=(const Listeners&) = delete;
+  ~Listeners() { close(); }
+
+  // false with error set if the endpoint can not be listened on
+  bool open(const std::string& endpoint, unsigned loops, std::string& error) {
+    unsigned count = endpoint.compare(0, 5, "unix:") == 0 ? 1 : loops;
+    for (unsigned i = 0; i < count; ++i) {
+      int fd = listenOn(endpoint, error);
+      if (fd < 0) {
+        close();
+        return false;
+      }
+      fds_.push_back(fd);
+    }
+    return true;
+  }
+
+  // the socket loop accepts connections on
+  int fd(unsigned loop) const { return fds_[unix_ ? 0 : loop]; }
+  size_t size() const { return fds_.size(); }
+  // whether the loops share one socket
+  bool shared() const { return unix_; }
+  bool isUnix() const { return unix_; }
+  // the TCP port listened on, useful with port 0
+  uint16_t port() const { return port_; }
+
+  // closes the sockets and removes the unix socket
+  void close() {
+    for (int fd : fds_) {
+      ::close(fd);
+    }
+    fds_.clear();
+    if (unix_) {
+      ::unlink(unix_path_.c_str());
+      unix_ = false;
+    }
+    port_ = 0;
+  }
+};
+
+/* a stream socket server: one event loop (epoll) per thread, every loop
+ * accepting connections on its Listeners socket and serving them to the end.
+ *
+ * The protocol is left to a handler, one per loop, made by the handler
+ * factory. handler(in, out) is called with the bytes received and not
+ * consumed yet, it appends the responses to the requests it finds in them
+ * to out and returns the number of bytes it consumed; a client may send
+ * many requests without waiting (pipelining), whatever arrived in one read
+ * is handled in one call, and its responses sent with one write. A
+ * connection is closed after its last response when the handler returns
+ * Close, or when the client shuts it down.
+ */
+class Server {
+ public:
+  static constexpr size_t Close = size_t(-1);
+  using HandlerTy = std::function<size_t(std::string_view in, std::string& out)>;
+  using HandlerFactoryTy = std::function<HandlerTy(unsigned loop)>;
+
+ private:
+  // what an epoll event is about
+  struct Source {
+    enum class Kind { Stop, Listener, Connection } kind;
+    int fd;
+  };
+
+  struct Connection : Source {
+    explicit Connection(int fd) : Source{Kind::Connection, fd} {}
+    std::string in, out;
+    size_t out_sent = 0;
+    bool closing = false, writing = false;
+  };
+
+  struct Loop {
+    int epoll_fd = -1;
+    std::thread thread;
+  };
+
+  // stop reading from a connection while this much output is not sent
+  static constexpr size_t MaxPendingOutput = 4 << 20;
+  static constexpr size_t ReadSize = 64 << 10;
+
+  Listeners listening_;
+  std::vector<Source> listeners_;
+  Source stop_{Source::Kind::Stop, -1};
+  std::vector<Loop> loops_;
+
+  static void watch(int epoll_fd, int op, Connection* conn) {
+    epoll_event ev{};
+    ev.events = 0;
+    if (conn->writing) {
+      ev.events |= EPOLLOUT;
+    }
+    if (conn->out.size() - conn->out_sent < MaxPendingOutput &&
+        !conn->closing) {
+      ev.events |= EPOLLIN | EPOLLRDHUP;
+    }
+    ev.data.ptr = conn;
+    ::epoll_ctl(epoll_fd, op, conn->fd, &ev);
+  }
+
+  // sends what it can of the output, false if the connection is broken
+  static bool flush(Connection* conn) {
+    while (conn->out_sent < conn->out.size()) {
+      ssize_t n = ::send(conn->fd, conn->out.data() + conn->out_sent,
+                         conn->out.size() - conn->out_sent, MSG_NOSIGNAL);
+      if (n < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+      }
+      conn->out_sent += n;
+    }
+    conn->out.clear();
+    conn->out_sent = 0;
+    return true;
+  }
+
+  /* reads and handles what arrived, false if the connection is broken. The
+   * bytes are read into buf, and only copied to the connection when a
+   * request is incomplete (see feed()).
+   */
+  static bool serve(Connection* conn, HandlerTy& handler,
+                    std::vector<char>& buf) {
+    ssize_t n = ::recv(conn->fd, buf.data(), buf.size(), 0);
+    if (n < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    if (n == 0) {
+      // the client is done sending, what is left is an incomplete request
+      conn->closing = true;
+      return true;
+    }
+    if (!feed(handler, std::string_view(buf.data(), n), conn->in, conn->out)) {
+      conn->closing = true;
+    }
+    return true;
+  }
+
+  void run(Loop& loop, HandlerTy handler) {
+    std::vector<epoll_event> events(256);
+    std::vector<char> buf(ReadSize);
+    std::unordered_set<Connection*> connections;
+    while (true) {
+      int ready = ::epoll_wait(loop.epoll_fd, events.data(), events.size(), -1);
+      if (ready < 0 && errno != EINTR) {
+        break;
+      }
+      for (int e = 0; e < ready; ++e) {
+        auto* source = static_cast<Source*>(events[e].data.ptr);
+        if (source->kind == Source::Kind::Stop) {
+          for (auto* conn : connections) {
+            ::close(conn->fd);
+            delete conn;
+          }
+          return;
+        }
+        if (source->kind == Source::Kind::Listener) {
+          while (true) {
+            int fd = ::accept4(source->fd, nullptr, nullptr,
+                               SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+              break;
+            }
+            if (!listening_.isUnix()) {
+              int one = 1;
+              ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            }
+            auto* conn = new Connection(fd);
+            connections.insert(conn);
+            watch(loop.epoll_fd, EPOLL_CTL_ADD, conn);
+          }
+          continue;
+        }
+        auto* conn = static_cast<Connection*>(events[e].data.ptr);
+        bool ok = !(events[e].events & EPOLLERR);
+        if (ok && (events[e].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))) {
+          ok = serve(conn, handler, buf);
+        }
+        if (ok) {
+          ok = flush(conn);
+        }
+        bool pending = conn->out_sent < conn->out.size();
+        if (!ok || (conn->closing && !pending)) {
+          ::close(conn->fd);
+          connections.erase(conn);
+          delete conn;
+          continue;
+        }
+        conn->writing = pending;
+        watch(loop.epoll_fd, EPOLL_CTL_MOD, conn);
+      }
+    }
+  }
+
+ public:
+  /* hands received, following the bytes of earlier reads not consumed yet
+   * (kept in pending), to handler and keeps what it does not consume in
+   * pending; false if the handler closes the connection
+   */
+  static bool feed(HandlerTy& handler, std::string_view received,
+                   std::string& pending, std::string& out) {
+    std::string_view in = received;
+    if (!pending.empty()) {
+      pending.append(received);
+      in = pending;
+    }
+    size_t consumed = handler(in, out);
+    if (consumed == Close) {
+      pending.clear();
+      return false;
+    }
+    if (pending.empty()) {
+      pending.assign(in.substr(consumed));
+    } else {
+      pending.erase(0, consumed);
+    }
+    return true;
+  }
+
+  Server() = default;
+  Server(const Server&) = delete;
+  Server& operator=(const Server&) = delete;
+  ~Server() { stop(); }
+
+  /* starts threads event loops serving endpoint, false with error set if
+   * the endpoint can not be listened on or make_handler returns no handler
+   */
+  bool start(const std::string& endpoint, unsigned threads,
+             HandlerFactoryTy make_handler, std::string& error) {
+    threads = std::max(1u, threads);
+    if (!listening_.open(endpoint, threads, error)) {
+      return false;
+    }
+    // the loops keep pointers to the sources
+    listeners_.reserve(listening_.size());
+    for (unsigned i = 0; i < listening_.size(); ++i) {
+      listeners_.push_back({Source::Kind::Listener, listening_.fd(i)});
+    }
+    std::vector<HandlerTy> handlers;
+    for (unsigned i = 0; i < threads; ++i) {
+      handlers.push_back(make_handler(i));
+      if (!handlers.back()) {
+        error = "no handler for event loop " + std::to_string(i);
+        stop();
+        return false;
+      }
+    }
+    stop_.fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    loops_.resize(threads);
+    for (unsigned i = 0; i < threads; ++i) {
+      Loop& loop = loops_[i];
+      loop.epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+      epoll_event ev{};
+      ev.events = EPOLLIN;
+      ev.data.ptr = &stop_;
+      ::epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, stop_.fd, &ev);
+      Source& listener = listeners_[listening_.shared() ? 0 : i];
+      // a shared listener wakes one loop per connection
+      ev.events = listening_.shared() ? EPOLLIN | EPOLLEXCLUSIVE : EPOLLIN;
+      ev.data.ptr = &listener;
+      ::epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, listener.fd, &ev);
+    }
+    for (unsigned i = 0; i < threads; ++i) {
+      loops_[i].thread =
+          std::thread(&Server::run, this, std::ref(loops_[i]),
+                      std::move(handlers[i]));
+    }
+    return true;
+  }
+
+  // the TCP port listened on, useful with port 0
+  uint16_t port() const { return listening_.port(); }
+
+  // stops every loop and closes every connection
+  void stop() {
+    if (stop_.fd >= 0) {
+      uint64_t one = 1;
+      ssize_t res = ::write(stop_.fd, &one, sizeof(one));
+      (void)res;
+    }
+    for (auto& loop : loops_) {
+      if (loop.thread.joinable()) {
+        loop.thread.join();
+      }
+      ::close(loop.epoll_fd);
+    }
+    loops_.clear();
+    listeners_.clear();
+    listening_.close();
+    if (stop_.fd >= 0) {
+      ::close(stop_.fd);
+      stop_.fd = -1;
+    }
+  }
+};
+
+}  // namespace ipq
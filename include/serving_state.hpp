@@ -0,0 +1,93 @@
+#pragma once
+
+#include "array_ref.hpp"
+#include "data_storage.hpp"
+#include "ip.hpp"
+#include "location.hpp"
+#include "location_names.hpp"
+#include "range_cache.hpp"
+#include "rcu_store.hpp"
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <utility>
+
+namespace ipq {
+
+class ServingReader;
+
+/* what the server threads share: the ranges in a storage engine, an
+ * RcuStore unless another is given, and the names. Updates intern names
+ * under an exclusive lock of the names, queries take it shared once per
+ * batch to format the names. Updates of the engine are serialized by
+ * engine_mutex; every loop queries through a ServingReader, without locks
+ * if the engine has readers, otherwise under engine_mutex as well.
+ *
+ * With cache_prefix set, every loop of the line protocol queries through
+ * its own RangeCache of blocks of that prefix; the writers invalidate them
+ * through cache_epochs, and each cache adds its stats to cache_stats when
+ * its loop ends.
+ */
+struct ServingState {
+  explicit ServingState(LocationNames& names,
+                        std::unique_ptr<DataStorateConcept> engine =
+                            std::unique_ptr<DataStorateConcept>(
+                                new DataStorageModel<RcuStore>()))
+      : engine(std::move(engine)), names(names) {}
+
+  std::unique_ptr<DataStorateConcept> engine;
+  LocationNames& names;
+  std::shared_mutex names_mutex;
+  std::mutex engine_mutex;
+
+  unsigned cache_prefix = 0;
+  RangeCacheEpochs cache_epochs;
+  std::mutex cache_stats_mutex;
+  RangeCacheStats cache_stats;
+
+  // the queries of one more loop, none if the engine has no reader left
+  std::optional<ServingReader> reader();
+};
+
+// the queries of one loop of a server, to the engine of a ServingState
+class ServingReader {
+  ServingState* state_;
+  std::unique_ptr<DataStorageReader> reader_;
+
+ public:
+  ServingReader(ServingState& state, std::unique_ptr<DataStorageReader> reader)
+      : state_(&state), reader_(std::move(reader)) {}
+
+  void query(ArrayRef<Ip> ips, Location* out) {
+    if (reader_) {
+      reader_->query(ips, out);
+      return;
+    }
+    std::lock_guard<std::mutex> lock(state_->engine_mutex);
+    state_->engine->query(ips, out);
+  }
+
+  void query(ArrayRef<Ip> ips, Location* out, IpRange* ranges) {
+    if (reader_) {
+      reader_->query(ips, out, ranges);
+      return;
+    }
+    std::lock_guard<std::mutex> lock(state_->engine_mutex);
+    state_->engine->query(ips, out, ranges);
+  }
+};
+
+inline std::optional<ServingReader> ServingState::reader() {
+  if (!engine->hasReaders()) {
+    return ServingReader(*this, nullptr);
+  }
+  auto engine_reader = engine->reader();
+  if (!engine_reader) {
+    return std::nullopt;
+  }
+  return ServingReader(*this, std::move(engine_reader));
+}
+
+}  // namespace ipq
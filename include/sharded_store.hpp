@@ -0,0 +1,284 @@
+#pragma once
+
+#include "array_ref.hpp"
+#include "config.hpp"
+#include "data_storage.hpp"
+#include "interval_tree.hpp"
+#include "ip.hpp"
+#include "location.hpp"
+#include "spsc_queue.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace ipq {
+
+/* shared-nothing storage of ip ranges: the ip space is cut into a power of
+ * two of prefix shards, each with its own IntervalTree owned by one thread
+ * pinned to a core. Nothing of a shard is touched by another thread: its
+ * tree nodes are allocated by its own thread (so they come from that
+ * thread's malloc arena), and requests reach it through a lock-free queue.
+ *
+ * A batch of queries or updates is split by shard, every shard gets its part
+ * as one request and writes the answers straight into the caller's array;
+ * the caller waits until every shard is done. An update crossing a shard
+ * boundary is cut at it. A shard thread with nothing to do spins for a
+ * while, then sleeps until the next request rings its doorbell.
+ *
+ * Queries and updates must come from one thread, the producer of every
+ * queue.
+ */
+class ShardedStore {
+  struct Request {
+    enum class Kind { Query, Update, Stop } kind = Kind::Stop;
+    // queries: out[idx[i]] = location of ips[i], with ranges[idx[i]] its
+    // bounds if ranges is set
+    const Ip* ips = nullptr;
+    const size_t* idx = nullptr;
+    Location* out = nullptr;
+    IpRange* ranges = nullptr;
+    // updates, applied as one batch
+    const IpRangeUpdate* updates = nullptr;
+    size_t count = 0;
+    std::atomic<size_t>* pending = nullptr;
+  };
+
+  struct alignas(64) Shard {
+    SpscQueue<Request> requests{256};
+    std::atomic<bool> sleeping{false};
+    std::mutex mutex;
+    std::condition_variable doorbell;
+    std::thread thread;
+    IntervalTree<Ip, Location, std::map<Ip, std::pair<Ip, Location>>> tree;
+    // the caller's scratch space for the part of a batch going to the shard
+    std::vector<Ip> ips;
+    std::vector<size_t> idx;
+    std::vector<IpRangeUpdate> updates;
+  };
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+  unsigned shard_bits_;
+
+  size_t shardOf(Ip ip) const {
+    return shard_bits_ ? ip >> (32 - shard_bits_) : 0;
+  }
+
+  Ip shardStart(size_t shard) const {
+    return Ip(uint64_t(shard) << (32 - shard_bits_));
+  }
+
+  Ip shardEnd(size_t shard) const {
+    return Ip(((uint64_t(shard) + 1) << (32 - shard_bits_)) - 1);
+  }
+
+  static void serve(Shard& shard) {
+    const int spins = 1000;
+    Request request;
+    while (true) {
+      int idle = 0;
+      while (!shard.requests.pop(request)) {
+        if (++idle < spins) {
+          std::this_thread::yield();
+          continue;
+        }
+        // the producer checks sleeping after pushing, so either it sees the
+        // flag or this thread sees the request
+        shard.sleeping.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        shard.doorbell.wait(lock, [&]() { return !shard.requests.empty(); });
+        shard.sleeping.store(false);
+        idle = 0;
+      }
+      if (request.kind == Request::Kind::Stop) {
+        return;
+      }
+      if (request.kind == Request::Kind::Query && request.ranges) {
+        for (size_t i = 0; i < request.count; ++i) {
+          IpRange& range = request.ranges[request.idx[i]];
+          Location* loc =
+              shard.tree.find_range(request.ips[i], range.start, range.end);
+          request.out[request.idx[i]] = loc ? *loc : Location();
+        }
+      } else if (request.kind == Request::Kind::Query) {
+        for (size_t i = 0; i < request.count; ++i) {
+          Location* loc = shard.tree.find(request.ips[i]);
+          request.out[request.idx[i]] = loc ? *loc : Location();
+        }
+      } else {
+        shard.tree.batch_update(
+            ArrayRef<IpRangeUpdate>(request.updates, request.count));
+      }
+      request.pending->fetch_sub(1, std::memory_order_release);
+    }
+  }
+
+  void send(Shard& shard, const Request& request) {
+    while (!shard.requests.push(request)) {
+      std::this_thread::yield();
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (shard.sleeping.load()) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      shard.doorbell.notify_one();
+    }
+  }
+
+  static void wait(const std::atomic<size_t>& pending) {
+    while (pending.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+  }
+
+ public:
+  /* 2^shard_bits shards; by default about one per core. Shard k runs on core
+   * k modulo the number of cores.
+   */
+  explicit ShardedStore(int shard_bits = -1) {
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    if (shard_bits < 0) {
+      shard_bits = 0;
+      while ((2u << shard_bits) <= cores && shard_bits < 8) {
+        ++shard_bits;
+      }
+    }
+    IPQ_ASSERT(shard_bits <= 16);
+    shard_bits_ = shard_bits;
+    for (size_t k = 0; k < (size_t(1) << shard_bits_); ++k) {
+      shards_.emplace_back(new Shard());
+      Shard& shard = *shards_.back();
+      shard.thread = std::thread(serve, std::ref(shard));
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(k % cores, &cpus);
+      // pinning is best effort, a restricted process keeps the default
+      pthread_setaffinity_np(shard.thread.native_handle(), sizeof(cpus),
+                             &cpus);
+    }
+  }
+
+  ShardedStore(const ShardedStore&) = delete;
+  ShardedStore& operator=(const ShardedStore&) = delete;
+
+  ~ShardedStore() {
+    for (auto& shard : shards_) {
+      send(*shard, Request());
+    }
+    for (auto& shard : shards_) {
+      shard->thread.join();
+    }
+  }
+
+  size_t shards() const { return shards_.size(); }
+
+  // out[i] = location of ips[i], each shard answering its part
+  void queryBatch(ArrayRef<Ip> ips, Location* out) {
+    queryRangeBatch(ips, out, nullptr);
+  }
+
+  /* queryBatch(ips, out), with ranges[i] (unless ranges is null) the range
+   * of ips[i] or the gap around it; a shard only knows its own part of the
+   * ip space, so gaps are cut at the shard bounds
+   */
+  void queryRangeBatch(ArrayRef<Ip> ips, Location* out, IpRange* ranges) {
+    for (size_t i = 0; i < ips.size(); ++i) {
+      Shard& shard = *shards_[shardOf(ips[i])];
+      shard.ips.push_back(ips[i]);
+      shard.idx.push_back(i);
+    }
+    std::atomic<size_t> pending{0};
+    for (auto& shard : shards_) {
+      if (!shard->ips.empty()) {
+        pending.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    for (auto& shard : shards_) {
+      if (shard->ips.empty()) {
+        continue;
+      }
+      Request request;
+      request.kind = Request::Kind::Query;
+      request.ips = shard->ips.data();
+      request.idx = shard->idx.data();
+      request.out = out;
+      request.ranges = ranges;
+      request.count = shard->ips.size();
+      request.pending = &pending;
+      send(*shard, request);
+    }
+    wait(pending);
+    for (auto& shard : shards_) {
+      shard->ips.clear();
+      shard->idx.clear();
+    }
+    for (size_t i = 0; ranges && i < ips.size(); ++i) {
+      size_t shard = shardOf(ips[i]);
+      ranges[i].start = std::max(ranges[i].start, shardStart(shard));
+      ranges[i].end = std::min(ranges[i].end, shardEnd(shard));
+    }
+  }
+
+  Location query(Ip ip) {
+    Location loc;
+    queryBatch(ArrayRef<Ip>(&ip, 1), &loc);
+    return loc;
+  }
+
+  Location queryRange(Ip ip, IpRange& range) {
+    Location loc;
+    queryRangeBatch(ArrayRef<Ip>(&ip, 1), &loc, &range);
+    return loc;
+  }
+
+  /* applies updates as IntervalTree::batch_update() does, every shard gets
+   * the pieces of the updates inside it, in the original order
+   */
+  void batchUpdateBlocking(ArrayRef<IpRangeUpdate> updates) {
+    for (auto& u : updates) {
+      for (size_t k = shardOf(u.start); k <= shardOf(u.end); ++k) {
+        IpRangeUpdate piece = u;
+        piece.start = std::max(u.start, shardStart(k));
+        piece.end = std::min(u.end, shardEnd(k));
+        shards_[k]->updates.push_back(piece);
+      }
+    }
+    std::atomic<size_t> pending{0};
+    for (auto& shard : shards_) {
+      if (!shard->updates.empty()) {
+        pending.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    for (auto& shard : shards_) {
+      if (shard->updates.empty()) {
+        continue;
+      }
+      Request request;
+      request.kind = Request::Kind::Update;
+      request.updates = shard->updates.data();
+      request.count = shard->updates.size();
+      request.pending = &pending;
+      send(*shard, request);
+    }
+    wait(pending);
+    for (auto& shard : shards_) {
+      shard->updates.clear();
+    }
+  }
+
+  void updateBlocking(Ip start, Ip end, Location loc) {
+    batchUpdateBlocking({IpRangeUpdate{start, end, loc}});
+  }
+};
+
+}  // namespace ipq
@@ -0,0 +1,371 @@
+#pragma once
+
+#include "ipqdb.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ipq {
+
+/* a compiled database shared by the processes of a box. A loader
+ * (SharedDbPublisher) copies ipqdb images, which only hold offsets and so
+ * work at any address, into memfds sealed against any write, shrink or
+ * growth, and keeps them open; a small POSIX shared memory control segment
+ * "/name" tells which generation is current and where its memfd is, as the
+ * loader's pid and descriptor, opened by workers through /proc. Workers
+ * (SharedDb) map the control segment and the current image read-only and
+ * query the image in place, so a box holds one copy of the ranges whatever
+ * the number of workers, and a worker starts without parsing or building
+ * anything. An image is only used once its seals are checked, so it is the
+ * image the loader validated for as long as it is mapped. A new generation
+ * is published by sealing its memfd, switching the control segment to it
+ * and closing the previous one; workers still mapping that one keep it
+ * until they move on.
+ */
+namespace shareddb {
+
+constexpr char Magic[8] = {'I', 'P', 'Q', 'S', 'H', 'M', '\r', '\n'};
+constexpr uint32_t Version = 2;
+constexpr int Seals = F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_GROW;
+
+struct Control {
+  char magic[8];
+  // stored last when the segment is made, 0 until the magic is there
+  std::atomic<uint32_t> version;
+  // odd while the loader changes the fields below
+  std::atomic<uint64_t> sequence;
+  // the current image, generation 0 if none was published yet
+  std::atomic<uint64_t> generation, size;
+  // the memfd of the current image, open in the loader
+  std::atomic<uint64_t> pid, fd;
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+                  std::atomic<uint32_t>::is_always_lock_free,
+              "the control block is shared between processes");
+
+inline std::string imagePath(uint64_t pid, uint64_t fd) {
+  return "/proc/" + std::to_string(pid) + "/fd/" + std::to_string(fd);
+}
+
+// a shared mapping of a whole file, unmapped on destruction
+class Mapping {
+  void* addr_ = nullptr;
+  size_t size_ = 0;
+
+ public:
+  Mapping() = default;
+  Mapping(const Mapping&) = delete;
+  Mapping& operator=(const Mapping&) = delete;
+  ~Mapping() { reset(); }
+
+  // maps size bytes of fd, writable or not
+  bool map(int fd, size_t size, bool writable) {
+    reset();
+    void* addr = mmap(nullptr, size, PROT_READ | (writable ? PROT_WRITE : 0),
+                      MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+      return false;
+    }
+    addr_ = addr;
+    size_ = size;
+    return true;
+  }
+
+  void reset() {
+    if (addr_) {
+      munmap(addr_, size_);
+    }
+    addr_ = nullptr;
+    size_ = 0;
+  }
+
+  void swap(Mapping& other) {
+    std::swap(addr_, other.addr_);
+    std::swap(size_, other.size_);
+  }
+
+  char* data() const { return static_cast<char*>(addr_); }
+  size_t size() const { return size_; }
+};
+
+// segment names start with the only slash
+inline bool validName(std::string_view name) {
+  return !name.empty() && name.size() < 200 &&
+         name.find('/') == name.npos;
+}
+
+}  // namespace shareddb
+
+/* the loader side: owns the control segment of a name and the memfds of
+ * the generations, which live as long as it does; the destructor
+ * unpublishes. One loader per name at a time.
+ */
+class SharedDbPublisher {
+  std::string name_;
+  shareddb::Mapping control_map_;
+  shareddb::Control* control_ = nullptr;
+  uint64_t generation_ = 0;
+  int fd_ = -1;
+
+ public:
+  SharedDbPublisher() = default;
+  SharedDbPublisher(const SharedDbPublisher&) = delete;
+  SharedDbPublisher& operator=(const SharedDbPublisher&) = delete;
+  ~SharedDbPublisher() { unpublish(); }
+
+  /* opens the control segment of name, made if it does not exist; a
+   * loader taking over from a previous one goes on from its generation
+   */
+  bool open(std::string_view name, std::string& error) {
+    using namespace shareddb;
+    if (!validName(name)) {
+      error = "invalid shared database name: " + std::string(name);
+      return false;
+    }
+    name_ = '/' + std::string(name);
+    int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat st;
+    bool ok = fd >= 0 && fstat(fd, &st) == 0 &&
+              (size_t(st.st_size) >= sizeof(Control) ||
+               ftruncate(fd, sizeof(Control)) == 0) &&
+              control_map_.map(fd, sizeof(Control), true);
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    if (!ok) {
+      error = "can not open shared memory " + name_ + ": " +
+              std::strerror(errno);
+      return false;
+    }
+    control_ = reinterpret_cast<Control*>(control_map_.data());
+    if (control_->version.load(std::memory_order_acquire) == 0) {
+      // a new segment is zero filled, workers wait for the version
+      std::memcpy(control_->magic, Magic, sizeof(Magic));
+      control_->version.store(Version, std::memory_order_release);
+    } else if (std::memcmp(control_->magic, Magic, sizeof(Magic)) ||
+               control_->version.load(std::memory_order_relaxed) !=
+                   Version) {
+      error = name_ + " is not a shared ipq database";
+      control_map_.reset();
+      control_ = nullptr;
+      return false;
+    }
+    generation_ = control_->generation.load(std::memory_order_relaxed);
+    return true;
+  }
+
+  /* publishes image, a valid ipqdb image, as the next generation: copied
+   * into a new sealed memfd which then becomes the current one
+   */
+  bool publish(std::string_view image, std::string& error) {
+    using namespace shareddb;
+    uint64_t generation = generation_ + 1;
+    std::string label = name_.substr(1) + '.' + std::to_string(generation);
+    int fd = memfd_create(label.c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+      error = "can not create a memfd for " + label + ": " +
+              std::strerror(errno);
+      return false;
+    }
+    size_t written = 0;
+    bool ok = ftruncate(fd, image.size()) == 0;
+    while (ok && written < image.size()) {
+      ssize_t n = ::pwrite(fd, image.data() + written, image.size() - written,
+                           written);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      ok = n > 0;
+      written += ok ? n : 0;
+    }
+    if (!ok || fcntl(fd, F_ADD_SEALS, Seals | F_SEAL_SEAL) < 0) {
+      error = "can not write the memfd of " + label + ": " +
+              std::strerror(errno);
+      ::close(fd);
+      return false;
+    }
+    control_->sequence.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    control_->generation.store(generation, std::memory_order_relaxed);
+    control_->size.store(image.size(), std::memory_order_relaxed);
+    control_->pid.store(uint64_t(::getpid()), std::memory_order_relaxed);
+    control_->fd.store(uint64_t(fd), std::memory_order_relaxed);
+    control_->sequence.fetch_add(1, std::memory_order_release);
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+    fd_ = fd;
+    generation_ = generation;
+    return true;
+  }
+
+  // closes the current image and unlinks the control segment
+  void unpublish() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+      fd_ = -1;
+    }
+    if (!control_) {
+      return;
+    }
+    shm_unlink(name_.c_str());
+    control_map_.reset();
+    control_ = nullptr;
+    generation_ = 0;
+  }
+
+  uint64_t generation() const { return generation_; }
+
+  // where workers open the current image, empty before publish()
+  std::string imagePath() const {
+    return fd_ < 0 ? std::string()
+                   : shareddb::imagePath(uint64_t(::getpid()), fd_);
+  }
+};
+
+/* the worker side: the current image of a name, mapped read-only. The image
+ * stays mapped until the next successful refresh() or the destruction.
+ */
+class SharedDb {
+  std::string name_;
+  shareddb::Mapping control_map_, image_;
+  const shareddb::Control* control_ = nullptr;
+  uint64_t generation_ = 0;
+
+  struct Current {
+    uint64_t generation, size, pid, fd;
+  };
+
+  // the fields of the current generation, as published together
+  Current current() const {
+    while (true) {
+      uint64_t sequence = control_->sequence.load(std::memory_order_acquire);
+      if (!(sequence & 1)) {
+        Current c;
+        c.generation = control_->generation.load(std::memory_order_relaxed);
+        c.size = control_->size.load(std::memory_order_relaxed);
+        c.pid = control_->pid.load(std::memory_order_relaxed);
+        c.fd = control_->fd.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (control_->sequence.load(std::memory_order_relaxed) == sequence) {
+          return c;
+        }
+      }
+      std::this_thread::yield();
+    }
+  }
+
+ public:
+  // maps the control segment of name and its current image
+  bool attach(std::string_view name, std::string& error) {
+    using namespace shareddb;
+    if (!validName(name)) {
+      error = "invalid shared database name: " + std::string(name);
+      return false;
+    }
+    name_ = '/' + std::string(name);
+    int fd = shm_open(name_.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    struct stat st;
+    bool ok = fd >= 0 && fstat(fd, &st) == 0 &&
+              size_t(st.st_size) >= sizeof(Control) &&
+              control_map_.map(fd, sizeof(Control), false);
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    if (!ok) {
+      error = "no shared database " + name_;
+      return false;
+    }
+    control_ = reinterpret_cast<const Control*>(control_map_.data());
+    uint32_t version = control_->version.load(std::memory_order_acquire);
+    if (version == 0) {
+      error = "nothing published in " + name_ + " yet";
+      return false;
+    }
+    if (std::memcmp(control_->magic, Magic, sizeof(Magic)) ||
+        version != Version) {
+      error = name_ + " is not a shared ipq database";
+      return false;
+    }
+    return refresh(error);
+  }
+
+  // whether the loader published a generation after the one mapped
+  bool changed() const {
+    return control_->generation.load(std::memory_order_relaxed) !=
+           generation_;
+  }
+
+  /* maps the current generation in place of the one mapped; false with
+   * error set, the mapped one kept, if it can not be mapped
+   */
+  bool refresh(std::string& error) {
+    using namespace shareddb;
+    while (true) {
+      Current c = current();
+      if (!c.generation) {
+        error = "nothing published in " + name_ + " yet";
+        return false;
+      }
+      std::string path = imagePath(c.pid, c.fd);
+      int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      int open_errno = errno;
+      // the loader closes a generation once replaced, and may then reuse
+      // its descriptor: what was opened is only known to be c.generation
+      // if that is still the current one
+      if (current().generation != c.generation) {
+        if (fd >= 0) {
+          ::close(fd);
+        }
+        continue;
+      }
+      if (fd < 0) {
+        error = "can not open the image of " + name_ + ": " +
+                std::strerror(open_errno);
+        return false;
+      }
+      struct stat st;
+      Mapping image;
+      bool sealed = (fcntl(fd, F_GET_SEALS) & Seals) == Seals;
+      bool ok = sealed && fstat(fd, &st) == 0 &&
+                uint64_t(st.st_size) == c.size &&
+                image.map(fd, c.size, false);
+      ::close(fd);
+      FrozenDb check;
+      if (!ok) {
+        error = name_ + ": " +
+                (sealed ? "can not map the image" : "the image is not sealed");
+        return false;
+      }
+      // only the checksums are skipped, the ids and offsets are checked
+      if (!check.attach(image.data(), image.size(), error, false)) {
+        error = name_ + ": " + error;
+        return false;
+      }
+      image_.swap(image);
+      generation_ = c.generation;
+      return true;
+    }
+  }
+
+  uint64_t generation() const { return generation_; }
+
+  // the ipqdb image, for FrozenDb::attach() without checking the sections
+  std::string_view image() const {
+    return std::string_view(image_.data(), image_.size());
+  }
+};
+
+}  // namespace ipq
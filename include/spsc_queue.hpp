@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace ipq {
+
+/* bounded lock-free queue between one producer thread and one consumer
+ * thread: a ring whose head is written by the consumer only and whose tail
+ * by the producer only, each on its own cache line. Each side keeps a stale
+ * copy of the other side's index and only reloads it when the ring looks
+ * full (or empty), so the lines move between cores once per batch rather
+ * than once per element.
+ */
+template <typename T>
+class SpscQueue {
+  std::vector<T> ring_;
+  size_t mask_;
+  // written by the consumer
+  alignas(64) std::atomic<size_t> head_{0};
+  size_t cached_tail_ = 0;
+  // written by the producer
+  alignas(64) std::atomic<size_t> tail_{0};
+  size_t cached_head_ = 0;
+
+ public:
+  // capacity is rounded up to a power of two
+  explicit SpscQueue(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    ring_.resize(size);
+    mask_ = size - 1;
+  }
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+
+  // producer side, false if the queue is full
+  bool push(const T& item) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ > mask_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ > mask_) {
+        return false;
+      }
+    }
+    ring_[tail & mask_] = item;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer side, false if the queue is empty
+  bool pop(T& item) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_) {
+        return false;
+      }
+    }
+    item = ring_[head & mask_];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // from either side, exact only when the other side is idle
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) ==
+           tail_.load(std::memory_order_acquire);
+  }
+};
+
+}  // namespace ipq
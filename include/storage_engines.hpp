@@ -0,0 +1,114 @@
+#pragma once
+
+#include "btree_map.hpp"
+#include "data_storage.hpp"
+#include "interval_tree.hpp"
+#include "ip.hpp"
+#include "location.hpp"
+#include "mmap_allocator.hpp"
+#include "overlay_store.hpp"
+#include "rcu_store.hpp"
+#include "segment_tree.hpp"
+#include "sharded_store.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ipq {
+
+using StlEngine = IntervalTree<Ip, Location, std::map<Ip, std::pair<Ip, Location>>>;
+using BTreeEngine =
+    IntervalTree<Ip, Location, BTreeMap<Ip, std::pair<Ip, Location>>>;
+
+// a SegmentTree over the whole ip space, its nodes are only backed by memory
+// once written
+using MmapSegmentTree = SegmentTree<Location, MmapAllocator<Location>>;
+struct SegmentEngine : MmapSegmentTree {
+  SegmentEngine() : MmapSegmentTree(0, UINT32_MAX) {}
+
+  // the range is the node segment of find_range()
+  Location queryRange(Ip ip, IpRange& range) {
+    size_t left, right;
+    const Location* loc = find_range(ip, left, right);
+    range = {Ip(left), Ip(right)};
+    return loc ? *loc : Location();
+  }
+};
+
+/* the storage engines selectable at run time by name. Every engine is a
+ * DataStorageModel, so it is driven through its own native operations;
+ * more engines are added with add().
+ */
+class StorageEngines {
+ public:
+  using FactoryTy = std::function<std::unique_ptr<DataStorateConcept>()>;
+
+  struct Engine {
+    std::string name, description;
+    FactoryTy create;
+  };
+
+  // the registry, with the built-in engines
+  static StorageEngines& instance() {
+    static StorageEngines engines;
+    return engines;
+  }
+
+  // false if an engine of that name exists already
+  bool add(std::string name, std::string description, FactoryTy create) {
+    if (find(name)) {
+      return false;
+    }
+    engines_.push_back({std::move(name), std::move(description),
+                        std::move(create)});
+    return true;
+  }
+
+  // an empty engine, nullptr if there is no engine of that name
+  std::unique_ptr<DataStorateConcept> create(std::string_view name) const {
+    const Engine* engine = find(name);
+    return engine ? engine->create() : nullptr;
+  }
+
+  const Engine* find(std::string_view name) const {
+    for (auto& engine : engines_) {
+      if (engine.name == name) {
+        return &engine;
+      }
+    }
+    return nullptr;
+  }
+
+  const std::vector<Engine>& engines() const { return engines_; }
+
+ private:
+  std::vector<Engine> engines_;
+
+  template <typename ImplT>
+  void addModel(std::string name, std::string description) {
+    add(std::move(name), std::move(description), []() {
+      return std::unique_ptr<DataStorateConcept>(
+          new DataStorageModel<ImplT>());
+    });
+  }
+
+  StorageEngines() {
+    addModel<StlEngine>("stl", "interval tree on std::map");
+    addModel<BTreeEngine>("btree", "interval tree on ipq::BTreeMap");
+    addModel<SegmentEngine>("segment",
+                            "segment tree over the whole ip space");
+    addModel<OverlayStore>(
+        "overlay", "frozen snapshot under a delta of recent updates");
+    addModel<RcuStore>("rcu", "versions published for lock-free readers");
+    addModel<ShardedStore>("sharded",
+                           "prefix shards owned by one pinned thread each");
+  }
+};
+
+}  // namespace ipq
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ipq {
+
+namespace internal {
+
+inline uint64_t hashBytes(const char* p, size_t n) {
+  // FNV-1a
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < n; ++i) {
+    h = (h ^ uint8_t(p[i])) * 0x100000001b3ull;
+  }
+  return h;
+}
+
+inline uint64_t hashUint64(uint64_t x) {
+  // splitmix64 finalizer
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+/* open-addressing (linear probing) table of ids. The keys live with the
+ * owner, which passes the hash of the key being searched and a predicate
+ * matching an id against it.
+ */
+class IdTable {
+  // 0 for an empty slot, id + 1 otherwise
+  std::vector<uint32_t> slots_;
+  size_t mask_ = 0;
+
+ public:
+  static constexpr uint32_t NotFound = uint32_t(-1);
+
+  /* the slot holding the matching id, or the empty slot where it belongs.
+   * The table must not be empty.
+   */
+  template <typename MatchTy>
+  size_t find(uint64_t hash, MatchTy match) const {
+    IPQ_ASSERT(!slots_.empty());
+    for (size_t pos = hash & mask_;; pos = (pos + 1) & mask_) {
+      if (!slots_[pos] || match(slots_[pos] - 1)) {
+        return pos;
+      }
+    }
+  }
+
+  uint32_t id(size_t pos) const { return slots_[pos] - 1; }
+  bool empty(size_t pos) const { return !slots_[pos]; }
+  void set(size_t pos, uint32_t id) { slots_[pos] = id + 1; }
+
+  /* grows the table so that it holds ids, rehashing with hash_of(id)
+   */
+  template <typename HashTy>
+  void reserve(size_t ids, HashTy hash_of) {
+    // keep the load factor under 1/2
+    if (ids * 2 <= slots_.size()) {
+      return;
+    }
+    size_t capacity = 16;
+    while (capacity < ids * 2) {
+      capacity <<= 1;
+    }
+    std::vector<uint32_t> old_slots(capacity, 0);
+    old_slots.swap(slots_);
+    mask_ = capacity - 1;
+    for (uint32_t slot : old_slots) {
+      if (slot) {
+        size_t pos = hash_of(slot - 1) & mask_;
+        while (slots_[pos]) {
+          pos = (pos + 1) & mask_;
+        }
+        slots_[pos] = slot;
+      }
+    }
+  }
+
+  size_t capacity() const { return slots_.size(); }
+};
+
+}  // namespace internal
+
+/* maps strings to dense, stable uint32_t ids (0, 1, 2... in the order of
+ * first interning). The bytes of all strings are stored back to back in one
+ * arena, each string once, and looked up through an open-addressing table.
+ * Views returned by get() are invalidated by intern().
+ */
+class StringInterner {
+  std::vector<char> arena_;
+  // string id spans [offsets_[id], offsets_[id + 1]) of arena_
+  std::vector<uint32_t> offsets_{0};
+  std::vector<uint64_t> hashes_;
+  internal::IdTable table_;
+
+  size_t slot(std::string_view str, uint64_t hash) const {
+    return table_.find(hash, [&](uint32_t id) {
+      return hashes_[id] == hash && get(id) == str;
+    });
+  }
+
+ public:
+  static constexpr uint32_t NotFound = internal::IdTable::NotFound;
+
+  uint32_t intern(std::string_view str) {
+    uint64_t hash = internal::hashBytes(str.data(), str.size());
+    uint32_t id = size();
+    table_.reserve(id + 1, [&](uint32_t id) { return hashes_[id]; });
+    size_t pos = slot(str, hash);
+    if (!table_.empty(pos)) {
+      return table_.id(pos);
+    }
+    table_.set(pos, id);
+    arena_.insert(arena_.end(), str.begin(), str.end());
+    offsets_.push_back(arena_.size());
+    hashes_.push_back(hash);
+    return id;
+  }
+
+  uint32_t find(std::string_view str) const {
+    if (!size()) {
+      return NotFound;
+    }
+    size_t pos = slot(str, internal::hashBytes(str.data(), str.size()));
+    return table_.empty(pos) ? NotFound : table_.id(pos);
+  }
+
+  std::string_view get(uint32_t id) const {
+    IPQ_ASSERT(id < size());
+    return std::string_view(arena_.data() + offsets_[id],
+                            offsets_[id + 1] - offsets_[id]);
+  }
+
+  uint32_t size() const { return offsets_.size() - 1; }
+
+  // bytes used by the strings, the offsets and the hash table
+  size_t memory() const {
+    return arena_.capacity() + offsets_.capacity() * sizeof(uint32_t) +
+           hashes_.capacity() * sizeof(uint64_t) +
+           table_.capacity() * sizeof(uint32_t);
+  }
+};
+
+/* maps pairs of uint32_t (typically ids of a StringInterner) to dense,
+ * stable uint32_t ids, in the same way as StringInterner
+ */
+class PairInterner {
+  std::vector<std::pair<uint32_t, uint32_t>> pairs_;
+  internal::IdTable table_;
+
+  static uint64_t key(uint32_t first, uint32_t second) {
+    return uint64_t(first) << 32 | second;
+  }
+
+  size_t slot(uint32_t first, uint32_t second) const {
+    return table_.find(internal::hashUint64(key(first, second)),
+                       [&](uint32_t id) {
+                         return pairs_[id].first == first &&
+                                pairs_[id].second == second;
+                       });
+  }
+
+ public:
+  static constexpr uint32_t NotFound = internal::IdTable::NotFound;
+
+  uint32_t intern(uint32_t first, uint32_t second) {
+    uint32_t id = size();
+    table_.reserve(id + 1, [&](uint32_t id) {
+      return internal::hashUint64(key(pairs_[id].first, pairs_[id].second));
+    });
+    size_t pos = slot(first, second);
+    if (!table_.empty(pos)) {
+      return table_.id(pos);
+    }
+    table_.set(pos, id);
+    pairs_.emplace_back(first, second);
+    return id;
+  }
+
+  uint32_t find(uint32_t first, uint32_t second) const {
+    if (!size()) {
+      return NotFound;
+    }
+    size_t pos = slot(first, second);
+    return table_.empty(pos) ? NotFound : table_.id(pos);
+  }
+
+  const std::pair<uint32_t, uint32_t>& get(uint32_t id) const {
+    IPQ_ASSERT(id < size());
+    return pairs_[id];
+  }
+
+  uint32_t size() const { return pairs_.size(); }
+
+  size_t memory() const {
+    return pairs_.capacity() * sizeof(pairs_[0]) +
+           table_.capacity() * sizeof(uint32_t);
+  }
+};
+
+}  // namespace ipq
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace ipq {
+
+/* a minimal io_uring, straight on the system calls: the submission and
+ * completion rings are shared with the kernel, requests are queued and
+ * completions drained without a system call, and one io_uring_enter()
+ * submits everything queued and waits for completions. Used by one thread.
+ */
+class Uring {
+  int fd_ = -1;
+  void* sq_ring_ = MAP_FAILED;
+  void* cq_ring_ = MAP_FAILED;
+  size_t sq_ring_size_ = 0, cq_ring_size_ = 0, sqes_size_ = 0;
+  io_uring_sqe* sqes_ = static_cast<io_uring_sqe*>(MAP_FAILED);
+  // the kernel moves sq_head_ and cq_tail_, this side the others
+  unsigned *sq_head_ = nullptr, *sq_tail_ = nullptr;
+  unsigned *cq_head_ = nullptr, *cq_tail_ = nullptr;
+  unsigned sq_mask_ = 0, sq_entries_ = 0, cq_mask_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+  // queued and not submitted yet
+  unsigned queued_ = 0;
+
+  template <typename T>
+  static T* at(void* base, unsigned offset) {
+    return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+  }
+
+  static bool fail(std::string& error, const char* what, int err) {
+    error = std::string(what) + ": " + std::strerror(err);
+    return false;
+  }
+
+ public:
+  Uring() = default;
+  Uring(const Uring&) = delete;
+  Uring& operator=(const Uring&) = delete;
+
+  ~Uring() {
+    if (sqes_ != MAP_FAILED) {
+      ::munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+      ::munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_ != MAP_FAILED) {
+      ::munmap(sq_ring_, sq_ring_size_);
+    }
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+  }
+
+  /* a ring of entries submission entries and cq_entries completion entries,
+   * false with error set if the kernel has no io_uring or refuses it
+   */
+  bool init(unsigned entries, unsigned cq_entries, std::string& error) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = cq_entries;
+    fd_ = int(::syscall(__NR_io_uring_setup, entries, &params));
+    if (fd_ < 0) {
+      return fail(error, "io_uring_setup", errno);
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(params.features & IORING_FEAT_NODROP)) {
+      error = "io_uring of this kernel is too old";
+      return false;
+    }
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    sq_ring_ = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) {
+      return fail(error, "mmap io_uring", errno);
+    }
+    cq_ring_ = sq_ring_;
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe*>(
+        ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+    if (sqes_ == MAP_FAILED) {
+      return fail(error, "mmap io_uring", errno);
+    }
+    sq_head_ = at<unsigned>(sq_ring_, params.sq_off.head);
+    sq_tail_ = at<unsigned>(sq_ring_, params.sq_off.tail);
+    sq_mask_ = *at<unsigned>(sq_ring_, params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    // entry i of the submission ring is always sqe i
+    unsigned* array = at<unsigned>(sq_ring_, params.sq_off.array);
+    for (unsigned i = 0; i < sq_entries_; ++i) {
+      array[i] = i;
+    }
+    cq_head_ = at<unsigned>(cq_ring_, params.cq_off.head);
+    cq_tail_ = at<unsigned>(cq_ring_, params.cq_off.tail);
+    cq_mask_ = *at<unsigned>(cq_ring_, params.cq_off.ring_mask);
+    cqes_ = at<io_uring_cqe>(cq_ring_, params.cq_off.cqes);
+    return true;
+  }
+
+  int fd() const { return fd_; }
+
+  /* a cleared submission entry to fill, submitted by the next submit();
+   * when the ring is full, the entries queued are submitted first. The
+   * kernel reads the ring in submit() only, so the entry is queued before it
+   * is filled.
+   */
+  io_uring_sqe* sqe() {
+    unsigned tail = *sq_tail_;
+    while (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+      submit(0);
+    }
+    io_uring_sqe* sqe = &sqes_[tail & sq_mask_];
+    std::memset(sqe, 0, sizeof(*sqe));
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    ++queued_;
+    return sqe;
+  }
+
+  /* submits the entries queued and waits until wait completions are ready,
+   * in one system call; -errno on error
+   */
+  int submit(unsigned wait) {
+    int res = int(::syscall(__NR_io_uring_enter, fd_, queued_, wait,
+                            wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+    if (res < 0) {
+      return -errno;
+    }
+    queued_ -= std::min<unsigned>(queued_, res);
+    return res;
+  }
+
+  // calls callback(cqe) for every ready completion, returns how many
+  template <typename CallbackTy>
+  unsigned drain(CallbackTy callback) {
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (unsigned i = head; i != tail; ++i) {
+      callback(cqes_[i & cq_mask_]);
+    }
+    __atomic_store_n(cq_head_, tail, __ATOMIC_RELEASE);
+    return tail - head;
+  }
+
+  int registerOp(unsigned opcode, void* arg, unsigned count) {
+    int res = int(::syscall(__NR_io_uring_register, fd_, opcode, arg, count));
+    return res < 0 ? -errno : res;
+  }
+};
+
+/* receive buffers registered with a ring (a provided buffer ring): the
+ * kernel picks a free one for each receive of the group and tells which in
+ * the completion, the buffer is recycled once its bytes are handled
+ */
+class UringBuffers {
+  io_uring_buf* ring_ = static_cast<io_uring_buf*>(MAP_FAILED);
+  size_t ring_size_ = 0;
+  char* data_ = static_cast<char*>(MAP_FAILED);
+  unsigned count_ = 0, size_ = 0;
+  uint16_t tail_ = 0;
+
+ public:
+  UringBuffers() = default;
+  UringBuffers(const UringBuffers&) = delete;
+  UringBuffers& operator=(const UringBuffers&) = delete;
+
+  // the ring unregisters the buffers when it is closed
+  ~UringBuffers() {
+    if (ring_ != MAP_FAILED) {
+      ::munmap(ring_, ring_size_);
+    }
+    if (data_ != MAP_FAILED) {
+      ::munmap(data_, size_t(count_) * size_);
+    }
+  }
+
+  /* count (a power of two) buffers of size bytes, registered with uring as
+   * buffer group group
+   */
+  bool init(Uring& uring, uint16_t group, unsigned count, unsigned size,
+            std::string& error) {
+    count_ = count;
+    size_ = size;
+    ring_size_ = count * sizeof(io_uring_buf);
+    ring_ = static_cast<io_uring_buf*>(::mmap(nullptr, ring_size_,
+                                              PROT_READ | PROT_WRITE,
+                                              MAP_PRIVATE | MAP_ANONYMOUS, -1,
+                                              0));
+    data_ = static_cast<char*>(::mmap(nullptr, size_t(count) * size,
+                                      PROT_READ | PROT_WRITE,
+                                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (ring_ == MAP_FAILED || data_ == MAP_FAILED) {
+      error = std::string("mmap: ") + std::strerror(errno);
+      return false;
+    }
+    io_uring_buf_reg reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uintptr_t>(ring_);
+    reg.ring_entries = count;
+    reg.bgid = group;
+    int res = uring.registerOp(IORING_REGISTER_PBUF_RING, &reg, 1);
+    if (res < 0) {
+      error = std::string("io_uring buffer ring: ") + std::strerror(-res);
+      return false;
+    }
+    for (unsigned bid = 0; bid < count; ++bid) {
+      recycle(bid);
+    }
+    publish();
+    return true;
+  }
+
+  unsigned size() const { return size_; }
+  const char* buffer(unsigned bid) const { return data_ + size_t(bid) * size_; }
+
+  // gives a buffer back, the kernel sees it after the next publish()
+  void recycle(unsigned bid) {
+    io_uring_buf& buf = ring_[tail_ & (count_ - 1)];
+    buf.addr = reinterpret_cast<uintptr_t>(buffer(bid));
+    buf.len = size_;
+    buf.bid = uint16_t(bid);
+    ++tail_;
+  }
+
+  void publish() {
+    // the tail of the ring overlays the reserved field of its first entry
+    __atomic_store_n(&ring_[0].resv, tail_, __ATOMIC_RELEASE);
+  }
+};
+
+}  // namespace ipq
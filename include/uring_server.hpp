@@ -0,0 +1,341 @@
+#pragma once
+
+#include "server.hpp"
+#include "uring.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string>
+#include <string_view>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace ipq {
+
+/* the Server with io_uring in place of epoll: same endpoints (Listeners),
+ * same handlers, same pipelining and closing rules, but a loop never calls
+ * accept, recv or send itself. Each loop keeps on its ring one multishot
+ * accept, which yields every new connection, and one multishot receive per
+ * connection, which yields every read into a buffer the kernel picks from a
+ * registered buffer ring. Requests are handled inline as their completions
+ * are drained, the responses of a connection go out with one send at a
+ * time, and everything queued while draining is submitted with the wait for
+ * the next completions in one io_uring_enter().
+ *
+ * A connection with MaxPendingOutput bytes not sent has its receive
+ * cancelled, and armed again once the output drains.
+ */
+class UringServer {
+ public:
+  using HandlerTy = Server::HandlerTy;
+  using HandlerFactoryTy = Server::HandlerFactoryTy;
+
+ private:
+  // what a completion is about, in the low bits of its user data
+  enum Op : uint64_t { Accept = 1, Recv, Send, Cancel, Stop };
+  static constexpr uint64_t OpMask = 7;
+
+  struct alignas(8) Connection {
+    explicit Connection(int fd) : fd(fd) {}
+    int fd;
+    // input not consumed, output not handed to the kernel, output being sent
+    std::string in, out, sending;
+    size_t sent = 0;
+    // operations on the ring referring to the connection
+    unsigned inflight = 0;
+    bool receiving = false, send_busy = false, cancelling = false;
+    bool closing = false, broken = false, shut = false;
+
+    size_t backlog() const { return out.size() + sending.size() - sent; }
+  };
+
+  struct Loop {
+    // destroyed after the ring: the kernel uses the buffers until it closes
+    UringBuffers buffers;
+    Uring ring;
+    int listener = -1;
+    std::thread thread;
+  };
+
+  static constexpr size_t MaxPendingOutput = 4 << 20;
+  static constexpr unsigned RingEntries = 1024;
+  static constexpr unsigned Buffers = 256;
+  static constexpr unsigned BufferSize = 16 << 10;
+  static constexpr uint16_t BufferGroup = 0;
+
+  Listeners listening_;
+  int stop_fd_ = -1;
+  std::vector<std::unique_ptr<Loop>> loops_;
+
+  static uint64_t tag(Connection* conn, Op op) {
+    return reinterpret_cast<uintptr_t>(conn) | op;
+  }
+
+  static void armAccept(Loop& loop) {
+    io_uring_sqe* sqe = loop.ring.sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = loop.listener;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = Accept;
+  }
+
+  static void armRecv(Loop& loop, Connection* conn) {
+    io_uring_sqe* sqe = loop.ring.sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BufferGroup;
+    sqe->user_data = tag(conn, Recv);
+    conn->receiving = true;
+    ++conn->inflight;
+  }
+
+  static void cancelRecv(Loop& loop, Connection* conn) {
+    io_uring_sqe* sqe = loop.ring.sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = tag(conn, Recv);
+    sqe->user_data = tag(conn, Cancel);
+    conn->cancelling = true;
+    ++conn->inflight;
+  }
+
+  // sends the rest of what is being sent, or else the output collected
+  static void send(Loop& loop, Connection* conn) {
+    if (conn->send_busy || conn->broken) {
+      return;
+    }
+    if (conn->sent == conn->sending.size()) {
+      conn->sending.clear();
+      conn->sent = 0;
+      conn->sending.swap(conn->out);
+    }
+    if (conn->sending.empty()) {
+      return;
+    }
+    io_uring_sqe* sqe = loop.ring.sqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->addr = reinterpret_cast<uintptr_t>(conn->sending.data() + conn->sent);
+    sqe->len = unsigned(std::min<size_t>(conn->sending.size() - conn->sent,
+                                         UINT32_MAX));
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = tag(conn, Send);
+    conn->send_busy = true;
+    ++conn->inflight;
+  }
+
+  /* moves a connection on after a completion: sends its output, pauses or
+   * resumes its receive, and closes it once it is done and nothing on the
+   * ring refers to it. A connection is shut down first, which ends its
+   * receive.
+   */
+  static void settle(Loop& loop, Connection* conn,
+                     std::unordered_set<Connection*>& connections) {
+    send(loop, conn);
+    if (!conn->closing) {
+      if (conn->backlog() >= MaxPendingOutput) {
+        if (conn->receiving && !conn->cancelling) {
+          cancelRecv(loop, conn);
+        }
+      } else if (!conn->receiving) {
+        armRecv(loop, conn);
+      }
+    } else if (!conn->shut && (conn->broken || !conn->backlog())) {
+      ::shutdown(conn->fd, SHUT_RDWR);
+      conn->shut = true;
+    }
+    if (conn->shut && !conn->inflight) {
+      ::close(conn->fd);
+      connections.erase(conn);
+      delete conn;
+    }
+  }
+
+  void run(Loop& loop, HandlerTy handler) {
+    std::unordered_set<Connection*> connections;
+    bool stopping = false;
+    armAccept(loop);
+    io_uring_sqe* sqe = loop.ring.sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = stop_fd_;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = Stop;
+
+    auto complete = [&](const io_uring_cqe& cqe) {
+      auto op = Op(cqe.user_data & OpMask);
+      auto* conn = reinterpret_cast<Connection*>(cqe.user_data & ~OpMask);
+      bool more = cqe.flags & IORING_CQE_F_MORE;
+      switch (op) {
+        case Stop:
+          stopping = true;
+          return;
+        case Accept:
+          if (cqe.res >= 0) {
+            if (stopping) {
+              ::close(cqe.res);
+            } else {
+              if (!listening_.isUnix()) {
+                int one = 1;
+                ::setsockopt(cqe.res, IPPROTO_TCP, TCP_NODELAY, &one,
+                             sizeof(one));
+              }
+              conn = new Connection(cqe.res);
+              connections.insert(conn);
+              armRecv(loop, conn);
+            }
+          }
+          if (!more && !stopping) {
+            armAccept(loop);
+          }
+          return;
+        case Recv:
+          if (!more) {
+            conn->receiving = false;
+            --conn->inflight;
+          }
+          if (cqe.res > 0) {
+            unsigned bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+            if (!conn->closing &&
+                !Server::feed(handler,
+                              std::string_view(loop.buffers.buffer(bid),
+                                               cqe.res),
+                              conn->in, conn->out)) {
+              conn->closing = true;
+            }
+            loop.buffers.recycle(bid);
+          } else if (cqe.res == 0) {
+            // the client is done sending
+            conn->closing = true;
+          } else if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+            conn->closing = conn->broken = true;
+          }
+          break;
+        case Send:
+          conn->send_busy = false;
+          --conn->inflight;
+          if (cqe.res < 0) {
+            conn->closing = conn->broken = true;
+          } else {
+            conn->sent += cqe.res;
+          }
+          break;
+        case Cancel:
+          conn->cancelling = false;
+          --conn->inflight;
+          break;
+      }
+      settle(loop, conn, connections);
+    };
+
+    while (!stopping) {
+      int res = loop.ring.submit(1);
+      if (res < 0 && res != -EINTR && res != -EBUSY) {
+        break;
+      }
+      loop.ring.drain(complete);
+      loop.buffers.publish();
+    }
+    // shut every connection down and wait until the ring is done with them
+    for (auto* conn : connections) {
+      conn->closing = conn->broken = true;
+    }
+    for (auto* conn : std::vector<Connection*>(connections.begin(),
+                                               connections.end())) {
+      settle(loop, conn, connections);
+    }
+    while (!connections.empty()) {
+      int res = loop.ring.submit(1);
+      if (res < 0 && res != -EINTR && res != -EBUSY) {
+        break;
+      }
+      loop.ring.drain(complete);
+      loop.buffers.publish();
+    }
+    for (auto* conn : connections) {
+      ::close(conn->fd);
+      delete conn;
+    }
+  }
+
+ public:
+  UringServer() = default;
+  UringServer(const UringServer&) = delete;
+  UringServer& operator=(const UringServer&) = delete;
+  ~UringServer() { stop(); }
+
+  /* starts threads event loops serving endpoint, false with error set if
+   * the endpoint can not be listened on, io_uring is not available or
+   * make_handler returns no handler
+   */
+  bool start(const std::string& endpoint, unsigned threads,
+             HandlerFactoryTy make_handler, std::string& error) {
+    threads = std::max(1u, threads);
+    if (!listening_.open(endpoint, threads, error)) {
+      return false;
+    }
+    std::vector<HandlerTy> handlers;
+    for (unsigned i = 0; i < threads; ++i) {
+      handlers.push_back(make_handler(i));
+      if (!handlers.back()) {
+        error = "no handler for event loop " + std::to_string(i);
+        stop();
+        return false;
+      }
+      loops_.emplace_back(new Loop());
+      Loop& loop = *loops_.back();
+      loop.listener = listening_.fd(i);
+      if (!loop.ring.init(RingEntries, RingEntries * 4, error) ||
+          !loop.buffers.init(loop.ring, BufferGroup, Buffers, BufferSize,
+                             error)) {
+        stop();
+        return false;
+      }
+    }
+    stop_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    for (unsigned i = 0; i < threads; ++i) {
+      loops_[i]->thread = std::thread(&UringServer::run, this,
+                                      std::ref(*loops_[i]),
+                                      std::move(handlers[i]));
+    }
+    return true;
+  }
+
+  // the TCP port listened on, useful with port 0
+  uint16_t port() const { return listening_.port(); }
+
+  // stops every loop and closes every connection
+  void stop() {
+    if (stop_fd_ >= 0) {
+      uint64_t one = 1;
+      ssize_t res = ::write(stop_fd_, &one, sizeof(one));
+      (void)res;
+    }
+    for (auto& loop : loops_) {
+      if (loop->thread.joinable()) {
+        loop->thread.join();
+      }
+    }
+    loops_.clear();
+    listening_.close();
+    if (stop_fd_ >= 0) {
+      ::close(stop_fd_);
+      stop_fd_ = -1;
+    }
+  }
+};
+
+}  // namespace ipq
@@ -1,171 +1,1343 @@
 #include "interval_tree.hpp"
 #include "location.hpp"
+#include "location_index.hpp"
+#include "country_filter.hpp"
+#include "joined_intervals.hpp"
+#include "csv_scanner.hpp"
+#include "enrich.hpp"
+#include "location_names.hpp"
+#include "ipqdb.hpp"
+#include "compressed_reader.hpp"
+#include "interval_diff.hpp"
+#include "storage_engines.hpp"
+#include "binary_protocol.hpp"
+#include "buffered_io.hpp"
+#include "ip.hpp"
+#include "line_protocol.hpp"
+#include "location_formatter.hpp"
+#include "range_cache.hpp"
+#include "server.hpp"
+#include "shared_db.hpp"
+#include "uring_server.hpp"
+
+using GeoListener = ipq::IntervalListeners<ipq::LocationIndex<uint32_t>,
+                                           ipq::CountryFilter<>>;
 
 #ifdef BTREE
 #include "btree_map.hpp"
+const char* tree_engine = "btree";
 using IntervalTree = ipq::IntervalTree<uint32_t, ipq::Location,
-                  ipq::BTreeMap<uint32_t, std::pair<uint32_t, ipq::Location>>>;
+                  ipq::BTreeMap<uint32_t, std::pair<uint32_t, ipq::Location>>,
+                  GeoListener>;
 #else
+const char* tree_engine = "stl";
 using IntervalTree = ipq::IntervalTree<uint32_t, ipq::Location,
-                  std::map<uint32_t, std::pair<uint32_t, ipq::Location>>>;
+                  std::map<uint32_t, std::pair<uint32_t, ipq::Location>>,
+                  GeoListener>;
 #endif
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
 #include <cstdint>
-#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include <limits>
 #include <map>
+#include <mutex>
+#include <optional>
 #include <set>
+#include <shared_mutex>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
 #include <vector>
 
-struct CsvLine {
-  uint32_t start_ip, end_ip;
-  std::string country_code, country, province, city;
+ipq::LocationNames names;
+ipq::LocationFormatter formatter(names);
+
+IntervalTree geo_ip;
+auto& location_index = geo_ip.listener.get<ipq::LocationIndex<uint32_t>>();
+auto& country_filter = geo_ip.listener.get<ipq::CountryFilter<>>();
+
+// a compiled database opened with mmap, serving the read-only commands until
+// the first command needing the tree thaws it into geo_ip
+ipq::FrozenDb frozen_db;
+bool frozen = false;
+
+/* --publish=NAME: the ranges loaded are published as a shared database for
+ * the workers of the box, again after every reload or publish command.
+ * --attach=NAME: frozen_db views the image published in place of a file;
+ * between two commands the newest generation is mapped in its place, until
+ * a command thaws it.
+ */
+ipq::SharedDbPublisher shared_publisher;
+std::optional<ipq::SharedDb> shared_db;
+
+/* the storage engine picked with --engine when it is not the one geo_ip is
+ * built on: it answers the point queries, and gets a copy of the ranges of
+ * geo_ip and every later update, geo_ip still serving the other commands
+ */
+std::unique_ptr<ipq::DataStorateConcept> engine;
+
+/* with --cache, the point queries go through a RangeCache of the blocks of
+ * cache_prefix bits, invalidated by update_ranges
+ */
+unsigned cache_prefix = 0;
+std::optional<ipq::RangeCacheEpochs> cache_epochs;
+std::optional<ipq::RangeCache> range_cache;
+
+// copies the ranges of geo_ip into the engine
+void fill_engine() {
+  if (!engine) {
+    return;
+  }
+  std::vector<ipq::IpRangeUpdate> ranges;
+  ranges.reserve(geo_ip.size());
+  for (auto& range : geo_ip.keys) {
+    ranges.push_back({range.first, range.second.first, range.second.second});
+  }
+  engine->batchUpdateBlocking(ranges);
+}
+
+void thaw() {
+  if (!frozen) {
+    return;
+  }
+  auto& ranges = frozen_db.ranges();
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    geo_ip.append(ranges.start(i), ranges.end(i),
+                  frozen_db.location(ranges.value(i)));
+  }
+  frozen = false;
+  fill_engine();
+}
+
+// every modification of the ranges goes through here, to reach the engine
+void update_ranges(ipq::ArrayRef<ipq::IpRangeUpdate> updates) {
+  thaw();
+  geo_ip.batch_update(updates);
+  if (engine) {
+    engine->batchUpdateBlocking(updates);
+  }
+  if (cache_epochs) {
+    for (auto& update : updates) {
+      cache_epochs->invalidate(update.start, update.end);
+    }
+  }
+}
+
+/* the Location of ip, Location() if there is none, with range set to the
+ * range found or the largest gap around ip (some engines give a smaller one)
+ */
+ipq::Location find_location_range(uint32_t ip, ipq::IpRange& range) {
+  if (frozen) {
+    const uint32_t* id =
+        frozen_db.ranges().findRange(ip, range.start, range.end);
+    return id ? frozen_db.location(*id) : ipq::Location();
+  }
+  if (engine) {
+    return engine->query(ip, range);
+  }
+  ipq::Location* found = geo_ip.find_range(ip, range.start, range.end);
+  return found ? *found : ipq::Location();
+}
+
+bool find_location(uint32_t ip, ipq::Location& loc) {
+  if (range_cache) {
+    ipq::IpRange range;
+    loc = range_cache->query(ip, range, find_location_range);
+    return !(loc == ipq::Location());
+  }
+  if (frozen) {
+    return frozen_db.find(ip, loc);
+  }
+  if (engine) {
+    loc = engine->query(ip);
+    return !(loc == ipq::Location());
+  }
+  ipq::Location* found = geo_ip.find(ip);
+  if (found) {
+    loc = *found;
+  }
+  return found;
+}
+
+template <typename CallbackTy>
+void for_each_overlapping(uint32_t ip1, uint32_t ip2, CallbackTy callback) {
+  if (frozen) {
+    frozen_db.ranges().for_each_overlapping(
+        ip1, ip2, [&](uint32_t start, uint32_t end, uint32_t location_id) {
+          callback(start, end, frozen_db.location(location_id));
+        });
+  } else {
+    geo_ip.for_each_overlapping(
+        ip1, ip2, [&](uint32_t start, uint32_t end, ipq::Location& loc) {
+          callback(start, end, loc);
+        });
+  }
+}
+
+std::string format_ip(uint32_t ip) {
+  std::string text;
+  ipq::appendIp(text, ip);
+  return text;
+}
+
+/* what one loader thread parsed from its chunk of the csv. Its names are
+ * interned in its own dictionary, so the codes of its ranges are local to the
+ * chunk until load_db3() maps them to the global dictionary.
+ */
+struct ChunkResult {
+  ipq::LocationNames names;
+  // start, end, local location
+  std::vector<std::tuple<uint32_t, uint32_t, ipq::Location>> ranges;
+  size_t lines = 0;
+  const char* error = nullptr;
 };
 
-struct CountryInfo {
-  std::string code;
-  std::string name;
-  std::map<std::pair<std::string, std::string>, int> cities;
-  std::vector<std::pair<std::string, std::string>> city_names;
-  CountryInfo(const std::string& code, const std::string& name)
-      : code(code), name(name), city_names(1) {}
-  CountryInfo() : CountryInfo("", "") {}
+void parse_chunk(const char* begin, const char* end, ChunkResult& result) {
+  ipq::CsvScanner scanner(begin, end);
+  ipq::Db3Parser parser;
+  ipq::Db3Line line;
+  while (parser.next(scanner, line)) {
+    result.ranges.emplace_back(
+        line.start_ip, line.end_ip,
+        result.names.location(line.country_code, line.country, line.province,
+                              line.city));
+  }
+  result.error = parser.error();
+  result.lines = scanner.line();
+}
+
+bool has_suffix(const std::string& str, const std::string& suffix) {
+  return str.size() > suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/* a block of decompressed csv passed from the decompression thread to the
+ * parsing thread
+ */
+struct CsvBlock {
+  std::vector<char> data;
+  size_t size = 0;
 };
 
-int country_number;
-std::map<std::string, int> country_code;
-std::vector<std::string> count_name(1);
-std::vector<CountryInfo> country_infos(1);
-
-const int BUF_SIZE = 100;
-char code_buf[BUF_SIZE], country_buf[BUF_SIZE], province_buf[BUF_SIZE],
-    city_buf[BUF_SIZE];
-// ipq::SegmentTree<ipq::Location> geo_ip(std::numeric_limits<uint32_t>::min(),
-// std::numeric_limits<uint32_t>::max());
-ipq::IntervalTree<uint32_t, ipq::Location,
-                  std::map<uint32_t, std::pair<uint32_t, ipq::Location>>>
-    geo_ip;
-
-uint32_t parse_ip(const std::string& ip) {
-  size_t p = 0;
-  uint32_t ret = 0;
-  for (int i = 0; i < 4; ++i) {
-    size_t np = ip.find('.', p);
-    uint32_t v = 0;
-    for (; p < np; ++p) {
-      v = v * 10 + (ip[p] - '0');
-    }
-    ret = (ret << 8) | v;
-    p = np;
-  }
-  return ret;
-}
-
-int main(int, const char** argv) {
-  std::ifstream csv_file((argv[1]));
+/* loads a gzip or zstd compressed DB3 csv as a stream. One thread
+ * decompresses into a few recycled blocks, the calling thread parses them
+ * and passes the ranges to sink(start, end, location), with locations
+ * interned in dict. At most a few blocks of the uncompressed file are in
+ * memory at any time. A line cut by the end of a block is carried over to
+ * the next one. Returns the number of ranges read, or -1 on error, printed
+ * to errors.
+ */
+template <typename SinkTy>
+int load_db3_stream(const char* path, ipq::LocationNames& dict, SinkTy sink,
+                    std::ostream& errors = std::cout) {
+  ipq::CompressedReader reader;
+  if (!reader.open(path)) {
+    errors << reader.error() << std::endl;
+    return -1;
+  }
+  const size_t block_size = 1 << 20, blocks = 4;
+  ipq::BoundedQueue<CsvBlock> free_blocks(blocks), full_blocks(blocks);
+  for (size_t i = 0; i < blocks; ++i) {
+    CsvBlock block;
+    block.data.resize(block_size);
+    free_blocks.push(std::move(block));
+  }
+  bool read_error = false;
+  std::thread decompressor([&]() {
+    CsvBlock block;
+    while (free_blocks.pop(block)) {
+      long size = reader.read(block.data.data(), block_size);
+      if (size < 0) {
+        read_error = true;
+        break;
+      }
+      block.size = size;
+      if (!size || !full_blocks.push(std::move(block))) {
+        break;
+      }
+    }
+    full_blocks.close();
+  });
+
+  ipq::Db3Parser parser;
+  size_t lines_before = 0;
+  int ranges = 0;
+  bool parse_error = false;
+  auto parse = [&](const char* begin, const char* end) {
+    if (parse_error) {
+      return;
+    }
+    ipq::CsvScanner scanner(begin, end);
+    ipq::Db3Line line;
+    while (parser.next(scanner, line)) {
+      sink(line.start_ip, line.end_ip,
+           dict.location(line.country_code, line.country, line.province,
+                          line.city));
+      ++ranges;
+    }
+    if (parser.error()) {
+      errors << path << ':' << lines_before + scanner.line() << ": "
+             << parser.error() << std::endl;
+      parse_error = true;
+    }
+    lines_before += scanner.line();
+  };
+  std::string carry;
+  CsvBlock block;
+  while (!parse_error && full_blocks.pop(block)) {
+    const char* p = block.data.data();
+    const char* end = p + block.size;
+    if (!carry.empty()) {
+      const char* newline = ipq::internal::findByte(p, end, '\n');
+      if (newline != end) {
+        carry.append(p, newline + 1);
+        parse(carry.data(), carry.data() + carry.size());
+        carry.clear();
+        p = newline + 1;
+      }
+    }
+    auto last_newline = static_cast<const char*>(memrchr(p, '\n', end - p));
+    if (last_newline) {
+      parse(p, last_newline + 1);
+      p = last_newline + 1;
+    }
+    carry.append(p, end);
+    free_blocks.push(std::move(block));
+  }
+  // when parsing did not fail, the queue was closed by the decompressor, so
+  // read_error is set already; a stream cut short is a read error, not a
+  // malformed last line
+  if (!parse_error && !read_error && !carry.empty()) {
+    parse(carry.data(), carry.data() + carry.size());
+  }
+  // stops the decompressor if parsing failed
+  free_blocks.close();
+  decompressor.join();
+  if (read_error) {
+    errors << path << ": " << reader.error() << std::endl;
+    return -1;
+  }
+  return parse_error ? -1 : ranges;
+}
+
+/* loads the DB3 csv at path with threads loader threads, which parse
+ * line-aligned chunks of the file, each into its own dictionaries. The
+ * calling thread merges the chunks in file order as soon as they are parsed
+ * and passes the ranges to sink(start, end, location) sorted, with locations
+ * interned in dict. There is one chunk per thread, or chunks of about
+ * chunk_bytes if that gives more, for the first ranges to come out early.
+ * Returns the number of ranges read, or -1 on error, printed to errors; the
+ * ranges before the error may have been passed to sink already.
+ */
+template <typename SinkTy>
+int load_db3(const char* path, unsigned threads, size_t chunk_bytes,
+             ipq::LocationNames& dict, SinkTy sink,
+             std::ostream& errors = std::cout) {
+  if (has_suffix(path, ".gz") || has_suffix(path, ".zst")) {
+    return load_db3_stream(path, dict, sink, errors);
+  }
+  ipq::MappedFile csv_file(path);
   if (!csv_file) {
-    std::cout << "wrong input csv file: " << argv[1] << std::endl;
-    return 1;
+    errors << "wrong input csv file: " << path << std::endl;
+    return -1;
+  }
+  auto chunks = ipq::splitLines(
+      csv_file.begin(), csv_file.end(),
+      std::max<size_t>(threads, chunk_bytes ? csv_file.size() / chunk_bytes : 0));
+  std::vector<ChunkResult> results(chunks.size() - 1);
+  std::vector<char> parsed(results.size(), false);
+  std::mutex parsed_mutex;
+  std::condition_variable parsed_cv;
+  std::atomic<size_t> next_chunk{0};
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < std::min<size_t>(threads, results.size()); ++t) {
+    workers.emplace_back([&]() {
+      for (size_t i; !stop && (i = next_chunk++) < results.size();) {
+        parse_chunk(chunks[i], chunks[i + 1], results[i]);
+        std::lock_guard<std::mutex> lock(parsed_mutex);
+        parsed[i] = true;
+        parsed_cv.notify_all();
+      }
+    });
   }
-  auto get_country_code = [&](const std::string& code,
-                              const std::string& country) -> int {
-    auto& ret = country_code[code];
-    if (!ret) {
-      ret = country_code.size();
-      count_name.emplace_back(code);
-      country_infos.emplace_back(code, country);
+  auto finish = [&](int ret) {
+    stop = true;
+    for (auto& worker : workers) {
+      worker.join();
     }
     return ret;
   };
-  auto get_city_code = [&](int code, const std::string& province,
-                           const std::string& city) {
-    auto& info = country_infos[code];
-    auto key = std::make_pair(province, city);
-    auto& ret = info.cities[key];
-    if (!ret) {
-      ret = info.cities.size();
-      info.city_names.emplace_back(province, city);
+  // each chunk checked its own ranges, check the chunk boundaries here
+  size_t lines_before = 0, ranges = 0;
+  uint32_t last_end = 0;
+  for (size_t i = 0; i < results.size(); ++i) {
+    {
+      std::unique_lock<std::mutex> lock(parsed_mutex);
+      parsed_cv.wait(lock, [&]() { return parsed[i]; });
     }
-    return ret;
+    auto& result = results[i];
+    const char* error = result.error;
+    size_t error_line = result.lines;
+    if (!error && ranges && !result.ranges.empty() &&
+        std::get<0>(result.ranges.front()) <= last_end) {
+      error = "range is not after the previous range";
+      error_line = 1;
+    }
+    if (error) {
+      errors << path << ':' << lines_before + error_line << ": " << error
+             << std::endl;
+      return finish(-1);
+    }
+    lines_before += result.lines;
+    ranges += result.ranges.size();
+    if (!result.ranges.empty()) {
+      last_end = std::get<1>(result.ranges.back());
+    }
+    std::vector<uint32_t> country_map, city_map;
+    for (uint32_t country = 0; country < result.names.countries(); ++country) {
+      country_map.push_back(dict.country(result.names.countryCode(country),
+                                         result.names.countryName(country)));
+    }
+    for (uint32_t city = 0; city < result.names.cities(); ++city) {
+      city_map.push_back(dict.city(result.names.province(city),
+                                   result.names.cityName(city)));
+    }
+    for (auto& range : result.ranges) {
+      auto& loc = std::get<2>(range);
+      sink(std::get<0>(range), std::get<1>(range),
+           ipq::Location(country_map[loc.getProvinceCode()],
+                         city_map[loc.getCountryCode()]));
+    }
+    result = ChunkResult();
+  }
+  return finish(ranges);
+}
+
+// loads the csv at path into geo_ip, built in one pass from the sorted ranges
+int load_tree(const char* path, unsigned threads) {
+  return load_db3(path, threads, 0, names,
+                  [](uint32_t start, uint32_t end, const ipq::Location& loc) {
+                    geo_ip.append(start, end, loc);
+                  });
+}
+
+/* reload command: reads a new version of the csv and applies to geo_ip only
+ * the difference to its current content, found by walking the new ranges
+ * and the tree side by side. The listeners see only the ranges that change.
+ * false if the csv can not be read.
+ */
+bool reload(const char* path, unsigned threads, ipq::OutputBuffer& out) {
+  using Range = std::pair<uint32_t, std::pair<uint32_t, ipq::Location>>;
+  std::vector<Range> ranges;
+  int ranges_read = load_db3(
+      path, threads, 0, names,
+      [&](uint32_t start, uint32_t end, const ipq::Location& loc) {
+        ranges.emplace_back(start, std::make_pair(end, loc));
+      });
+  if (ranges_read < 0) {
+    out << "reload failed, data base unchanged\n";
+    return false;
+  }
+  thaw();
+  // the tree can not be modified while it is walked, the edit is applied
+  // afterwards as one batch
+  std::vector<ipq::IpRangeUpdate> edit;
+  auto stats = ipq::IntervalDiff<uint32_t, ipq::Location>::diff(
+      geo_ip.keys.begin(), geo_ip.keys.end(), ranges.begin(), ranges.end(),
+      [&](uint32_t start, uint32_t end, const ipq::Location& loc, bool) {
+        edit.push_back({start, end, loc});
+      },
+      [&](uint32_t start, uint32_t end) {
+        edit.push_back({start, end, std::nullopt});
+      });
+  update_ranges(edit);
+  out << "ip location informations read: " << ranges_read
+      << ", ranges added: " << stats.added << " changed: " << stats.changed
+      << " removed: " << stats.removed << '\n';
+  return true;
+}
+
+/* publishes the current ranges as the next generation of the shared
+ * database, the mapped image as it is while still frozen
+ */
+bool publish_shared(std::string& error) {
+  if (frozen) {
+    return shared_publisher.publish(frozen_db.image(), error);
+  }
+  ipq::IpqdbWriter writer;
+  for (auto& range : geo_ip.keys) {
+    writer.add(range.first, range.second.first, range.second.second);
+  }
+  std::vector<char> image = writer.image(names);
+  return shared_publisher.publish(std::string_view(image.data(), image.size()),
+                                  error);
+}
+
+// publish command: the current ranges as the next generation
+void publish_command(ipq::OutputBuffer& out) {
+  std::string error;
+  if (!shared_publisher.generation()) {
+    out << "no shared database, restart with --publish\n";
+  } else if (!publish_shared(error)) {
+    out << "publish failed: " << error << '\n';
+  } else {
+    out << "generation published: " << shared_publisher.generation() << '\n';
+  }
+}
+
+/* serves the image mapped by shared_db, with its names: the ids of another
+ * generation may be another's
+ */
+bool attach_shared(std::string& error) {
+  std::string_view image = shared_db->image();
+  if (!frozen_db.attach(image.data(), image.size(), error, false)) {
+    return false;
+  }
+  names = ipq::LocationNames();
+  formatter = ipq::LocationFormatter(names);
+  frozen_db.loadNames(names);
+  frozen = true;
+  if (cache_epochs) {
+    cache_epochs->invalidate(0, std::numeric_limits<uint32_t>::max());
+  }
+  return true;
+}
+
+/* progressive startup (--progressive): the csv is loaded into geo_ip by a
+ * background thread, in ip order, while commands are read. Every ip below
+ * loaded_until is final, a query for it is answered from the tree under a
+ * shared lock. A query above it is answered by the previous compiled
+ * snapshot (--snapshot=file.ipqdb) if there is one, otherwise it waits until
+ * the loader gets there. Other commands wait for the end of the load.
+ */
+namespace progressive {
+
+std::shared_mutex tree_mutex;
+std::mutex progress_mutex;
+std::condition_variable progress;
+std::atomic<bool> loading{false};
+// set when the csv can not be loaded, with the error under progress_mutex
+std::atomic<bool> failed{false};
+std::string load_error;
+bool failure_reported = false;
+// 64 bits, 2^32 once everything is loaded
+std::atomic<uint64_t> loaded_until{0};
+std::thread loader;
+
+ipq::FrozenDb snapshot;
+ipq::LocationNames snapshot_names;
+ipq::LocationFormatter snapshot_formatter(snapshot_names);
+bool has_snapshot = false;
+
+void set_progress(uint64_t until, bool done) {
+  {
+    std::lock_guard<std::mutex> lock(progress_mutex);
+    loaded_until = until;
+    if (done) {
+      loading = false;
+    }
+  }
+  progress.notify_all();
+}
+
+/* the loader interns names in its own dictionary, the ranges are moved to
+ * geo_ip and their names to the global dictionary in batches, under the
+ * tree lock, so that readers see both consistent
+ */
+void load(std::string path, unsigned threads) {
+  ipq::LocationNames loader_names;
+  std::vector<uint32_t> country_ids, city_ids;
+  std::vector<std::tuple<uint32_t, uint32_t, ipq::Location>> batch;
+  const size_t batch_size = 4096;
+  auto publish = [&]() {
+    if (batch.empty()) {
+      return;
+    }
+    {
+      std::unique_lock<std::shared_mutex> lock(tree_mutex);
+      for (auto& range : batch) {
+        auto& loc = std::get<2>(range);
+        uint32_t country = loc.getProvinceCode(), city = loc.getCountryCode();
+        // loader ids are dense and first seen in order
+        for (uint32_t c = country_ids.size(); c <= country; ++c) {
+          country_ids.push_back(names.country(loader_names.countryCode(c),
+                                              loader_names.countryName(c)));
+        }
+        for (uint32_t c = city_ids.size(); c <= city; ++c) {
+          city_ids.push_back(names.city(loader_names.province(c),
+                                        loader_names.cityName(c)));
+        }
+        geo_ip.append(std::get<0>(range), std::get<1>(range),
+                      ipq::Location(country_ids[country], city_ids[city]));
+      }
+    }
+    set_progress(uint64_t(std::get<1>(batch.back())) + 1, false);
+    batch.clear();
   };
-  int lines_read = 0;
-  while (true) {
-    uint32_t start_ip, end_ip;
-    std::string code, country, province, city;
-    csv_file.get();
-    if (csv_file.eof()) {
-      break;
+  const size_t chunk_bytes = 8 << 20;
+  std::ostringstream errors;
+  int ranges = load_db3(
+      path.c_str(), threads, chunk_bytes, loader_names,
+      [&](uint32_t start, uint32_t end, const ipq::Location& loc) {
+        batch.emplace_back(start, end, loc);
+        if (batch.size() == batch_size) {
+          publish();
+        }
+      },
+      errors);
+  if (ranges < 0) {
+    // reported by the main thread; loaded_until stays where it is
+    {
+      std::lock_guard<std::mutex> lock(progress_mutex);
+      load_error = errors.str();
+      failed = true;
+    }
+    set_progress(loaded_until, true);
+    return;
+  }
+  publish();
+  set_progress(uint64_t(1) << 32, true);
+  std::cerr << "ip location informations read: " << ranges << std::endl;
+}
+
+void start(const char* path, unsigned threads) {
+  loading = true;
+  loader = std::thread(load, std::string(path), threads);
+}
+
+void wait() {
+  if (!loading) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(progress_mutex);
+  progress.wait(lock, []() { return !loading; });
+}
+
+void stop() {
+  if (loader.joinable()) {
+    loader.join();
+  }
+}
+
+/* once the load failed: prints the error to out the first time, and returns
+ * whether commands can still be served, which only the queries can, from
+ * the ranges loaded and from the snapshot beyond them
+ */
+bool report_failure(ipq::OutputBuffer& out) {
+  if (!failure_reported) {
+    std::lock_guard<std::mutex> lock(progress_mutex);
+    out << load_error;
+    if (has_snapshot) {
+      out << "load failed, queries beyond the ranges loaded are answered "
+             "from the snapshot\n";
+    }
+    failure_reported = true;
+  }
+  return has_snapshot;
+}
+
+/* answers a query for ip while loading or after a failed load, returns
+ * false if loading is over and the query should be answered as usual. A
+ * query left waiting by a failed load is not answered.
+ */
+bool query(uint32_t ip, ipq::OutputBuffer& out) {
+  if (!loading && !failed) {
+    return false;
+  }
+  if (ip >= loaded_until) {
+    if (has_snapshot) {
+      ipq::Location loc;
+      if (snapshot.find(ip, loc)) {
+        snapshot_formatter.print(out, loc);
+      } else {
+        out << "not found\n";
+      }
+      return true;
+    }
+    // the answers so far are sent before waiting for the loader
+    out.flush();
+    std::unique_lock<std::mutex> lock(progress_mutex);
+    progress.wait(lock, [&]() { return ip < loaded_until || !loading; });
+    if (ip >= loaded_until) {
+      return true;
+    }
+  }
+  std::shared_lock<std::shared_mutex> lock(tree_mutex);
+  ipq::Location* loc = geo_ip.find(ip);
+  if (loc) {
+    formatter.print(out, *loc);
+  } else {
+    out << "not found\n";
+  }
+  return true;
+}
+
+}  // namespace progressive
+
+/* compile mode: loads the csv and writes it as a compiled database, to be
+ * opened later without parsing
+ */
+int compile_main(const char* csv_path, const char* db_path, unsigned threads) {
+  int lines_read = load_tree(csv_path, threads);
+  if (lines_read < 0) {
+    return 1;
+  }
+  ipq::IpqdbWriter writer;
+  for (auto& range : geo_ip.keys) {
+    writer.add(range.first, range.second.first, range.second.second);
+  }
+  std::string error;
+  if (!writer.write(db_path, names, error)) {
+    std::cout << error << std::endl;
+    return 1;
+  }
+  std::cout << "ip ranges compiled: " << writer.ranges() << std::endl;
+  return 0;
+}
+
+/* --join mode: several range csv files of any layout (first two fields are
+ * the range) are merged into one partition, one query returns the remaining
+ * fields of every file
+ */
+int join_main(int files, const char** paths) {
+  ipq::JoinedIntervals<uint32_t,
+                       std::map<uint32_t, std::pair<uint32_t, uint32_t>>>
+      joined(files);
+  std::vector<std::map<std::string, uint32_t>> payload_ids(files);
+  std::vector<std::vector<std::string>> payloads(files);
+  const size_t max_fields = 32;
+  std::string_view fields[max_fields];
+  for (int d = 0; d < files; ++d) {
+    ipq::MappedFile csv_file(paths[d]);
+    if (!csv_file) {
+      std::cout << "wrong input csv file: " << paths[d] << std::endl;
+      return 1;
+    }
+    ipq::CsvScanner scanner(csv_file.begin(), csv_file.end());
+    int lines_read = 0;
+    size_t field_count;
+    std::string payload;
+    while (scanner.next(fields, max_fields, field_count)) {
+      uint32_t start_ip, end_ip;
+      if (field_count < 2 || !ipq::parseUint32(fields[0], start_ip) ||
+          !ipq::parseUint32(fields[1], end_ip) || start_ip > end_ip) {
+        std::cout << paths[d] << ':' << scanner.line() << ": invalid ip range"
+                  << std::endl;
+        return 1;
+      }
+      ++lines_read;
+      payload.clear();
+      for (size_t i = 2; i < std::min(field_count, max_fields); ++i) {
+        if (i > 2) {
+          payload += ' ';
+        }
+        payload += fields[i];
+      }
+      auto res = payload_ids[d].emplace(payload, payloads[d].size());
+      if (res.second) {
+        payloads[d].push_back(payload);
+      }
+      joined.add(d, start_ip, end_ip, res.first->second);
+    }
+    if (scanner.error()) {
+      std::cout << paths[d] << ':' << scanner.line() << ": malformed csv line"
+                << std::endl;
+      return 1;
+    }
+    std::cout << "ip ranges read from " << paths[d] << ": " << lines_read
+              << std::endl;
+  }
+  joined.build();
+  std::cout << "joined segments: " << joined.size() << std::endl;
+  std::string command, ip;
+  while (std::cin >> command) {
+    if (command != "query") {
+      std::cout << "unknown command" << std::endl;
+      continue;
     }
-    ++lines_read;
-    csv_file >> start_ip;
-    csv_file.get();
-    csv_file.get();
-    csv_file.get();
-    csv_file >> end_ip;
-    csv_file.get();
-    csv_file.get();
-    csv_file.get();
-    getline(csv_file, code, '"');
-    csv_file.get();
-    csv_file.get();
-    getline(csv_file, country, '"');
-    csv_file.get();
-    csv_file.get();
-    getline(csv_file, province, '"');
-    csv_file.get();
-    csv_file.get();
-    getline(csv_file, city, '"');
-    csv_file.get();
-    csv_file.get();
-    int country_code = get_country_code(code, country);
-    int city_code = get_city_code(country_code, province, city);
-    ipq::Location loc(country_code, city_code);
-    geo_ip.update(start_ip, end_ip, loc);
-  }
-  std::cout << "ip location informations read: " << lines_read << std::endl;
-  auto get_ip = [&]() -> uint32_t {
-    std::string ip;
     std::cin >> ip;
-    if (ip.find('.') != ip.npos) {
-      return parse_ip(ip);
+    ipq::Ip key;
+    if (!ipq::parseIp(ip, key)) {
+      std::cout << "invalid ip: " << ip << std::endl;
+      continue;
+    }
+    const uint32_t* row = joined.find(key);
+    if (!row) {
+      std::cout << "not found" << std::endl;
+      continue;
+    }
+    for (int d = 0; d < files; ++d) {
+      std::cout << paths[d] << ": "
+                << (row[d] == joined.NoPayload ? "not found"
+                                               : payloads[d][row[d]])
+                << '\n';
+    }
+    std::cout << std::flush;
+  }
+  return 0;
+}
+
+/* --serve mode: the ranges loaded are copied into a new engine_name engine,
+ * rcu unless --engine picks another, and served over endpoint by threads
+ * event loops, on epoll or with --uring on io_uring, until SIGINT or
+ * SIGTERM. The loops query rcu without locks, an engine without readers
+ * one at a time. The protocol is the line protocol, or with --binary the
+ * binary one. With --cache every loop of the line protocol
+ * has its own range cache, their hit rate is printed when the server stops.
+ */
+template <typename OutTy>
+void print_cache_stats(OutTy& out, const ipq::RangeCacheStats& stats) {
+  out << "cache hits: " << stats.hits << " (negative: " << stats.negative_hits
+      << "), misses: " << stats.misses
+      << ", hit rate: " << unsigned(stats.hitRate() * 100 + 0.5) << "%\n";
+}
+
+template <typename ServerTy>
+int serve_main(const std::string& endpoint, const std::string& engine_name,
+               unsigned threads, bool binary) {
+  // the server threads inherit the mask, the signals are left to sigwait()
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  ipq::ServingState state(names,
+                          ipq::StorageEngines::instance().create(engine_name));
+  state.cache_prefix = cache_prefix;
+  std::vector<ipq::IpRangeUpdate> ranges;
+  if (frozen) {
+    auto& frozen_ranges = frozen_db.ranges();
+    ranges.reserve(frozen_ranges.size());
+    for (size_t i = 0; i < frozen_ranges.size(); ++i) {
+      ranges.push_back({frozen_ranges.start(i), frozen_ranges.end(i),
+                        frozen_db.location(frozen_ranges.value(i))});
+    }
+  } else {
+    ranges.reserve(geo_ip.size());
+    for (auto& range : geo_ip.keys) {
+      ranges.push_back({range.first, range.second.first, range.second.second});
+    }
+  }
+  state.engine->batchUpdateBlocking(ranges);
+  ranges = {};
+
+  ServerTy server;
+  std::string error;
+  auto protocol =
+      binary ? ipq::binaryProtocol(state) : ipq::lineProtocol(state);
+  if (!server.start(endpoint, threads, protocol, error)) {
+    std::cout << error << std::endl;
+    return 1;
+  }
+  std::cout << "listening on " << endpoint;
+  if (server.port()) {
+    std::cout << " port " << server.port();
+  }
+  std::cout << " with " << threads << " threads" << std::endl;
+  int signal = 0;
+  sigwait(&signals, &signal);
+  server.stop();
+  std::cout << "stopped by signal " << signal << std::endl;
+  if (cache_prefix && !binary) {
+    print_cache_stats(std::cout, state.cache_stats);
+  }
+  return 0;
+}
+
+/* enrich mode: every address of the file at in_path is looked up and
+ * written with its location to the tsv at out_path, by an Enricher running
+ * on threads threads. The lookups go to a FrozenIntervalMap, the mapped one
+ * of an ipqdb file or one built from geo_ip, as it is read-only and can be
+ * shared by the threads.
+ */
+int enrich_main(const char* in_path, const char* out_path, unsigned threads) {
+  ipq::Enricher enricher(names, threads);
+  ipq::EnrichStats stats;
+  std::string error;
+  bool ok;
+  if (frozen) {
+    auto& ranges = frozen_db.ranges();
+    ok = enricher.run(
+        in_path, out_path,
+        [&](ipq::ArrayRef<ipq::Ip> ips, ipq::Location* out) {
+          for (ipq::Ip ip : ips) {
+            size_t idx = ranges.findIndex(ip);
+            *out++ = idx == ranges.size()
+                         ? ipq::Location()
+                         : frozen_db.location(ranges.value(idx));
+          }
+        },
+        stats, error);
+  } else {
+    // the values of the map index the locations of the ranges
+    std::vector<ipq::Location> locations;
+    locations.reserve(geo_ip.size());
+    ipq::FrozenIntervalMap ranges;
+    ranges.build(geo_ip.size(), [&](auto emit) {
+      for (auto& range : geo_ip.keys) {
+        emit(range.first, range.second.first, uint32_t(locations.size()));
+        locations.push_back(range.second.second);
+      }
+    });
+    ok = enricher.run(
+        in_path, out_path,
+        [&](ipq::ArrayRef<ipq::Ip> ips, ipq::Location* out) {
+          for (ipq::Ip ip : ips) {
+            const uint32_t* idx = ranges.find(ip);
+            *out++ = idx ? locations[*idx] : ipq::Location();
+          }
+        },
+        stats, error);
+  }
+  if (!ok) {
+    std::cout << error << std::endl;
+    return 1;
+  }
+  std::cout << "lines enriched: " << stats.lines << ", found: " << stats.found
+            << ", invalid: " << stats.invalid << std::endl;
+  return 0;
+}
+
+int main(int argc, const char** argv) {
+  if (argc > 2 && std::string(argv[1]) == "--join") {
+    return join_main(argc - 2, argv + 2);
+  }
+  const char* csv_path = nullptr;
+  std::vector<const char*> positional;
+  bool progressive_load = false;
+  const char* snapshot_path = nullptr;
+  std::string engine_name = tree_engine;
+  std::string serve_endpoint;
+  // the engine of the servers, which make their own from the ranges loaded
+  std::string serve_engine = "rcu";
+  bool uring = false, binary = false;
+  const char* enrich_in = nullptr;
+  const char* enrich_out = nullptr;
+  std::string publish_name, attach_name;
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg.compare(0, 10, "--threads=") == 0) {
+      threads = std::max(1, std::atoi(arg.c_str() + 10));
+    } else if (arg == "--location-index") {
+      location_index.enable();
+    } else if (arg == "--country-filter") {
+      country_filter.enable();
+    } else if (arg == "--progressive") {
+      progressive_load = true;
+    } else if (arg.compare(0, 9, "--engine=") == 0) {
+      engine_name = arg.substr(9);
+      serve_engine = engine_name;
+    } else if (arg == "--uring") {
+      uring = true;
+    } else if (arg == "--binary") {
+      binary = true;
+    } else if (arg == "--cache") {
+      cache_prefix = 24;
+    } else if (arg.compare(0, 8, "--cache=") == 0) {
+      cache_prefix = std::clamp(std::atoi(arg.c_str() + 8), 16, 32);
+    } else if (arg.compare(0, 10, "--publish=") == 0) {
+      publish_name = arg.substr(10);
+    } else if (arg.compare(0, 9, "--attach=") == 0) {
+      attach_name = arg.substr(9);
+    } else if (arg.compare(0, 8, "--serve=") == 0) {
+      serve_endpoint = arg.substr(8);
+    } else if ((arg == "--in" || arg == "--out") && i + 1 < argc) {
+      (arg == "--in" ? enrich_in : enrich_out) = argv[++i];
+    } else if (arg.compare(0, 11, "--snapshot=") == 0) {
+      progressive_load = true;
+      snapshot_path = argv[i] + 11;
     } else {
-      return std::stoll(ip);
+      positional.push_back(argv[i]);
     }
+  }
+  if (positional.size() == 3 && std::string(positional[0]) == "compile") {
+    return compile_main(positional[1], positional[2], threads);
+  }
+  bool enrich = positional.size() == 2 &&
+                std::string(positional[0]) == "enrich" && enrich_in &&
+                enrich_out;
+  if (!attach_name.empty()) {
+    // the database is the one published, in place of a file
+    csv_path = positional.empty() || enrich ? attach_name.c_str() : nullptr;
+  } else if (positional.size() == 1 || enrich) {
+    csv_path = positional.back();
+  }
+  if (!serve_endpoint.empty()) {
+    if (!ipq::StorageEngines::instance().find(serve_engine)) {
+      std::cout << "unknown engine: " << serve_engine << std::endl;
+      csv_path = nullptr;
+    }
+  } else if (engine_name != tree_engine) {
+    engine = ipq::StorageEngines::instance().create(engine_name);
+    if (!engine) {
+      std::cout << "unknown engine: " << engine_name << std::endl;
+      csv_path = nullptr;
+    } else if (progressive_load) {
+      std::cout << "--engine=" << engine_name
+                << " can not be used with --progressive" << std::endl;
+      return 1;
+    }
+  }
+  if ((!publish_name.empty() || !attach_name.empty()) &&
+      (progressive_load || (!publish_name.empty() && !attach_name.empty()))) {
+    std::cout << "--publish and --attach can not be used together or with "
+                 "--progressive"
+              << std::endl;
+    return 1;
+  }
+  if (enrich && engine) {
+    std::cout << "enrich can not be used with --engine" << std::endl;
+    return 1;
+  }
+  if ((!serve_endpoint.empty() || enrich) && progressive_load) {
+    std::cout << (enrich ? "enrich" : "--serve")
+              << " can not be used with --progressive" << std::endl;
+    return 1;
+  }
+  if (!csv_path) {
+    std::string engines;
+    for (auto& e : ipq::StorageEngines::instance().engines()) {
+      engines += (engines.empty() ? "" : "|") + e.name;
+    }
+    std::cout << "usage: " << argv[0] << " [--threads=N] [--engine=" << engines << "] [--location-index] [--country-filter] [--cache[=PREFIX]] csv_or_ipqdb_file\n"
+              << "       " << argv[0] << " [options] --progressive [--snapshot=ipqdb_file] csv_file\n"
+              << "       " << argv[0] << " [--threads=N] [--engine=" << engines << "] [--uring] [--binary] [--cache[=PREFIX]] --serve=tcp:host:port|unix:path csv_or_ipqdb_file\n"
+              << "       " << argv[0] << " [--threads=N] enrich --in ips_file --out tsv_file csv_or_ipqdb_file\n"
+              << "       " << argv[0] << " [options] --publish=NAME csv_or_ipqdb_file\n"
+              << "       " << argv[0] << " [options] --attach=NAME\n"
+              << "       " << argv[0] << " [--threads=N] compile csv_file ipqdb_file\n"
+              << "       " << argv[0] << " --join csv_file..."
+              << std::endl;
+    return 1;
+  }
+  if (!attach_name.empty()) {
+    std::string error;
+    shared_db.emplace();
+    if (!shared_db->attach(attach_name, error) || !attach_shared(error)) {
+      std::cout << attach_name << ": " << error << std::endl;
+      return 1;
+    }
+    std::cout << "ip location informations attached: "
+              << frozen_db.ranges().size() << ", generation "
+              << shared_db->generation() << std::endl;
+    if (location_index.enabled() || country_filter.enabled() || engine) {
+      thaw();
+    }
+  } else if (has_suffix(csv_path, ".ipqdb")) {
+    std::string error;
+    if (!frozen_db.open(csv_path, error)) {
+      std::cout << csv_path << ": " << error << std::endl;
+      return 1;
+    }
+    frozen_db.loadNames(names);
+    frozen = true;
+    std::cout << "ip location informations mapped: "
+              << frozen_db.ranges().size() << std::endl;
+    // the listeners and the engine are fed by the tree
+    if (location_index.enabled() || country_filter.enabled() || engine) {
+      thaw();
+    }
+  } else if (progressive_load) {
+    if (snapshot_path) {
+      std::string error;
+      if (!progressive::snapshot.open(snapshot_path, error)) {
+        std::cout << snapshot_path << ": " << error << std::endl;
+        return 1;
+      }
+      progressive::snapshot.loadNames(progressive::snapshot_names);
+      progressive::has_snapshot = true;
+    }
+    progressive::start(csv_path, threads);
+    std::cout << "loading ip location informations in background" << std::endl;
+  } else {
+    int lines_read = load_tree(csv_path, threads);
+    if (lines_read < 0) {
+      return 1;
+    }
+    fill_engine();
+    std::cout << "ip location informations read: " << lines_read << std::endl;
+  }
+  if (!publish_name.empty()) {
+    std::string error;
+    if (!shared_publisher.open(publish_name, error) ||
+        !publish_shared(error)) {
+      std::cout << publish_name << ": " << error << std::endl;
+      return 1;
+    }
+    std::cout << "shared database published: " << publish_name
+              << ", generation " << shared_publisher.generation() << std::endl;
+  }
+  if (cache_prefix && serve_endpoint.empty()) {
+    cache_epochs.emplace();
+    range_cache.emplace(*cache_epochs, cache_prefix);
+  }
+  if (enrich) {
+    return enrich_main(enrich_in, enrich_out, threads);
+  }
+  if (!serve_endpoint.empty()) {
+    return uring ? serve_main<ipq::UringServer>(serve_endpoint, serve_engine,
+                                                threads, binary)
+                 : serve_main<ipq::Server>(serve_endpoint, serve_engine,
+                                           threads, binary);
+  }
+  /* commands are read a line at a time from large blocks of the input, the
+   * answers collected in a large buffer and written when the input runs dry
+   * (so an interactive session sees every answer) or on the flush command
+   */
+  std::cout << std::flush;
+  ipq::LineReader input(STDIN_FILENO);
+  ipq::OutputBuffer out(STDOUT_FILENO);
+  std::string_view line, words[8];
+  size_t count = 0;
+  auto next_line = [&]() {
+    if (!input.next(line, [&]() { out.flush(); })) {
+      return false;
+    }
+    count = std::min<size_t>(ipq::splitWords(line, words, 8), 8);
+    return true;
   };
-  while (true) {
-    std::string command;
-    std::cin >> command;
+  /* parses the first n arguments into ips; prints why if one of them is no
+   * address, a query of an IPv6 address outside the IPv4-mapped ones is not
+   * found, or if the two addresses of a range are inverted
+   */
+  ipq::Ip ips[2];
+  auto parse_ips = [&](size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      if (ipq::parseIp(words[i + 1], ips[i])) {
+        continue;
+      }
+      ipq::Ip6 ip6;
+      if (!ipq::parseIp6(words[i + 1], ip6)) {
+        out << "invalid ip: " << words[i + 1] << '\n';
+      } else if (words[0] == "query") {
+        out << "not found\n";
+      } else {
+        out << "ipv6 address not supported: " << words[i + 1] << '\n';
+      }
+      return false;
+    }
+    if (n > 1 && ips[0] > ips[1]) {
+      out << "range start is greater than range end\n";
+      return false;
+    }
+    return true;
+  };
+  while (next_line()) {
+    if (!count) {
+      continue;
+    }
+    if (progressive::failed && !progressive::report_failure(out)) {
+      break;
+    }
+    if (shared_db && frozen && shared_db->changed()) {
+      std::string error;
+      if (!shared_db->refresh(error) || !attach_shared(error)) {
+        out << "can not follow the shared database: " << error << '\n';
+      }
+    }
+    std::string_view command = words[0];
+    const ipq::CommandSpec* spec = ipq::findCommand(command);
+    if (!spec) {
+      out << "unknown command\n";
+      continue;
+    }
+    if (count <= spec->arguments) {
+      out << "missing arguments for " << command << '\n';
+      continue;
+    }
+    if (!parse_ips(spec->ip_arguments)) {
+      continue;
+    }
+    if (command == "quit") {
+      break;
+    }
+    if (command != "query" && (progressive::loading || progressive::failed)) {
+      out.flush();
+      progressive::wait();
+      if (progressive::failed) {
+        if (!progressive::report_failure(out)) {
+          break;
+        }
+        out << command << " not available, the load failed\n";
+        continue;
+      }
+    }
     if (command == "query") {
-      uint32_t ip = get_ip();
-      ipq::Location* loc = geo_ip.find(ip);
-      if (!loc) {
-        std::cout << "not found" << std::endl;
+      uint32_t ip = ips[0];
+      ipq::Location loc;
+      if (progressive::query(ip, out)) {
+        continue;
+      } else if (!find_location(ip, loc)) {
+        out << "not found\n";
       } else {
-        int country_code = loc->getProvinceCode();
-        int city_code = loc->getCountryCode();
-        std::cout << "country code: " << country_infos[country_code].code
-                  << " country name: " << country_infos[country_code].name
-                  << std::endl;
-        auto& pc = country_infos[country_code].city_names[city_code];
-        std::cout << "province: " << pc.first << " city : " << pc.second
-                  << std::endl;
+        formatter.print(out, loc);
+      }
+    } else if (command == "range") {
+      // not through the range cache, which keeps ranges cut to its blocks
+      ipq::IpRange range;
+      ipq::Location loc = find_location_range(ips[0], range);
+      out << "range: " << format_ip(range.start) << " - "
+          << format_ip(range.end) << '\n';
+      if (loc == ipq::Location()) {
+        out << "not found\n";
+      } else {
+        formatter.print(out, loc);
+      }
+    } else if (command == "flush") {
+      out.flush();
+    } else if (command == "cache_stats") {
+      if (!range_cache) {
+        out << "range cache disabled, restart with --cache\n";
+        continue;
       }
+      print_cache_stats(out, range_cache->stats());
     } else if (command == "update") {
-      uint32_t ip1 = get_ip();
-      uint32_t ip2 = get_ip();
-      std::string code, country, province, city;
-      std::cin >> code >> country >> province >> city;
-      int country_code = get_country_code(code, country);
-      int city_code = get_city_code(country_code, province, city);
-      geo_ip.update(ip1, ip2, ipq::Location(country_code, city_code));
+      update_ranges({{ips[0], ips[1],
+                      names.location(words[3], words[4], words[5], words[6])}});
+    } else if (command == "overlap") {
+      int ranges_found = 0;
+      for_each_overlapping(
+          ips[0], ips[1],
+          [&](uint32_t start, uint32_t end, const ipq::Location& loc) {
+            ++ranges_found;
+            uint32_t city = loc.getCountryCode();
+            out << format_ip(start) << ' ' << format_ip(end)
+                << " country code: "
+                << names.countryCode(loc.getProvinceCode())
+                << " province: " << names.province(city)
+                << " city: " << names.cityName(city) << '\n';
+          });
+      out << "ranges found: " << ranges_found << '\n';
+    } else if (command == "in") {
+      uint32_t ip = ips[0];
+      std::string_view codes = words[2];
+      ipq::CountryFilter<>::CountrySet countries;
+      std::set<uint32_t> wide_countries;
+      size_t p = 0;
+      while (p <= codes.size()) {
+        size_t np = std::min(codes.find(',', p), codes.size());
+        uint32_t country = names.findCountry(codes.substr(p, np - p));
+        if (country < countries.size()) {
+          countries.set(country);
+        } else if (country != names.NotFound) {
+          wide_countries.insert(country);
+        }
+        p = np + 1;
+      }
+      auto answer = ipq::CountryFilter<>::Answer::Maybe;
+      if (country_filter.enabled() && wide_countries.empty()) {
+        answer = country_filter.contains(ip, countries);
+      }
+      if (answer == ipq::CountryFilter<>::Answer::Maybe) {
+        ipq::Location loc;
+        bool found = find_location(ip, loc);
+        uint32_t country = found ? loc.getProvinceCode() : 0;
+        bool in = found && (country < countries.size()
+                              ? countries.test(country)
+                              : wide_countries.count(country) > 0);
+        answer = in ? ipq::CountryFilter<>::Answer::Yes
+                    : ipq::CountryFilter<>::Answer::No;
+      }
+      out << (answer == ipq::CountryFilter<>::Answer::Yes ? "yes\n" : "no\n");
+    } else if (command == "ranges" || command == "count" ||
+               command == "count_city" || command == "delete_country") {
+      std::string_view code = words[1];
+      if (!location_index.enabled()) {
+        out << "location index disabled, restart with --location-index\n";
+        continue;
+      }
+      uint32_t country = names.findCountry(code);
+      if (country == names.NotFound) {
+        out << "unknown country code: " << code << '\n';
+        continue;
+      }
+      if (command == "count") {
+        out << "ranges: " << location_index.countCountry(country) << '\n';
+      } else if (command == "count_city") {
+        uint32_t city_id = names.findCity(words[2], words[3]);
+        size_t ranges = 0;
+        if (city_id != names.NotFound) {
+          ranges = location_index.count(ipq::Location(country, city_id));
+        }
+        out << "ranges: " << ranges << '\n';
+      } else {
+        std::vector<std::pair<uint32_t, uint32_t>> found;
+        auto collect = [&](const ipq::Location& loc,
+                           const std::set<uint32_t>& starts) {
+          for (uint32_t start : starts) {
+            uint32_t end = geo_ip.keys.find(start)->second.first;
+            found.emplace_back(start, end);
+            if (command == "ranges") {
+              uint32_t city = loc.getCountryCode();
+              out << format_ip(start) << ' ' << format_ip(end)
+                  << " province: " << names.province(city)
+                  << " city: " << names.cityName(city) << '\n';
+            }
+          }
+        };
+        location_index.for_each_country_location(country, collect);
+        if (command == "delete_country") {
+          std::vector<ipq::IpRangeUpdate> removals;
+          for (auto& range : found) {
+            removals.push_back({range.first, range.second, std::nullopt});
+          }
+          update_ranges(removals);
+          out << "ranges deleted: " << found.size() << '\n';
+        } else {
+          out << "ranges found: " << found.size() << '\n';
+        }
+      }
+    } else if (command == "batch") {
+      uint32_t lines;
+      if (!ipq::parseUint32(words[1], lines)) {
+        out << "invalid count: " << words[1] << '\n';
+        continue;
+      }
+      std::vector<ipq::IpRangeUpdate> updates;
+      for (size_t i = 0; i < lines && next_line(); ++i) {
+        if (count == 7 && words[0] == "update") {
+          if (parse_ips(2)) {
+            updates.push_back(
+                {ips[0], ips[1],
+                 names.location(words[3], words[4], words[5], words[6])});
+          }
+        } else if (count == 3 && words[0] == "delete") {
+          if (parse_ips(2)) {
+            updates.push_back({ips[0], ips[1], std::nullopt});
+          }
+        } else {
+          out << "unknown command in batch: " << line << '\n';
+        }
+      }
+      update_ranges(updates);
+      out << "updates applied: " << updates.size() << '\n';
+    } else if (command == "reload") {
+      // loading errors are printed to std::cout
+      out.flush();
+      if (reload(std::string(words[1]).c_str(), threads, out) &&
+          shared_publisher.generation()) {
+        publish_command(out);
+      }
+    } else if (command == "publish") {
+      publish_command(out);
     } else if (command == "delete") {
-      uint32_t ip1 = get_ip();
-      uint32_t ip2 = get_ip();
-      geo_ip.remove(ip1, ip2);
-    } else {
-      std::cout << "unknown command" << std::endl;
+      update_ranges({{ips[0], ips[1], std::nullopt}});
     }
   }
+  progressive::stop();
+  bool load_failed = progressive::failed && !progressive::report_failure(out);
+  out.flush();
+  return load_failed ? 1 : 0;
 }
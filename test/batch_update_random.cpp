@@ -0,0 +1,143 @@
+#include "btree_map.hpp"
+#include "data_storage.hpp"
+#include "interval_tree.hpp"
+
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <map>
+#include <random>
+#include <set>
+#include <tuple>
+#include <vector>
+
+int NMAX = 300;
+
+std::random_device rd;
+
+using T = uint16_t;
+using Update = ipq::IntervalUpdate<T, T>;
+using Range = std::tuple<T, T, T>;
+
+// mirrors the stored ranges from the notifications
+struct RecordingListener {
+  std::set<Range> ranges;
+  void inserted(T start, T end, T val) {
+    EXPECT_TRUE(ranges.emplace(start, end, val).second);
+  }
+  void erased(T start, T end, T val) {
+    EXPECT_EQ(ranges.erase(Range(start, end, val)), 1u);
+  }
+};
+
+template <typename MapTy>
+using Tree = ipq::IntervalTree<T, T, MapTy, RecordingListener>;
+using StlTree = Tree<std::map<T, std::pair<T, T>>>;
+using BTree = Tree<ipq::BTreeMap<T, std::pair<T, T>>>;
+
+template <typename TreeTy>
+std::vector<Range> contents(TreeTy& tree) {
+  std::vector<Range> ret;
+  for (auto& range : tree.keys) {
+    ret.emplace_back(range.first, range.second.first, range.second.second);
+  }
+  EXPECT_EQ(std::set<Range>(ret.begin(), ret.end()), tree.listener.ranges);
+  return ret;
+}
+
+std::vector<Update> randomBatch(size_t size, bool disjoint) {
+  std::uniform_int_distribution<T> key_dist, val_dist(0, 5);
+  std::uniform_int_distribution<int> len_dist(0, 500), op_dist(0, 4);
+  std::vector<Update> ret;
+  for (size_t i = 0; i < size; ++i) {
+    T start = key_dist(rd);
+    T end = std::min<int>(start + len_dist(rd), UINT16_MAX);
+    if (op_dist(rd)) {
+      ret.push_back({start, end, val_dist(rd)});
+    } else {
+      ret.push_back({start, end, std::nullopt});
+    }
+  }
+  if (disjoint) {
+    // keep the first update of every run of overlapping ones
+    std::sort(ret.begin(), ret.end(),
+              [](auto& a, auto& b) { return a.start < b.start; });
+    std::vector<Update> kept;
+    for (auto& u : ret) {
+      if (kept.empty() || kept.back().end < u.start) {
+        kept.push_back(u);
+      }
+    }
+    std::shuffle(kept.begin(), kept.end(), std::mt19937(rd()));
+    ret = kept;
+  }
+  return ret;
+}
+
+template <typename TreeTy>
+void applyOneByOne(TreeTy& tree, const std::vector<Update>& updates) {
+  for (auto& u : updates) {
+    if (u.val) {
+      tree.update(u.start, u.end, *u.val);
+    } else {
+      tree.remove(u.start, u.end);
+    }
+  }
+}
+
+TEST(BatchUpdate, SameAsOneByOne) {
+  StlTree expected, stl_tree;
+  BTree btree;
+  std::uniform_int_distribution<int> size_dist(1, 200);
+  for (int i = 0; i < NMAX; ++i) {
+    // small batches take the in place path, large ones the rebuild
+    size_t size = i % 3 ? size_dist(rd) : size_dist(rd) * 20;
+    auto updates = randomBatch(size, i % 2);
+    applyOneByOne(expected, updates);
+    stl_tree.batch_update(updates);
+    btree.batch_update(updates);
+    auto ranges = contents(expected);
+    ASSERT_EQ(contents(stl_tree), ranges);
+    ASSERT_EQ(contents(btree), ranges);
+  }
+}
+
+TEST(BatchUpdate, LaterUpdateWins) {
+  StlTree tree;
+  tree.batch_update({{10, 20, 1}, {15, 30, 2}, {12, 13, std::nullopt},
+                     {0, 5, 3}, {0, 5, 4}});
+  EXPECT_EQ(contents(tree),
+            (std::vector<Range>{Range(0, 5, 4), Range(10, 11, 1),
+                                Range(14, 14, 1), Range(15, 30, 2)}));
+  tree.batch_update({});
+  EXPECT_EQ(contents(tree).size(), 4u);
+}
+
+TEST(BatchUpdate, KeySpaceBounds) {
+  StlTree tree;
+  tree.update(0, UINT16_MAX, 1);
+  tree.batch_update({{0, 0, 2}, {UINT16_MAX, UINT16_MAX, 3}});
+  EXPECT_EQ(contents(tree),
+            (std::vector<Range>{Range(0, 0, 2), Range(1, UINT16_MAX - 1, 1),
+                                Range(UINT16_MAX, UINT16_MAX, 3)}));
+}
+
+TEST(DataStorageModel, DispatchesToIntervalTree) {
+  ipq::DataStorageModel<ipq::IntervalTree<
+      ipq::Ip, ipq::Location,
+      std::map<ipq::Ip, std::pair<ipq::Ip, ipq::Location>>>>
+      model;
+  ipq::DataStorateConcept& storage = model;
+  storage.updateBlocking(10, 20, ipq::Location(1, 2));
+  storage.batchUpdateBlocking({{15, 30, ipq::Location(3, 4)},
+                               {18, 19, std::nullopt}});
+  EXPECT_TRUE(storage.query(12) == ipq::Location(1, 2));
+  EXPECT_TRUE(storage.query(16) == ipq::Location(3, 4));
+  EXPECT_TRUE(storage.query(18) == ipq::Location());
+  EXPECT_TRUE(storage.query(31) == ipq::Location());
+  EXPECT_EQ(model.impl().size(), 3u);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
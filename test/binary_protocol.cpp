@@ -0,0 +1,187 @@
+#include "binary_protocol.hpp"
+#include "server.hpp"
+
+#include "gtest/gtest.h"
+#include <arpa/inet.h>
+#include <cstdint>
+#include <netinet/in.h>
+#include <random>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+namespace binary = ipq::binary;
+
+struct Record {
+  uint32_t country, city, start, end;
+};
+
+// the records of the Lookup response at the start of buf, consumed from it
+std::vector<Record> takeRecords(std::string& buf) {
+  EXPECT_GE(buf.size(), binary::HeaderSize);
+  EXPECT_EQ(uint8_t(buf[0]), binary::Lookup);
+  uint32_t count = binary::load32(&buf[4]);
+  EXPECT_GE(buf.size(), binary::HeaderSize + count * binary::RecordSize);
+  std::vector<Record> records(count);
+  const char* p = buf.data() + binary::HeaderSize;
+  for (auto& r : records) {
+    r = {binary::load32(p), binary::load32(p + 4), binary::load32(p + 8),
+         binary::load32(p + 12)};
+    p += binary::RecordSize;
+  }
+  buf.erase(0, binary::HeaderSize + count * binary::RecordSize);
+  return records;
+}
+
+class BinaryProtocolTest : public ::testing::Test {
+ protected:
+  ipq::LocationNames names;
+  ipq::ServingState state{names};
+
+  void SetUp() override {
+    state.engine->updateBlocking(
+        100, 200, names.location("AU", "Australia", "QLD", "Brisbane"));
+    state.engine->updateBlocking(
+        0x0a000000, 0x0affffff, names.location("NZ", "New Zealand", "", ""));
+  }
+};
+
+TEST_F(BinaryProtocolTest, Lookup) {
+  auto handler = ipq::binaryProtocol(state)(0);
+  ASSERT_TRUE(handler);
+  std::vector<ipq::Ip> ips = {150, 99, 0x0a010203, 200};
+  std::string in, out;
+  binary::appendLookup(in, ips);
+  // an incomplete message is left for later
+  EXPECT_EQ(handler(std::string_view(in).substr(0, 11), out), 0u);
+  EXPECT_TRUE(out.empty());
+  ASSERT_EQ(handler(in, out), in.size());
+  auto records = takeRecords(out);
+  EXPECT_TRUE(out.empty());
+  ASSERT_EQ(records.size(), 4u);
+  EXPECT_EQ(names.countryCode(records[0].country), "AU");
+  EXPECT_EQ(names.cityName(records[0].city), "Brisbane");
+  EXPECT_EQ(records[0].start, 100u);
+  EXPECT_EQ(records[0].end, 200u);
+  EXPECT_EQ(records[1].country, binary::NotFound);
+  EXPECT_EQ(records[1].city, binary::NotFound);
+  // the gap up to the first range
+  EXPECT_EQ(records[1].start, 0u);
+  EXPECT_EQ(records[1].end, 99u);
+  EXPECT_EQ(names.countryName(records[2].country), "New Zealand");
+  EXPECT_EQ(records[2].start, 0x0a000000u);
+  EXPECT_EQ(records[2].end, 0x0affffffu);
+  EXPECT_EQ(records[3].country, records[0].country);
+}
+
+TEST_F(BinaryProtocolTest, Ipv6Keys) {
+  auto handler = ipq::binaryProtocol(state)(0);
+  std::string in, out;
+  binary::appendHeader(in, binary::Lookup, 6, 2);
+  char mapped[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\xff', '\xff', 0, 0, 0, 120};
+  in.append(mapped, 16);
+  char v6[16] = {0x20, 0x01, 0x0d, '\xb8'};
+  in.append(v6, 16);
+  ASSERT_EQ(handler(in, out), in.size());
+  auto records = takeRecords(out);
+  ASSERT_EQ(records.size(), 2u);
+  EXPECT_EQ(names.countryCode(records[0].country), "AU");
+  EXPECT_EQ(records[0].start, 100u);
+  EXPECT_EQ(records[1].country, binary::NotFound);
+  EXPECT_GT(records[1].start, records[1].end);
+}
+
+TEST_F(BinaryProtocolTest, Names) {
+  auto handler = ipq::binaryProtocol(state)(0);
+  std::string in, out;
+  binary::appendHeader(in, binary::Names, 0, 0);
+  ASSERT_EQ(handler(in, out), in.size());
+  ASSERT_EQ(uint8_t(out[0]), binary::Names);
+  ASSERT_EQ(binary::load32(&out[4]), out.size() - binary::HeaderSize);
+  size_t pos = binary::HeaderSize;
+  auto take_string = [&]() {
+    size_t len = uint8_t(out[pos]) << 8 | uint8_t(out[pos + 1]);
+    std::string str = out.substr(pos + 2, len);
+    pos += 2 + len;
+    return str;
+  };
+  ASSERT_EQ(binary::load32(&out[pos]), names.countries());
+  pos += 4;
+  for (uint32_t country = 0; country < names.countries(); ++country) {
+    EXPECT_EQ(take_string(), names.countryCode(country));
+    EXPECT_EQ(take_string(), names.countryName(country));
+  }
+  ASSERT_EQ(binary::load32(&out[pos]), names.cities());
+  pos += 4;
+  for (uint32_t city = 0; city < names.cities(); ++city) {
+    EXPECT_EQ(take_string(), names.province(city));
+    EXPECT_EQ(take_string(), names.cityName(city));
+  }
+  EXPECT_EQ(pos, out.size());
+}
+
+TEST_F(BinaryProtocolTest, Errors) {
+  auto handler = ipq::binaryProtocol(state)(0);
+  std::string in, out;
+  binary::appendHeader(in, binary::Lookup, 5, 1);
+  EXPECT_EQ(handler(in, out), ipq::Server::Close);
+  EXPECT_EQ(out, std::string("\xff\x02\0\0\0\0\0\0", 8));
+  in.clear();
+  out.clear();
+  binary::appendHeader(in, binary::Lookup, 4, binary::MaxKeys + 1);
+  EXPECT_EQ(handler(in, out), ipq::Server::Close);
+  EXPECT_EQ(uint8_t(out[1]), binary::TooManyKeys);
+  in.clear();
+  out.clear();
+  binary::appendHeader(in, binary::Type(9), 0, 0);
+  EXPECT_EQ(handler(in, out), ipq::Server::Close);
+  EXPECT_EQ(uint8_t(out[1]), binary::UnknownType);
+}
+
+TEST_F(BinaryProtocolTest, PipelinedOverTcp) {
+  ipq::Server server;
+  std::string error;
+  ASSERT_TRUE(server.start("tcp:127.0.0.1:0", 2, ipq::binaryProtocol(state),
+                           error))
+      << error;
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(server.port());
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+  // messages of 10k keys, larger than one read of the server
+  const int messages = 20, keys = 10000;
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<ipq::Ip> ip_dist(0, 300);
+  std::vector<std::vector<ipq::Ip>> sent(messages);
+  std::string requests;
+  for (auto& ips : sent) {
+    ips.resize(keys);
+    for (auto& ip : ips) {
+      ip = ip_dist(gen);
+    }
+    binary::appendLookup(requests, ips);
+  }
+  ASSERT_EQ(::send(fd, requests.data(), requests.size(), MSG_NOSIGNAL),
+            ssize_t(requests.size()));
+  ::shutdown(fd, SHUT_WR);
+  std::string responses;
+  char buf[1 << 16];
+  ssize_t n;
+  while ((n = ::recv(fd, buf, sizeof(buf), 0)) > 0) {
+    responses.append(buf, n);
+  }
+  ::close(fd);
+  for (auto& ips : sent) {
+    auto records = takeRecords(responses);
+    ASSERT_EQ(records.size(), ips.size());
+    for (size_t i = 0; i < ips.size(); ++i) {
+      bool inside = ips[i] >= 100 && ips[i] <= 200;
+      ASSERT_EQ(records[i].country != binary::NotFound, inside);
+      ASSERT_EQ(records[i].start, inside ? 100u : ips[i] < 100 ? 0u : 201u);
+    }
+  }
+  EXPECT_TRUE(responses.empty());
+}
@@ -0,0 +1,115 @@
+#include "buffered_io.hpp"
+#include "location_formatter.hpp"
+
+#include "gtest/gtest.h"
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// what can be read from fd until its end
+std::string readAll(int fd) {
+  std::string data;
+  char buf[4096];
+  ssize_t n;
+  while ((n = ::read(fd, buf, sizeof(buf))) > 0) {
+    data.append(buf, n);
+  }
+  return data;
+}
+
+TEST(LineReader, Lines) {
+  int fds[2];
+  ASSERT_EQ(::pipe(fds), 0);
+  // lines shorter and longer than the blocks, the last one without newline
+  std::vector<std::string> lines = {"", "a", "query 1.2.3.4", std::string(100, 'x'),
+                                    "", std::string(7, 'y'), "last"};
+  std::thread writer([&]() {
+    for (size_t i = 0; i < lines.size(); ++i) {
+      std::string line = lines[i] + (i + 1 < lines.size() ? "\n" : "");
+      // written in pieces, so that reads return parts of lines
+      for (size_t p = 0; p < line.size(); p += 3) {
+        std::string piece = line.substr(p, 3);
+        ASSERT_EQ(::write(fds[1], piece.data(), piece.size()),
+                  ssize_t(piece.size()));
+      }
+    }
+    ::close(fds[1]);
+  });
+  ipq::LineReader reader(fds[0], 8);
+  std::string_view line;
+  size_t dry = 0;
+  for (auto& expected : lines) {
+    ASSERT_TRUE(reader.next(line, [&]() { ++dry; }));
+    EXPECT_EQ(line, expected);
+  }
+  EXPECT_FALSE(reader.next(line, [&]() { ++dry; }));
+  EXPECT_GT(dry, 0u);
+  writer.join();
+  ::close(fds[0]);
+}
+
+TEST(LineReader, DryOnlyWhenNoLineIsBuffered) {
+  int fds[2];
+  ASSERT_EQ(::pipe(fds), 0);
+  std::string data = "a\nb\nc\n";
+  ASSERT_EQ(::write(fds[1], data.data(), data.size()), ssize_t(data.size()));
+  ::close(fds[1]);
+  ipq::LineReader reader(fds[0]);
+  std::string_view line;
+  size_t dry = 0;
+  auto on_dry = [&]() { ++dry; };
+  ASSERT_TRUE(reader.next(line, on_dry));
+  EXPECT_EQ(dry, 1u);
+  ASSERT_TRUE(reader.next(line, on_dry));
+  ASSERT_TRUE(reader.next(line, on_dry));
+  EXPECT_EQ(line, "c");
+  EXPECT_EQ(dry, 1u);
+  EXPECT_FALSE(reader.next(line, on_dry));
+  ::close(fds[0]);
+}
+
+TEST(OutputBuffer, WrittenOnFlushOrWhenFull) {
+  int fds[2];
+  ASSERT_EQ(::pipe(fds), 0);
+  {
+    ipq::OutputBuffer out(fds[1], 16);
+    out << "ranges: " << uint64_t(42) << '\n';
+    out << -7 << ' ' << uint32_t(4294967295u) << '\n';
+    out.flush();
+    out << std::string(20, 'z');
+    out << "tail";
+  }
+  ::close(fds[1]);
+  EXPECT_EQ(readAll(fds[0]),
+            "ranges: 42\n-7 4294967295\n" + std::string(20, 'z') + "tail");
+  ::close(fds[0]);
+}
+
+TEST(LocationFormatter, Lines) {
+  ipq::LocationNames names;
+  ipq::LocationFormatter formatter(names);
+  ipq::Location au = names.location("AU", "Australia", "QLD", "Brisbane");
+  std::string out;
+  struct Sink {
+    std::string& str;
+    Sink& operator<<(std::string_view s) {
+      str.append(s);
+      return *this;
+    }
+  } sink{out};
+  formatter.print(sink, au);
+  EXPECT_EQ(out,
+            "country code: AU country name: Australia\n"
+            "province: QLD city : Brisbane\n");
+  // names added after the first lines were rendered
+  ipq::Location nz = names.location("NZ", "New Zealand", "AKL", "Auckland");
+  out.clear();
+  formatter.print(sink, nz);
+  formatter.print(sink, au);
+  EXPECT_EQ(out,
+            "country code: NZ country name: New Zealand\n"
+            "province: AKL city : Auckland\n"
+            "country code: AU country name: Australia\n"
+            "province: QLD city : Brisbane\n");
+}
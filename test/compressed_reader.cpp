@@ -0,0 +1,161 @@
+#include "compressed_reader.hpp"
+
+#include "gtest/gtest.h"
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+std::random_device rd;
+
+std::string randomCsv(size_t lines) {
+  std::string ret;
+  std::uniform_int_distribution<uint32_t> dist;
+  for (size_t i = 0; i < lines; ++i) {
+    ret += '"' + std::to_string(dist(rd)) + "\",\"" +
+           std::to_string(dist(rd) % 1000) + "\"\n";
+  }
+  return ret;
+}
+
+void writeFile(const std::string& path, const std::string& data) {
+  FILE* file = std::fopen(path.c_str(), "wb");
+  ASSERT_TRUE(file);
+  ASSERT_EQ(std::fwrite(data.data(), 1, data.size(), file), data.size());
+  std::fclose(file);
+}
+
+// reads the whole stream in pieces of random size, or fails with -1
+long readAll(ipq::CompressedReader& reader, std::string& out) {
+  std::uniform_int_distribution<size_t> size_dist(1, 1 << 16);
+  std::vector<char> buf(1 << 16);
+  while (true) {
+    size_t size = size_dist(rd);
+    long ret = reader.read(buf.data(), size);
+    if (ret < 0) {
+      return -1;
+    }
+    out.append(buf.data(), ret);
+    if (size_t(ret) < size) {
+      return out.size();
+    }
+  }
+}
+
+#ifdef IPQ_HAVE_ZLIB
+std::string gzipCompress(const std::string& data) {
+  std::string path = testing::TempDir() + "compressed_reader_tmp.gz";
+  gzFile gz = gzopen(path.c_str(), "wb");
+  gzwrite(gz, data.data(), data.size());
+  gzclose(gz);
+  FILE* file = std::fopen(path.c_str(), "rb");
+  std::string ret;
+  char buf[4096];
+  for (size_t n; (n = std::fread(buf, 1, sizeof(buf), file));) {
+    ret.append(buf, n);
+  }
+  std::fclose(file);
+  ::unlink(path.c_str());
+  return ret;
+}
+#endif
+
+#ifdef IPQ_HAVE_ZSTD
+std::string zstdCompress(const std::string& data) {
+  std::string ret(ZSTD_compressBound(data.size()), '\0');
+  ret.resize(ZSTD_compress(&ret[0], ret.size(), data.data(), data.size(), 3));
+  return ret;
+}
+#endif
+
+class CompressedReaderTest : public ::testing::Test {
+ protected:
+  std::string path = testing::TempDir() + "compressed_reader_test";
+  void TearDown() override { ::unlink(path.c_str()); }
+
+  void expectRoundTrip(const std::string& compressed,
+                       const std::string& expected) {
+    writeFile(path, compressed);
+    ipq::CompressedReader reader;
+    ASSERT_TRUE(reader.open(path.c_str())) << reader.error();
+    std::string out;
+    EXPECT_EQ(readAll(reader, out), long(expected.size())) << reader.error();
+    EXPECT_EQ(out, expected);
+  }
+
+  void expectTruncated(const std::string& compressed) {
+    writeFile(path, compressed.substr(0, compressed.size() / 2));
+    ipq::CompressedReader reader;
+    ASSERT_TRUE(reader.open(path.c_str()));
+    std::string out;
+    EXPECT_EQ(readAll(reader, out), -1);
+    EXPECT_FALSE(reader.error().empty());
+  }
+};
+
+#ifdef IPQ_HAVE_ZLIB
+TEST_F(CompressedReaderTest, Gzip) {
+  std::string csv = randomCsv(100000);
+  expectRoundTrip(gzipCompress(csv), csv);
+  // concatenated members are one stream
+  expectRoundTrip(gzipCompress(csv) + gzipCompress("tail\n"), csv + "tail\n");
+  expectRoundTrip(gzipCompress(""), "");
+  expectTruncated(gzipCompress(csv));
+}
+#endif
+
+#ifdef IPQ_HAVE_ZSTD
+TEST_F(CompressedReaderTest, Zstd) {
+  std::string csv = randomCsv(100000);
+  expectRoundTrip(zstdCompress(csv), csv);
+  expectRoundTrip(zstdCompress(csv) + zstdCompress("tail\n"), csv + "tail\n");
+  expectRoundTrip(zstdCompress(""), "");
+  expectTruncated(zstdCompress(csv));
+}
+#endif
+
+TEST_F(CompressedReaderTest, UnknownFormat) {
+  writeFile(path, "\"1\",\"2\"\n");
+  ipq::CompressedReader reader;
+  EXPECT_FALSE(reader.open(path.c_str()));
+  char buf[16];
+  EXPECT_EQ(reader.read(buf, sizeof(buf)), -1);
+  EXPECT_FALSE(reader.open((path + ".missing").c_str()));
+}
+
+TEST(BoundedQueue, ProducerConsumer) {
+  ipq::BoundedQueue<int> queue(3);
+  const int items = 100000;
+  std::thread producer([&]() {
+    for (int i = 0; i < items; ++i) {
+      ASSERT_TRUE(queue.push(i));
+    }
+    queue.close();
+  });
+  int item, expected = 0;
+  while (queue.pop(item)) {
+    EXPECT_EQ(item, expected++);
+  }
+  producer.join();
+  EXPECT_EQ(expected, items);
+  EXPECT_FALSE(queue.push(0));
+}
+
+TEST(BoundedQueue, CloseWakesProducer) {
+  ipq::BoundedQueue<int> queue(1);
+  ASSERT_TRUE(queue.push(1));
+  std::thread producer([&]() { EXPECT_FALSE(queue.push(2)); });
+  queue.close();
+  producer.join();
+  int item;
+  ASSERT_TRUE(queue.pop(item));
+  EXPECT_EQ(item, 1);
+  EXPECT_FALSE(queue.pop(item));
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
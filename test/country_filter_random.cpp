@@ -0,0 +1,92 @@
+#include "country_filter.hpp"
+#include "interval_tree.hpp"
+#include "location.hpp"
+
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <map>
+#include <random>
+#include <utility>
+
+int NMAX = 3000;
+
+std::random_device rd;
+
+using Filter = ipq::CountryFilter<8>;
+using IntTree =
+    ipq::IntervalTree<uint32_t, ipq::Location,
+                      std::map<uint32_t, std::pair<uint32_t, ipq::Location>>,
+                      Filter>;
+
+/* checks that every definite answer of the filter agrees with the tree
+ */
+int expectFilterConsistent(IntTree& tree, uint32_t ip,
+                           const Filter::CountrySet& countries) {
+  auto answer = tree.listener.contains(ip, countries);
+  ipq::Location* loc = tree.find(ip);
+  bool in = loc && loc->getProvinceCode() < countries.size() &&
+            countries.test(loc->getProvinceCode());
+  if (answer == Filter::Answer::Yes) {
+    EXPECT_TRUE(in);
+  } else if (answer == Filter::Answer::No) {
+    EXPECT_FALSE(in);
+  }
+  return answer == Filter::Answer::Maybe;
+}
+
+TEST(CountryFilter, FollowsUpdateAndRemove) {
+  IntTree tree;
+  tree.listener.enable();
+  // keep most of the work inside 16 /16s, so that ranges collide
+  std::uniform_int_distribution<uint32_t> key_dist(0, (uint32_t(1) << 20) - 1);
+  std::uniform_int_distribution<uint32_t> wide_dist;
+  std::uniform_int_distribution<int> op_dist(1, 10);
+  // countries 8 and 9 do not fit in the filter
+  std::uniform_int_distribution<int> country_dist(0, 9);
+  std::uniform_int_distribution<unsigned long> set_dist(0, 255);
+  for (int i = 0; i < NMAX; ++i) {
+    int op = op_dist(rd);
+    auto& dist = op == 10 ? wide_dist : key_dist;
+    uint32_t key1 = dist(rd), key2 = dist(rd);
+    if (key1 > key2) {
+      std::swap(key1, key2);
+    }
+    if (op <= 3) {
+      Filter::CountrySet countries(set_dist(rd));
+      for (int j = 0; j < 100; ++j) {
+        expectFilterConsistent(tree, key_dist(rd), countries);
+      }
+    } else if (op <= 5) {
+      tree.remove(key1, key2);
+    } else {
+      tree.update(key1, key2, ipq::Location(country_dist(rd), 0));
+    }
+  }
+}
+
+TEST(CountryFilter, SingleCountryFastPath) {
+  IntTree tree;
+  tree.listener.enable();
+  tree.update(0x10000, 0x2ffff, ipq::Location(3, 0));
+  tree.update(0x18000, 0x18000, ipq::Location(4, 0));
+  Filter::CountrySet three, four, both;
+  three.set(3);
+  four.set(4);
+  both.set(3).set(4);
+  EXPECT_EQ(tree.listener.contains(0x20001, three), Filter::Answer::Yes);
+  EXPECT_EQ(tree.listener.contains(0x20001, four), Filter::Answer::No);
+  EXPECT_EQ(tree.listener.contains(0x10001, four), Filter::Answer::Maybe);
+  EXPECT_EQ(tree.listener.contains(0x10001, both), Filter::Answer::Yes);
+  EXPECT_EQ(tree.listener.contains(0x30001, both), Filter::Answer::No);
+  tree.update(0x18000, 0x18000, ipq::Location(3, 0));
+  EXPECT_EQ(tree.listener.contains(0x10001, four), Filter::Answer::No);
+  tree.remove(0x1ffff, 0x20000);
+  EXPECT_EQ(tree.listener.contains(0x10001, three), Filter::Answer::Maybe);
+  EXPECT_EQ(tree.listener.contains(0x20001, three), Filter::Answer::Maybe);
+  EXPECT_EQ(tree.listener.contains(0x20001, four), Filter::Answer::No);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,98 @@
+#include "csv_scanner.hpp"
+
+#include "gtest/gtest.h"
+#include <string>
+#include <string_view>
+#include <vector>
+
+std::vector<std::vector<std::string>> scanAll(std::string_view buf,
+                                              bool expect_error = false) {
+  ipq::CsvScanner scanner(buf);
+  std::vector<std::vector<std::string>> ret;
+  std::string_view fields[8];
+  size_t field_count;
+  while (scanner.next(fields, 8, field_count)) {
+    ret.emplace_back(fields, fields + std::min<size_t>(field_count, 8));
+  }
+  EXPECT_EQ(scanner.error(), expect_error);
+  return ret;
+}
+
+using Lines = std::vector<std::vector<std::string>>;
+
+TEST(CsvScanner, QuotedAndUnquotedFields) {
+  EXPECT_EQ(scanAll("\"1\",\"2\",\"a b\"\r\n3,4,c\n"),
+            (Lines{{"1", "2", "a b"}, {"3", "4", "c"}}));
+  EXPECT_EQ(scanAll("\"x,y\",\"\",z"), (Lines{{"x,y", "", "z"}}));
+  EXPECT_EQ(scanAll("a,\r\n\r\n\nb,c\r\n"), (Lines{{"a", ""}, {"b", "c"}}));
+  EXPECT_EQ(scanAll(""), Lines{});
+}
+
+TEST(CsvScanner, LongFieldsCrossVectorWidth) {
+  std::string long_field(100, 'x');
+  EXPECT_EQ(scanAll(long_field + "," + long_field + "\n"),
+            (Lines{{long_field, long_field}}));
+}
+
+TEST(CsvScanner, MalformedLines) {
+  scanAll("\"unterminated\n", true);
+  scanAll("\"a\"b,c\n", true);
+}
+
+TEST(CsvScanner, SplitLinesAlignsChunks) {
+  std::string buf;
+  for (int i = 0; i < 100; ++i) {
+    buf += "\"" + std::to_string(i) + "\",\"x\"\r\n";
+  }
+  for (size_t chunks : {1, 3, 7, 1000}) {
+    auto bounds = ipq::splitLines(buf.data(), buf.data() + buf.size(), chunks);
+    ASSERT_GE(bounds.size(), 2u);
+    EXPECT_LE(bounds.size(), chunks + 1);
+    EXPECT_EQ(bounds.front(), buf.data());
+    EXPECT_EQ(bounds.back(), buf.data() + buf.size());
+    size_t lines = 0;
+    for (size_t i = 0; i + 1 < bounds.size(); ++i) {
+      EXPECT_TRUE(bounds[i] == buf.data() || bounds[i][-1] == '\n');
+      lines += scanAll(std::string_view(bounds[i], bounds[i + 1] - bounds[i]))
+                   .size();
+    }
+    EXPECT_EQ(lines, 100u);
+  }
+}
+
+TEST(Db3Parser, ValidatesLayout) {
+  auto parse = [](std::string_view buf, int& lines) {
+    ipq::CsvScanner scanner(buf);
+    ipq::Db3Parser parser;
+    ipq::Db3Line line;
+    lines = 0;
+    while (parser.next(scanner, line)) {
+      ++lines;
+    }
+    return parser.error() ? std::string(parser.error()) : std::string();
+  };
+  int lines;
+  EXPECT_EQ(parse("\"0\",\"16777215\",\"-\",\"-\",\"-\",\"-\"\r\n"
+                  "\"16777216\",\"16777471\",\"AU\",\"Australia\","
+                  "\"Queensland\",\"Brisbane\"\r\n",
+                  lines),
+            "");
+  EXPECT_EQ(lines, 2);
+  EXPECT_NE(parse("\"0\",\"1\",\"AU\",\"A\",\"B\"\n", lines), "");
+  EXPECT_NE(parse("\"0\",\"1\",\"AU\",\"A\",\"B\",\"C\",\"D\"\n", lines), "");
+  EXPECT_NE(parse("\"0\",\"4294967296\",\"AU\",\"A\",\"B\",\"C\"\n", lines),
+            "");
+  EXPECT_NE(parse("\"0\",\"1x\",\"AU\",\"A\",\"B\",\"C\"\n", lines), "");
+  EXPECT_NE(parse("\"5\",\"1\",\"AU\",\"A\",\"B\",\"C\"\n", lines), "");
+  EXPECT_NE(parse("\"0\",\"1\",\"au\",\"A\",\"B\",\"C\"\n", lines), "");
+  EXPECT_NE(parse("\"0\",\"9\",\"AU\",\"A\",\"B\",\"C\"\n"
+                  "\"9\",\"10\",\"AU\",\"A\",\"B\",\"C\"\n",
+                  lines),
+            "");
+  EXPECT_EQ(lines, 1);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,132 @@
+#include "enrich.hpp"
+
+#include "gtest/gtest.h"
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+class EnrichTest : public ::testing::Test {
+ protected:
+  ipq::LocationNames names;
+  ipq::Location au, nz;
+  std::string in_path, out_path;
+
+  void SetUp() override {
+    au = names.location("AU", "Australia", "QLD", "Brisbane");
+    nz = names.location("NZ", "New Zealand", "AKL", "Auckland");
+    std::string prefix = "/tmp/ipq_enrich_test_" + std::to_string(::getpid());
+    in_path = prefix + ".txt";
+    out_path = prefix + ".tsv";
+  }
+
+  void TearDown() override {
+    ::unlink(in_path.c_str());
+    ::unlink(out_path.c_str());
+  }
+
+  // AU for [100, 200], NZ for 10.0.0.0/8
+  void lookup(ipq::ArrayRef<ipq::Ip> ips, ipq::Location* out) const {
+    for (ipq::Ip ip : ips) {
+      if (ip >= 100 && ip <= 200) {
+        *out++ = au;
+      } else {
+        *out++ = (ip >> 24) == 10 ? nz : ipq::Location();
+      }
+    }
+  }
+
+  void write(const std::string& data) {
+    std::ofstream(in_path, std::ios::binary) << data;
+  }
+
+  std::string read() {
+    std::ifstream file(out_path, std::ios::binary);
+    std::stringstream data;
+    data << file.rdbuf();
+    return data.str();
+  }
+
+  bool run(unsigned threads, size_t chunk_bytes, ipq::EnrichStats& stats) {
+    ipq::Enricher enricher(names, threads, chunk_bytes);
+    std::string error;
+    bool ok = enricher.run(
+        in_path.c_str(), out_path.c_str(),
+        [this](ipq::ArrayRef<ipq::Ip> ips, ipq::Location* out) {
+          lookup(ips, out);
+        },
+        stats, error);
+    EXPECT_TRUE(ok) << error;
+    return ok;
+  }
+};
+
+TEST_F(EnrichTest, Lines) {
+  write("150\n10.1.2.3\r\n99\nbad\n\n::ffff:0.0.0.120\n10.0.0.0");
+  ipq::EnrichStats stats;
+  ASSERT_TRUE(run(2, 1 << 20, stats));
+  EXPECT_EQ(read(),
+            "150\tAU\tAustralia\tQLD\tBrisbane\n"
+            "10.1.2.3\tNZ\tNew Zealand\tAKL\tAuckland\n"
+            "99\t-\t-\t-\t-\n"
+            "bad\t-\t-\t-\t-\n"
+            "\t-\t-\t-\t-\n"
+            "::ffff:0.0.0.120\tAU\tAustralia\tQLD\tBrisbane\n"
+            "10.0.0.0\tNZ\tNew Zealand\tAKL\tAuckland\n");
+  EXPECT_EQ(stats.lines, 7u);
+  EXPECT_EQ(stats.found, 4u);
+  EXPECT_EQ(stats.invalid, 2u);
+}
+
+TEST_F(EnrichTest, OrderKeptAcrossChunks) {
+  std::mt19937 gen(5);
+  std::string input, expected;
+  size_t found = 0;
+  for (int i = 0; i < 200000; ++i) {
+    ipq::Ip ip = gen() % 3 ? gen() % 300 : 0x0a000000 | (gen() & 0xffffff);
+    std::string line = (i & 1) ? std::to_string(ip)
+                               : std::to_string(ip >> 24) + '.' +
+                                     std::to_string(ip >> 16 & 255) + '.' +
+                                     std::to_string(ip >> 8 & 255) + '.' +
+                                     std::to_string(ip & 255);
+    input += line + '\n';
+    ipq::Location loc;
+    lookup(ipq::ArrayRef<ipq::Ip>(&ip, 1), &loc);
+    expected += line;
+    if (loc == au) {
+      expected += "\tAU\tAustralia\tQLD\tBrisbane\n";
+    } else if (loc == nz) {
+      expected += "\tNZ\tNew Zealand\tAKL\tAuckland\n";
+    } else {
+      expected += "\t-\t-\t-\t-\n";
+    }
+    found += !(loc == ipq::Location());
+  }
+  write(input);
+  // small chunks, many more than the workers may take ahead of the writer
+  for (unsigned threads : {1u, 4u}) {
+    ipq::EnrichStats stats;
+    ASSERT_TRUE(run(threads, 4096, stats));
+    EXPECT_EQ(read(), expected);
+    EXPECT_EQ(stats.lines, 200000u);
+    EXPECT_EQ(stats.found, found);
+    EXPECT_EQ(stats.invalid, 0u);
+  }
+}
+
+TEST_F(EnrichTest, EmptyAndMissingInput) {
+  write("");
+  ipq::EnrichStats stats;
+  ASSERT_TRUE(run(3, 1 << 20, stats));
+  EXPECT_EQ(read(), "");
+  EXPECT_EQ(stats.lines, 0u);
+  ipq::Enricher enricher(names, 1);
+  std::string error;
+  auto none = [](ipq::ArrayRef<ipq::Ip>, ipq::Location*) {};
+  EXPECT_FALSE(enricher.run("/nonexistent/ips.txt", out_path.c_str(), none,
+                            stats, error));
+  EXPECT_FALSE(error.empty());
+  EXPECT_FALSE(enricher.run(in_path.c_str(), "/nonexistent/dir/out.tsv", none,
+                            stats, error));
+}
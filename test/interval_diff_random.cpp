@@ -0,0 +1,125 @@
+#include "interval_diff.hpp"
+#include "interval_tree.hpp"
+
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <random>
+#include <vector>
+
+int NMAX = 200;
+
+std::random_device rd;
+
+using T = uint16_t;
+using Tree = ipq::IntervalTree<T, T, std::map<T, std::pair<T, T>>>;
+using Diff = ipq::IntervalDiff<T, T>;
+const int Keys = std::numeric_limits<T>::max() + 1;
+
+// random ranges of a few values, so that neighbours often share one
+void fillRandom(Tree& tree, std::vector<int>& points) {
+  std::uniform_int_distribution<int> key_dist(0, Keys - 1), len_dist(0, 2000),
+      val_dist(0, 3), op_dist(0, 3);
+  points.assign(Keys, -1);
+  for (int i = 0; i < 100; ++i) {
+    int key1 = key_dist(rd), key2 = std::min(Keys - 1, key1 + len_dist(rd));
+    if (i % 10 == 0) {
+      key2 = Keys - 1;
+    }
+    if (!op_dist(rd)) {
+      tree.remove(key1, key2);
+      std::fill(points.begin() + key1, points.begin() + key2 + 1, -1);
+    } else {
+      T val = val_dist(rd);
+      tree.update(key1, key2, val);
+      std::fill(points.begin() + key1, points.begin() + key2 + 1, val);
+    }
+  }
+}
+
+TEST(IntervalDiff, AppliedEditGivesNewRanges) {
+  for (int i = 0; i < NMAX; ++i) {
+    Tree old_tree, new_tree;
+    std::vector<int> old_points, new_points;
+    fillRandom(old_tree, old_points);
+    fillRandom(new_tree, new_points);
+    if (i % 4 == 0) {
+      new_tree = old_tree;
+      new_points = old_points;
+      new_tree.update(100, 200, 9);
+      std::fill(new_points.begin() + 100, new_points.begin() + 201, 9);
+    }
+    struct Op {
+      int start, end, val;
+      bool added;
+    };
+    std::vector<Op> ops;
+    auto stats = Diff::diff(
+        old_tree.keys.begin(), old_tree.keys.end(), new_tree.keys.begin(),
+        new_tree.keys.end(),
+        [&](T start, T end, T val, bool added) {
+          ops.push_back({start, end, val, added});
+        },
+        [&](T start, T end) { ops.push_back({start, end, -1, false}); });
+
+    size_t added = 0, changed = 0, removed = 0;
+    std::vector<bool> touched(Keys, false);
+    for (size_t j = 0; j < ops.size(); ++j) {
+      auto& op = ops[j];
+      ASSERT_LE(op.start, op.end);
+      if (j) {
+        // in order, and neighbours with the same effect are joined
+        ASSERT_LT(ops[j - 1].end, op.start);
+        EXPECT_FALSE(ops[j - 1].end + 1 == op.start &&
+                     ops[j - 1].val == op.val);
+      }
+      bool all_empty = true;
+      for (int key = op.start; key <= op.end; ++key) {
+        // only points that differ are touched
+        EXPECT_NE(old_points[key], new_points[key]);
+        EXPECT_EQ(new_points[key], op.val);
+        all_empty = all_empty && old_points[key] < 0;
+        touched[key] = true;
+      }
+      if (op.val < 0) {
+        ++removed;
+        old_tree.remove(op.start, op.end);
+      } else {
+        EXPECT_EQ(op.added, all_empty);
+        ++(op.added ? added : changed);
+        old_tree.update(op.start, op.end, op.val);
+      }
+    }
+    EXPECT_EQ(stats.added, added);
+    EXPECT_EQ(stats.changed, changed);
+    EXPECT_EQ(stats.removed, removed);
+    for (int key = 0; key < Keys; ++key) {
+      EXPECT_EQ(touched[key], old_points[key] != new_points[key]);
+      T* val = old_tree.find(key);
+      ASSERT_EQ(val != nullptr, new_points[key] >= 0) << key;
+      if (val) {
+        EXPECT_EQ(*val, new_points[key]);
+      }
+    }
+  }
+}
+
+TEST(IntervalDiff, SplitRangesAreNotChanges) {
+  Tree old_tree, new_tree;
+  old_tree.update(0, 99, 1);
+  new_tree.update(0, 49, 1);
+  new_tree.update(50, 99, 1);
+  int ops = 0;
+  auto stats = Diff::diff(
+      old_tree.keys.begin(), old_tree.keys.end(), new_tree.keys.begin(),
+      new_tree.keys.end(), [&](T, T, T, bool) { ++ops; },
+      [&](T, T) { ++ops; });
+  EXPECT_EQ(ops, 0);
+  EXPECT_EQ(stats.added + stats.changed + stats.removed, 0u);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,130 @@
+#include "btree_map.hpp"
+#include "interval_tree.hpp"
+
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <random>
+#include <tuple>
+#include <vector>
+
+int NMAX = 2000;
+
+std::random_device rd;
+
+using T = uint16_t;
+using Range = std::tuple<T, T, T>;
+
+template <typename IntTree>
+std::vector<Range> collect(IntTree& tree, T key1, T key2) {
+  std::vector<Range> ret;
+  tree.for_each_overlapping(key1, key2, [&](T start, T end, T val) {
+    ret.emplace_back(start, end, val);
+  });
+  return ret;
+}
+
+template <typename IntTree>
+std::vector<Range> collectIter(IntTree& tree, T key1, T key2) {
+  std::vector<Range> ret;
+  for (auto& range : tree.overlapping(key1, key2)) {
+    ret.emplace_back(range.first, range.second.first, range.second.second);
+  }
+  return ret;
+}
+
+/* brute force: ranges are maximal runs of the same stored value, so compare
+ * by covering every point of [key1, key2] instead
+ */
+void expectCovers(const std::vector<Range>& ranges,
+                  const std::vector<int>& points, T key1, T key2) {
+  size_t idx = 0;
+  for (int key = key1; key <= key2; ++key) {
+    while (idx < ranges.size() && std::get<1>(ranges[idx]) < key) {
+      ++idx;
+    }
+    if (points[key] < 0) {
+      EXPECT_TRUE(idx == ranges.size() || std::get<0>(ranges[idx]) > key);
+    } else {
+      ASSERT_LT(idx, ranges.size());
+      EXPECT_LE(std::get<0>(ranges[idx]), key);
+      EXPECT_EQ(std::get<2>(ranges[idx]), points[key]);
+    }
+  }
+  for (size_t i = 1; i < ranges.size(); ++i) {
+    EXPECT_LT(std::get<1>(ranges[i - 1]), std::get<0>(ranges[i]));
+  }
+  if (!ranges.empty()) {
+    EXPECT_LE(std::get<0>(ranges.front()), key2);
+    EXPECT_GE(std::get<1>(ranges.back()), key1);
+  }
+}
+
+TEST(IntervalOperations, ForEachOverlapping) {
+  std::vector<int> points(std::numeric_limits<T>::max() + 1, -1);
+  ipq::IntervalTree<T, T, std::map<T, std::pair<T, T>>> stl_int_tree;
+  ipq::IntervalTree<T, T, ipq::BTreeMap<T, std::pair<T, T>>> btree_int_tree;
+  std::uniform_int_distribution<int> op_dist(1, 10);
+  std::uniform_int_distribution<T> value_dist(
+      std::numeric_limits<T>::min(), std::numeric_limits<T>::max() - T(1));
+  auto random_range = [&]() {
+    T key1 = value_dist(rd), key2 = value_dist(rd);
+    if (key1 > key2) {
+      std::swap(key1, key2);
+    }
+    return std::make_pair(key1, key2);
+  };
+  for (int i = 0; i < NMAX; ++i) {
+    int op = op_dist(rd);
+    auto [key1, key2] = random_range();
+    switch (op) {
+      case 1:
+      case 2:
+      case 3:
+      case 4: {
+        auto res1 = collect(stl_int_tree, key1, key2);
+        auto res2 = collect(btree_int_tree, key1, key2);
+        auto res3 = collectIter(stl_int_tree, key1, key2);
+        auto res4 = collectIter(btree_int_tree, key1, key2);
+        EXPECT_EQ(res1, res2);
+        EXPECT_EQ(res1, res3);
+        EXPECT_EQ(res1, res4);
+        expectCovers(res1, points, key1, key2);
+      } break;
+      case 5: {
+        for (int key = key1; key <= key2; ++key) {
+          points[key] = -1;
+        }
+        stl_int_tree.remove(key1, key2);
+        btree_int_tree.remove(key1, key2);
+      } break;
+      default: {
+        T val = value_dist(rd);
+        for (int key = key1; key <= key2; ++key) {
+          points[key] = val;
+        }
+        stl_int_tree.update(key1, key2, val);
+        btree_int_tree.update(key1, key2, val);
+      }
+    }
+  }
+}
+
+TEST(IntervalOperations, OverlappingSinglePoint) {
+  ipq::IntervalTree<T, T, std::map<T, std::pair<T, T>>> int_tree;
+  int_tree.update(10, 20, 1);
+  int_tree.update(30, 40, 2);
+  EXPECT_TRUE(collect(int_tree, 0, 9).empty());
+  EXPECT_TRUE(collect(int_tree, 21, 29).empty());
+  EXPECT_EQ(collect(int_tree, 20, 20), std::vector<Range>{Range(10, 20, 1)});
+  EXPECT_EQ(collect(int_tree, 15, 35),
+            (std::vector<Range>{Range(10, 20, 1), Range(30, 40, 2)}));
+  EXPECT_EQ(collectIter(int_tree, 40, 50),
+            std::vector<Range>{Range(30, 40, 2)});
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
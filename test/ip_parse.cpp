@@ -0,0 +1,210 @@
+#include "ip.hpp"
+
+#include "gtest/gtest.h"
+#include <arpa/inet.h>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+// what inet_pton makes of str, the reference for the parsers
+bool referenceIp(const std::string& str, ipq::Ip& ip) {
+  in_addr addr;
+  if (inet_pton(AF_INET, str.c_str(), &addr) != 1) {
+    return false;
+  }
+  ip = ntohl(addr.s_addr);
+  return true;
+}
+
+bool referenceIp6(const std::string& str, ipq::Ip6& ip) {
+  in6_addr addr;
+  if (inet_pton(AF_INET6, str.c_str(), &addr) != 1) {
+    return false;
+  }
+  std::memcpy(ip.data(), &addr, 16);
+  return true;
+}
+
+// strings made of the characters of alphabet, mostly near valid addresses
+std::vector<std::string> randomStrings(const std::string& alphabet,
+                                       size_t max_size, size_t count) {
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<size_t> size_dist(0, max_size);
+  std::uniform_int_distribution<size_t> char_dist(0, alphabet.size() - 1);
+  std::vector<std::string> strings;
+  for (size_t i = 0; i < count; ++i) {
+    std::string str(size_dist(gen), ' ');
+    for (char& c : str) {
+      c = alphabet[char_dist(gen)];
+    }
+    strings.push_back(str);
+  }
+  return strings;
+}
+
+TEST(ParseIp, DottedQuad) {
+  ipq::Ip ip = 0;
+  EXPECT_TRUE(ipq::parseIp("1.2.3.4", ip));
+  EXPECT_EQ(ip, 0x01020304u);
+  EXPECT_TRUE(ipq::parseIp("255.255.255.255", ip));
+  EXPECT_EQ(ip, 0xffffffffu);
+  EXPECT_TRUE(ipq::parseIp("0.0.0.0", ip));
+  EXPECT_EQ(ip, 0u);
+  EXPECT_TRUE(ipq::parseIp("10.100.200.9", ip));
+  EXPECT_EQ(ip, 0x0a64c809u);
+  ip = 42;
+  for (const char* bad :
+       {"", "1.2.3", "1.2.3.4.", ".1.2.3.4", "1..2.3", "256.0.0.1",
+        "1.2.3.1000", "01.2.3.4", "1.2.3.00", "1.2.3.4x", " 1.2.3.4",
+        "1.2.3.-4", "1.2.3.4\n", "1111.2.3.4", "1.2.3.4.5.6.7.8"}) {
+    EXPECT_FALSE(ipq::parseIp(bad, ip)) << bad;
+  }
+  // a failed parse leaves the address alone
+  EXPECT_EQ(ip, 42u);
+}
+
+TEST(ParseIp, Decimal) {
+  ipq::Ip ip;
+  EXPECT_TRUE(ipq::parseIp("0", ip));
+  EXPECT_EQ(ip, 0u);
+  EXPECT_TRUE(ipq::parseIp("4294967295", ip));
+  EXPECT_EQ(ip, 0xffffffffu);
+  EXPECT_TRUE(ipq::parseIp("0000000150", ip));
+  EXPECT_EQ(ip, 150u);
+  for (const char* bad : {"4294967296", "99999999999", "-1", "+1", "12a", "1e9"}) {
+    EXPECT_FALSE(ipq::parseIp(bad, ip)) << bad;
+  }
+}
+
+TEST(ParseIp, MappedIpv6) {
+  ipq::Ip ip;
+  EXPECT_TRUE(ipq::parseIp("::ffff:1.2.3.4", ip));
+  EXPECT_EQ(ip, 0x01020304u);
+  EXPECT_TRUE(ipq::parseIp("0:0:0:0:0:FFFF:0a0b:0c0d", ip));
+  EXPECT_EQ(ip, 0x0a0b0c0du);
+  EXPECT_FALSE(ipq::parseIp("::1", ip));
+  EXPECT_FALSE(ipq::parseIp("2001:db8::1", ip));
+  EXPECT_FALSE(ipq::parseIp("::1.2.3.4", ip));
+}
+
+TEST(ParseIp, DottedQuadLikeInetPton) {
+  auto strings = randomStrings("0123456789..", 16, 200000);
+  // every valid address, written out
+  std::mt19937 gen(3);
+  for (int i = 0; i < 20000; ++i) {
+    ipq::Ip ip = gen() >> (gen() % 32);
+    strings.push_back(std::to_string(ip >> 24) + '.' +
+                      std::to_string(ip >> 16 & 255) + '.' +
+                      std::to_string(ip >> 8 & 255) + '.' +
+                      std::to_string(ip & 255));
+  }
+  for (auto& str : strings) {
+    ipq::Ip expected = 0, scalar = 0, ip = 0;
+    bool valid = referenceIp(str, expected);
+    ASSERT_EQ(ipq::internal::parseDottedQuadScalar(str, scalar), valid) << str;
+    ASSERT_EQ(ipq::internal::parseDottedQuad(str, ip), valid) << str;
+    if (valid) {
+      ASSERT_EQ(scalar, expected) << str;
+      ASSERT_EQ(ip, expected) << str;
+    }
+  }
+}
+
+TEST(AppendIp, RoundTrip) {
+  std::string text = "ip ";
+  ipq::appendIp(text, 0x0a00ff09);
+  EXPECT_EQ(text, "ip 10.0.255.9");
+  std::mt19937 gen(1);
+  for (int i = 0; i < 100000; ++i) {
+    ipq::Ip ip = gen() >> (gen() % 32), parsed;
+    text.clear();
+    ipq::appendIp(text, ip);
+    ASSERT_TRUE(referenceIp(text, parsed)) << text;
+    ASSERT_EQ(parsed, ip);
+  }
+}
+
+TEST(ParseIp6, Forms) {
+  ipq::Ip6 ip;
+  ASSERT_TRUE(ipq::parseIp6("2001:db8::ff00:42:8329", ip));
+  ipq::Ip6 expected = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0,
+                       0,    0,    0xff, 0,    0, 0x42, 0x83, 0x29};
+  EXPECT_EQ(ip, expected);
+  ASSERT_TRUE(ipq::parseIp6("::", ip));
+  EXPECT_EQ(ip, ipq::Ip6());
+  ASSERT_TRUE(ipq::parseIp6("1::", ip));
+  EXPECT_EQ(ip[1], 1);
+  ASSERT_TRUE(ipq::parseIp6("::ffff:192.168.0.1", ip));
+  EXPECT_EQ(ip[10], 0xff);
+  EXPECT_EQ(ip[12], 192);
+  EXPECT_EQ(ip[15], 1);
+  for (const char* bad :
+       {"", ":", ":::", "1:2:3:4:5:6:7", "1:2:3:4:5:6:7:8:9", "1::2::3",
+        "12345::", "1:2:3:4:5:6:7:8::", "1:", ":1::", "::g", "::1.2.3",
+        "1:2:3:4:5:6:7:1.2.3.4", "::01.2.3.4", "::1.2.3.4:5"}) {
+    EXPECT_FALSE(ipq::parseIp6(bad, ip)) << bad;
+  }
+}
+
+TEST(ParseIp6, LikeInetPton) {
+  auto strings = randomStrings("0123456789abcDEF::::.", 40, 300000);
+  for (auto& str : randomStrings("0f:", 24, 100000)) {
+    strings.push_back(str);
+  }
+  for (auto& str : strings) {
+    ipq::Ip6 expected{}, ip{};
+    bool valid = referenceIp6(str, expected);
+    ASSERT_EQ(ipq::parseIp6(str, ip), valid) << str;
+    if (valid) {
+      ASSERT_EQ(ip, expected) << str;
+    }
+  }
+}
+
+TEST(ParseIpLines, Buffer) {
+  std::string text =
+      "1.2.3.4\n"
+      "255.255.255.255\r\n"
+      "\n"
+      "150\n"
+      "not an address, and a line longer than a vector\n"
+      "::ffff:10.0.0.1\n"
+      "01.2.3.4\n"
+      "10.20.30.40";
+  std::vector<ipq::Ip> ips;
+  std::vector<uint8_t> valid;
+  ASSERT_EQ(ipq::parseIpLines(text, ips, valid), 8u);
+  std::vector<ipq::Ip> expected_ips = {0x01020304, 0xffffffff, 0, 150,
+                                       0,          0x0a000001, 0, 0x0a141e28};
+  std::vector<uint8_t> expected_valid = {1, 1, 0, 1, 0, 1, 0, 1};
+  EXPECT_EQ(ips, expected_ips);
+  EXPECT_EQ(valid, expected_valid);
+  ips.clear();
+  valid.clear();
+  EXPECT_EQ(ipq::parseIpLines("", ips, valid), 0u);
+  EXPECT_EQ(ipq::parseIpLines("7\n", ips, valid), 1u);
+  EXPECT_EQ(ips.back(), 7u);
+}
+
+TEST(ParseIpLines, LikeParseIp) {
+  // lines of every kind, at every offset from the end of the buffer
+  auto lines = randomStrings("0123456789....:f\r", 18, 50000);
+  std::string text;
+  for (auto& line : lines) {
+    text += line + '\n';
+  }
+  std::vector<ipq::Ip> ips;
+  std::vector<uint8_t> valid;
+  ASSERT_EQ(ipq::parseIpLines(text, ips, valid), lines.size());
+  for (size_t i = 0; i < lines.size(); ++i) {
+    std::string_view line = lines[i];
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    ipq::Ip ip = 0;
+    bool ok = ipq::parseIp(line, ip);
+    ASSERT_EQ(valid[i], ok) << lines[i];
+    ASSERT_EQ(ips[i], ok ? ip : 0) << lines[i];
+  }
+}
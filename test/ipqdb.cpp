@@ -0,0 +1,235 @@
+#include "frozen_interval_map.hpp"
+#include "interval_tree.hpp"
+#include "ipqdb.hpp"
+#include "location_names.hpp"
+
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+
+int NMAX = 20000;
+
+std::random_device rd;
+
+using Tree = ipq::IntervalTree<uint32_t, uint32_t,
+                               std::map<uint32_t, std::pair<uint32_t, uint32_t>>>;
+using Range = std::tuple<uint32_t, uint32_t, uint32_t>;
+
+/* random ranges, most of them packed in a few /16s so that lookups hit both
+ * crowded and empty prefixes, a few spread over the whole key space
+ */
+void fillRandom(Tree& tree) {
+  std::uniform_int_distribution<uint32_t> key_dist;
+  std::uniform_int_distribution<uint32_t> len_dist(0, 300);
+  std::uniform_int_distribution<int> op_dist(1, 10);
+  for (int i = 0; i < NMAX; ++i) {
+    uint32_t key1 = key_dist(rd);
+    if (op_dist(rd) > 1) {
+      key1 = (key1 % 4) << 16 | (key1 & 0x3ffff);
+    }
+    uint32_t key2 = key1 + std::min(len_dist(rd), UINT32_MAX - key1);
+    if (op_dist(rd) == 1) {
+      tree.remove(key1, key2);
+    } else {
+      tree.update(key1, key2, key_dist(rd) % 1000);
+    }
+  }
+  tree.update(UINT32_MAX - 5, UINT32_MAX, 7);
+}
+
+void freeze(const Tree& tree, ipq::FrozenIntervalMap& map) {
+  map.build(tree.keys.size(), [&](auto emit) {
+    for (auto& range : tree.keys) {
+      emit(range.first, range.second.first, range.second.second);
+    }
+  });
+}
+
+TEST(FrozenIntervalMap, FindMatchesIntervalTree) {
+  Tree tree;
+  fillRandom(tree);
+  ipq::FrozenIntervalMap map;
+  freeze(tree, map);
+  ASSERT_EQ(map.size(), tree.keys.size());
+  std::vector<uint32_t> keys{0, UINT32_MAX};
+  std::uniform_int_distribution<uint32_t> key_dist;
+  for (auto& range : tree.keys) {
+    for (uint32_t key : {range.first, range.second.first}) {
+      keys.push_back(key);
+      keys.push_back(key - 1);
+      keys.push_back(key + 1);
+    }
+  }
+  for (int i = 0; i < NMAX; ++i) {
+    keys.push_back(key_dist(rd) & 0x3ffff);
+    keys.push_back(key_dist(rd));
+  }
+  for (uint32_t key : keys) {
+    const uint32_t* expected = tree.find(key);
+    const uint32_t* found = map.find(key);
+    ASSERT_EQ(expected == nullptr, found == nullptr) << key;
+    if (expected) {
+      EXPECT_EQ(*expected, *found) << key;
+    }
+  }
+}
+
+TEST(FrozenIntervalMap, OverlappingMatchesIntervalTree) {
+  Tree tree;
+  fillRandom(tree);
+  ipq::FrozenIntervalMap map;
+  freeze(tree, map);
+  std::uniform_int_distribution<uint32_t> key_dist(0, 0x4ffff);
+  for (int i = 0; i < NMAX / 10; ++i) {
+    uint32_t key1 = key_dist(rd), key2 = key_dist(rd);
+    if (key1 > key2) {
+      std::swap(key1, key2);
+    }
+    std::vector<Range> expected, found;
+    tree.for_each_overlapping(key1, key2,
+                              [&](uint32_t start, uint32_t end, uint32_t val) {
+                                expected.emplace_back(start, end, val);
+                              });
+    map.for_each_overlapping(key1, key2,
+                             [&](uint32_t start, uint32_t end, uint32_t val) {
+                               found.emplace_back(start, end, val);
+                             });
+    EXPECT_EQ(expected, found);
+  }
+}
+
+TEST(FrozenIntervalMap, Empty) {
+  ipq::FrozenIntervalMap map;
+  EXPECT_EQ(map.find(1), nullptr);
+  map.build(0, [](auto) {});
+  EXPECT_EQ(map.find(0), nullptr);
+  EXPECT_EQ(map.find(UINT32_MAX), nullptr);
+}
+
+class Ipqdb : public ::testing::Test {
+ protected:
+  ipq::LocationNames names;
+  ipq::IpqdbWriter writer;
+
+  void SetUp() override {
+    writer.add(10, 20, names.location("US", "United States", "Ohio", "Dayton"));
+    writer.add(30, 40, names.location("CN", "China", "Beijing", "Beijing"));
+    writer.add(41, 50, names.location("US", "United States", "Ohio", "Dayton"));
+    writer.add(0x10000, UINT32_MAX, names.location("-", "-", "-", "-"));
+  }
+};
+
+TEST_F(Ipqdb, RoundTrip) {
+  std::vector<char> image = writer.image(names);
+  EXPECT_EQ(image.size() % ipq::ipqdb::PageSize, 0u);
+  ipq::FrozenDb db;
+  std::string error;
+  ASSERT_TRUE(db.attach(image.data(), image.size(), error)) << error;
+  EXPECT_EQ(db.ranges().size(), 4u);
+  EXPECT_EQ(db.locations(), 3u);
+  ipq::LocationNames loaded;
+  db.loadNames(loaded);
+  ipq::Location loc;
+  EXPECT_FALSE(db.find(9, loc));
+  EXPECT_FALSE(db.find(25, loc));
+  ASSERT_TRUE(db.find(45, loc));
+  EXPECT_EQ(loaded.countryCode(loc.getProvinceCode()), "US");
+  EXPECT_EQ(loaded.countryName(loc.getProvinceCode()), "United States");
+  EXPECT_EQ(loaded.province(loc.getCountryCode()), "Ohio");
+  EXPECT_EQ(loaded.cityName(loc.getCountryCode()), "Dayton");
+  ASSERT_TRUE(db.find(UINT32_MAX, loc));
+  EXPECT_EQ(loaded.countryCode(loc.getProvinceCode()), "-");
+  EXPECT_EQ(loaded.countries(), names.countries());
+  EXPECT_EQ(loaded.cities(), names.cities());
+}
+
+TEST_F(Ipqdb, WriteAndOpen) {
+  std::string path = testing::TempDir() + "ipqdb_test.ipqdb";
+  std::string error;
+  ASSERT_TRUE(writer.write(path.c_str(), names, error)) << error;
+  ipq::FrozenDb db;
+  ASSERT_TRUE(db.open(path.c_str(), error)) << error;
+  ipq::Location loc;
+  ASSERT_TRUE(db.find(35, loc));
+  EXPECT_EQ(names.countryCode(loc.getProvinceCode()), "CN");
+  ::unlink(path.c_str());
+  ipq::FrozenDb missing;
+  EXPECT_FALSE(missing.open(path.c_str(), error));
+}
+
+TEST_F(Ipqdb, DetectsCorruption) {
+  std::vector<char> image = writer.image(names);
+  std::string error;
+  {
+    ipq::FrozenDb db;
+    EXPECT_FALSE(db.attach(image.data(), 100, error));
+  }
+  std::uniform_int_distribution<size_t> pos_dist(0, image.size() - 1);
+  auto header_size = offsetof(ipq::ipqdb::Header, checksum) + sizeof(uint64_t);
+  for (int i = 0; i < 100; ++i) {
+    std::vector<char> corrupted = image;
+    size_t pos = pos_dist(rd);
+    if (i < 20) {
+      pos %= header_size;
+    } else {
+      // only bytes inside sections are covered by their checksums, the
+      // padding to the next page is not
+      auto& sections = reinterpret_cast<ipq::ipqdb::Header*>(image.data())->sections;
+      auto& section = sections[pos % ipq::ipqdb::SectionCount];
+      if (!section.size) {
+        continue;
+      }
+      pos = section.offset + pos % section.size;
+    }
+    corrupted[pos] ^= 1 << (i % 8);
+    ipq::FrozenDb db;
+    EXPECT_FALSE(db.attach(corrupted.data(), corrupted.size(), error)) << pos;
+  }
+}
+
+TEST_F(Ipqdb, DetectsOutOfBoundsContents) {
+  std::vector<char> image = writer.image(names);
+  auto header = reinterpret_cast<ipq::ipqdb::Header*>(image.data());
+  // a value of a section, changed with the checksums made to match
+  auto corrupt = [&](ipq::ipqdb::SectionKind kind, size_t index,
+                     uint32_t value) {
+    std::vector<char> corrupted = image;
+    auto h = reinterpret_cast<ipq::ipqdb::Header*>(corrupted.data());
+    auto& section = h->sections[kind];
+    std::memcpy(&corrupted[section.offset + 4 * index], &value, 4);
+    section.checksum =
+        ipq::ipqdb::checksum(&corrupted[section.offset], section.size);
+    h->checksum = ipq::ipqdb::checksum(
+        h, offsetof(ipq::ipqdb::Header, checksum));
+    ipq::FrozenDb db;
+    std::string error;
+    bool ok = db.attach(corrupted.data(), corrupted.size(), error);
+    EXPECT_TRUE(ok || error == "corrupted ipqdb contents") << error;
+    return ok;
+  };
+  using namespace ipq::ipqdb;
+  size_t strings = header->sections[StringOffsets].size / 4 - 1;
+  size_t bytes = header->sections[StringBytes].size;
+  EXPECT_TRUE(corrupt(RangeLocations, 0, 2));
+  EXPECT_FALSE(corrupt(RangeLocations, 0, 3));
+  EXPECT_FALSE(corrupt(Locations, 0, uint32_t(names.countries())));
+  EXPECT_FALSE(corrupt(Locations, 1, uint32_t(names.cities())));
+  EXPECT_FALSE(corrupt(Countries, 1, uint32_t(strings)));
+  EXPECT_FALSE(corrupt(Cities, 0, uint32_t(strings)));
+  EXPECT_TRUE(corrupt(StringOffsets, strings, uint32_t(bytes)));
+  EXPECT_FALSE(corrupt(StringOffsets, strings, uint32_t(bytes + 1)));
+  EXPECT_FALSE(corrupt(StringOffsets, 1, uint32_t(bytes)));
+  EXPECT_FALSE(corrupt(PrefixIndex, 0, 5));
+  EXPECT_FALSE(corrupt(PrefixIndex, 1, 0xffffffff));
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,81 @@
+#include "btree_map.hpp"
+#include "interval_tree.hpp"
+#include "joined_intervals.hpp"
+
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+int NMAX = 300;
+
+std::random_device rd;
+
+using T = uint16_t;
+
+template <typename MapTy>
+void testJoin(size_t datasets) {
+  ipq::JoinedIntervals<T, MapTy> joined(datasets);
+  std::vector<ipq::IntervalTree<T, uint32_t, MapTy>> trees(datasets);
+  std::uniform_int_distribution<size_t> dataset_dist(0, datasets - 1);
+  std::uniform_int_distribution<T> value_dist;
+  std::uniform_int_distribution<uint32_t> payload_dist(0, 5);
+  for (int i = 0; i < NMAX; ++i) {
+    size_t d = dataset_dist(rd);
+    T key1 = value_dist(rd), key2 = value_dist(rd);
+    if (key1 > key2) {
+      std::swap(key1, key2);
+    }
+    uint32_t payload = payload_dist(rd);
+    joined.add(d, key1, key2, payload);
+    trees[d].update(key1, key2, payload);
+  }
+  joined.build();
+  for (int key_ = std::numeric_limits<T>::min();
+       key_ <= std::numeric_limits<T>::max(); ++key_) {
+    T key = key_;
+    const uint32_t* row = joined.find(key);
+    bool covered = false;
+    for (size_t d = 0; d < datasets; ++d) {
+      uint32_t* expected = trees[d].find(key);
+      covered = covered || expected;
+      if (row) {
+        EXPECT_EQ(row[d], expected ? *expected : joined.NoPayload);
+      }
+    }
+    EXPECT_EQ(covered, row != nullptr);
+  }
+  EXPECT_LE(joined.rows(), size_t(7 * 7 * 7));
+}
+
+TEST(JoinedIntervals, StlMap) {
+  testJoin<std::map<T, std::pair<T, uint32_t>>>(3);
+}
+
+TEST(JoinedIntervals, BTreeMap) {
+  testJoin<ipq::BTreeMap<T, std::pair<T, uint32_t>>>(3);
+}
+
+TEST(JoinedIntervals, SingleDataset) {
+  testJoin<std::map<T, std::pair<T, uint32_t>>>(1);
+}
+
+TEST(JoinedIntervals, MergesAdjacentSegments) {
+  ipq::JoinedIntervals<T, std::map<T, std::pair<T, uint32_t>>> joined(2);
+  joined.add(0, 0, 99, 1);
+  joined.add(0, 100, 199, 1);
+  joined.add(1, 0, 199, 2);
+  joined.add(1, 300, std::numeric_limits<T>::max(), 3);
+  joined.build();
+  EXPECT_EQ(joined.size(), 2u);
+  EXPECT_EQ(joined.find(250), nullptr);
+  EXPECT_EQ(joined.find(std::numeric_limits<T>::max())[1], 3u);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,93 @@
+#include "btree_map.hpp"
+#include "interval_tree.hpp"
+#include "location.hpp"
+#include "location_index.hpp"
+
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <random>
+#include <set>
+#include <utility>
+
+int NMAX = 5000;
+
+std::random_device rd;
+
+using T = uint16_t;
+
+template <typename IntTree>
+void expectIndexConsistent(IntTree& tree) {
+  std::map<uint64_t, std::set<T>> expected;
+  std::map<uint64_t, size_t> country_ranges;
+  for (auto& range : tree.keys) {
+    expected[range.second.second.getLoc()].insert(range.first);
+    ++country_ranges[range.second.second.getProvinceCode()];
+  }
+  EXPECT_EQ(tree.listener.size(), expected.size());
+  for (auto& entry : expected) {
+    ipq::Location loc(entry.first);
+    EXPECT_EQ(tree.listener.count(loc), entry.second.size());
+    std::set<T> starts;
+    tree.listener.for_each_range(loc, [&](T start) { starts.insert(start); });
+    EXPECT_EQ(starts, entry.second);
+  }
+  for (auto& entry : country_ranges) {
+    EXPECT_EQ(tree.listener.countCountry(entry.first), entry.second);
+  }
+}
+
+TEST(LocationIndex, FollowsUpdateAndRemove) {
+  ipq::IntervalTree<T, ipq::Location,
+                    std::map<T, std::pair<T, ipq::Location>>,
+                    ipq::LocationIndex<T>>
+      stl_int_tree;
+  ipq::IntervalTree<T, ipq::Location,
+                    ipq::BTreeMap<T, std::pair<T, ipq::Location>>,
+                    ipq::LocationIndex<T>>
+      btree_int_tree;
+  stl_int_tree.listener.enable();
+  btree_int_tree.listener.enable();
+  std::uniform_int_distribution<int> op_dist(1, 10);
+  std::uniform_int_distribution<int> code_dist(0, 7);
+  std::uniform_int_distribution<T> value_dist(
+      std::numeric_limits<T>::min(), std::numeric_limits<T>::max() - T(1));
+  for (int i = 0; i < NMAX; ++i) {
+    T key1 = value_dist(rd), key2 = value_dist(rd);
+    if (key1 > key2) {
+      std::swap(key1, key2);
+    }
+    int op = op_dist(rd);
+    if (op == 1) {
+      expectIndexConsistent(stl_int_tree);
+      expectIndexConsistent(btree_int_tree);
+    } else if (op <= 4) {
+      stl_int_tree.remove(key1, key2);
+      btree_int_tree.remove(key1, key2);
+    } else {
+      ipq::Location loc(code_dist(rd), code_dist(rd));
+      stl_int_tree.update(key1, key2, loc);
+      btree_int_tree.update(key1, key2, loc);
+    }
+  }
+  expectIndexConsistent(stl_int_tree);
+  expectIndexConsistent(btree_int_tree);
+}
+
+TEST(LocationIndex, DisabledIndexIsEmpty) {
+  ipq::IntervalTree<T, ipq::Location,
+                    std::map<T, std::pair<T, ipq::Location>>,
+                    ipq::LocationIndex<T>>
+      int_tree;
+  int_tree.update(1, 10, ipq::Location(1, 1));
+  int_tree.remove(3, 4);
+  EXPECT_FALSE(int_tree.listener.enabled());
+  EXPECT_EQ(int_tree.listener.size(), 0u);
+  EXPECT_EQ(int_tree.listener.countCountry(1), 0u);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
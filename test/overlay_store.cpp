@@ -0,0 +1,107 @@
+#include "overlay_store.hpp"
+
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <map>
+#include <random>
+#include <vector>
+
+int NMAX = 20000;
+
+std::random_device rd;
+
+using Reference =
+    ipq::IntervalTree<ipq::Ip, ipq::Location,
+                      std::map<ipq::Ip, std::pair<ipq::Ip, ipq::Location>>>;
+
+// ranges near both ends of the ip space
+ipq::Ip randomIp(std::mt19937& gen) {
+  std::uniform_int_distribution<ipq::Ip> dist(0, 1 << 17);
+  ipq::Ip ip = dist(gen);
+  return ip & 1 ? ip >> 1 : UINT32_MAX - (ip >> 1);
+}
+
+void expectSame(ipq::OverlayStore& store, Reference& reference,
+                std::mt19937& gen) {
+  for (int j = 0; j < 20; ++j) {
+    ipq::Ip ip = randomIp(gen);
+    ipq::Location* expected = reference.find(ip);
+    ASSERT_TRUE(store.query(ip) == (expected ? *expected : ipq::Location()))
+        << ip;
+    // a range holds only ips of the same answer, a gap is the largest one
+    ipq::IpRange range;
+    ipq::Location loc = store.queryRange(ip, range);
+    ASSERT_TRUE(loc == (expected ? *expected : ipq::Location())) << ip;
+    ASSERT_LE(range.start, ip);
+    ASSERT_GE(range.end, ip);
+    for (ipq::Ip bound : {range.start, range.end}) {
+      ipq::Location* found = reference.find(bound);
+      ASSERT_TRUE(loc == (found ? *found : ipq::Location())) << bound;
+    }
+    if (!expected) {
+      ipq::Ip start, end;
+      reference.find_range(ip, start, end);
+      ASSERT_EQ(range.start, start);
+      ASSERT_EQ(range.end, end);
+    }
+  }
+}
+
+TEST(OverlayStore, SameAsIntervalTree) {
+  std::mt19937 gen(rd());
+  std::uniform_int_distribution<ipq::Ip> len_dist(0, 2000);
+  std::uniform_int_distribution<int> loc_dist(0, 5), op_dist(0, 4);
+  ipq::OverlayStore store(100);
+  Reference reference;
+  size_t compactions = 0;
+  for (int i = 0; i < NMAX; ++i) {
+    ipq::Ip start = randomIp(gen);
+    ipq::Ip end = start + std::min(len_dist(gen), UINT32_MAX - start);
+    if (op_dist(gen)) {
+      ipq::Location loc(loc_dist(gen), loc_dist(gen));
+      reference.update(start, end, loc);
+      store.updateBlocking(start, end, loc);
+    } else {
+      reference.remove(start, end);
+      store.batchUpdateBlocking({{start, end, std::nullopt}});
+    }
+    compactions += store.compacting();
+    if (i % 1000 == 0) {
+      // lookups in the fresh delta, the sealed one and the snapshot
+      store.waitCompaction();
+    }
+    expectSame(store, reference, gen);
+  }
+  // a running compaction first, then one of the remaining delta
+  store.waitCompaction();
+  store.compact();
+  store.waitCompaction();
+  EXPECT_EQ(store.deltaSize(), 0u);
+  EXPECT_GT(compactions, 0u);
+  expectSame(store, reference, gen);
+}
+
+TEST(OverlayStore, TombstonesHideSnapshot) {
+  ipq::OverlayStore store;
+  store.updateBlocking(0, UINT32_MAX, ipq::Location(1, 1));
+  store.compact();
+  store.waitCompaction();
+  EXPECT_EQ(store.snapshotSize(), 1u);
+  store.batchUpdateBlocking({{10, 20, std::nullopt}, {UINT32_MAX, UINT32_MAX,
+                                                       std::nullopt}});
+  EXPECT_TRUE(store.query(15) == ipq::Location());
+  EXPECT_TRUE(store.query(UINT32_MAX) == ipq::Location());
+  EXPECT_TRUE(store.query(21) == ipq::Location(1, 1));
+  store.compact();
+  store.waitCompaction();
+  // the tombstones are dropped once folded into the snapshot
+  EXPECT_EQ(store.snapshotSize(), 2u);
+  EXPECT_TRUE(store.query(9) == ipq::Location(1, 1));
+  EXPECT_TRUE(store.query(15) == ipq::Location());
+  EXPECT_TRUE(store.query(UINT32_MAX - 1) == ipq::Location(1, 1));
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,260 @@
+#include "frozen_interval_map.hpp"
+#include "interval_tree.hpp"
+#include "range_cache.hpp"
+#include "rcu_store.hpp"
+
+#include "gtest/gtest.h"
+#include <atomic>
+#include <functional>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+
+using Tree = ipq::IntervalTree<
+    ipq::Ip, ipq::Location,
+    std::map<ipq::Ip, std::pair<ipq::Ip, ipq::Location>>>;
+
+// a tree lookup for the cache, counting the lookups
+struct TreeLookup {
+  Tree& tree;
+  size_t lookups = 0;
+
+  ipq::Location operator()(ipq::Ip ip, ipq::IpRange& range) {
+    ++lookups;
+    ipq::Location* loc = tree.find_range(ip, range.start, range.end);
+    return loc ? *loc : ipq::Location();
+  }
+};
+
+TEST(FindRange, TreeAndFrozenMapGiveRangesAndGaps) {
+  std::mt19937 gen(11);
+  Tree tree;
+  for (int i = 0; i < 300; ++i) {
+    ipq::Ip start = gen() % 1000000, end = start + gen() % 3000;
+    tree.update(start, end, ipq::Location(i, 0));
+  }
+  tree.update(UINT32_MAX - 10, UINT32_MAX, ipq::Location(7, 7));
+  ipq::FrozenIntervalMap frozen;
+  std::vector<ipq::Location> locations;
+  frozen.build(tree.size(), [&](auto emit) {
+    for (auto& range : tree.keys) {
+      emit(range.first, range.second.first, uint32_t(locations.size()));
+      locations.push_back(range.second.second);
+    }
+  });
+  std::vector<ipq::Ip> ips = {0, UINT32_MAX, UINT32_MAX - 11, 1000000 + 3000};
+  for (int i = 0; i < 100000; ++i) {
+    ips.push_back(gen() % 1100000);
+  }
+  for (ipq::Ip ip : ips) {
+    ipq::Ip start, end, frozen_start, frozen_end;
+    ipq::Location* loc = tree.find_range(ip, start, end);
+    const uint32_t* id = frozen.findRange(ip, frozen_start, frozen_end);
+    ASSERT_EQ(loc, tree.find(ip));
+    ASSERT_EQ(!loc, !id);
+    if (loc) {
+      ASSERT_TRUE(*loc == locations[*id]);
+    }
+    ASSERT_EQ(start, frozen_start);
+    ASSERT_EQ(end, frozen_end);
+    ASSERT_LE(start, ip);
+    ASSERT_GE(end, ip);
+    if (!loc) {
+      // a gap is as wide as it can be
+      ASSERT_TRUE(start == 0 || tree.find(start - 1));
+      ASSERT_TRUE(end == UINT32_MAX || tree.find(end + 1));
+      size_t overlapping = 0;
+      tree.for_each_overlapping(start, end, [&](auto, auto, auto&) {
+        ++overlapping;
+      });
+      ASSERT_EQ(overlapping, 0u);
+    }
+  }
+}
+
+TEST(RangeCache, HitsWithinRangeAndBlock) {
+  Tree tree;
+  ipq::Location au(1, 1), nz(2, 2);
+  // one range spanning three /24s, one inside a /24
+  tree.update(0x0a000080, 0x0a0200ff, au);
+  tree.update(0x0b000010, 0x0b000020, nz);
+  ipq::RangeCacheEpochs epochs;
+  ipq::RangeCache cache(epochs);
+  TreeLookup lookup{tree};
+  ipq::IpRange range;
+  EXPECT_TRUE(cache.query(0x0a0000c0, range, std::ref(lookup)) == au);
+  EXPECT_EQ(range.start, 0x0a000080u);
+  EXPECT_EQ(range.end, 0x0a0000ffu);
+  EXPECT_EQ(lookup.lookups, 1u);
+  // the range is kept cut to the /24 of the ip looked up
+  EXPECT_TRUE(cache.query(0x0a000080, range, std::ref(lookup)) == au);
+  EXPECT_EQ(range.start, 0x0a000080u);
+  EXPECT_EQ(range.end, 0x0a0000ffu);
+  EXPECT_EQ(lookup.lookups, 1u);
+  EXPECT_TRUE(cache.query(0x0a010005, range, std::ref(lookup)) == au);
+  EXPECT_EQ(lookup.lookups, 2u);
+  // the gap before the range, in the same /24
+  EXPECT_TRUE(cache.query(0x0a000001, range, std::ref(lookup)) ==
+              ipq::Location());
+  EXPECT_EQ(range.start, 0x0a000000u);
+  EXPECT_EQ(range.end, 0x0a00007fu);
+  EXPECT_TRUE(cache.query(0x0a00007f, range, std::ref(lookup)) ==
+              ipq::Location());
+  EXPECT_EQ(lookup.lookups, 3u);
+  EXPECT_TRUE(cache.query(0x0b000015, range, std::ref(lookup)) == nz);
+  EXPECT_TRUE(cache.query(0x0b000021, range, std::ref(lookup)) ==
+              ipq::Location());
+  EXPECT_TRUE(cache.query(0x0b000010, range, std::ref(lookup)) == nz);
+  EXPECT_EQ(lookup.lookups, 5u);
+  const auto& stats = cache.stats();
+  EXPECT_EQ(stats.hits, 3u);
+  EXPECT_EQ(stats.negative_hits, 1u);
+  EXPECT_EQ(stats.misses, 5u);
+  EXPECT_DOUBLE_EQ(stats.hitRate(), 3.0 / 8);
+  cache.resetStats();
+  EXPECT_EQ(cache.stats().hits + cache.stats().misses, 0u);
+}
+
+TEST(RangeCache, InvalidatedByEpochs) {
+  Tree tree;
+  ipq::Location au(1, 1), nz(2, 2);
+  tree.update(100, 200, au);
+  ipq::RangeCacheEpochs epochs;
+  ipq::RangeCache cache(epochs);
+  TreeLookup lookup{tree};
+  ipq::IpRange range;
+  EXPECT_TRUE(cache.query(150, range, std::ref(lookup)) == au);
+  EXPECT_TRUE(cache.query(50, range, std::ref(lookup)) == ipq::Location());
+  tree.update(40, 160, nz);
+  // unchanged epochs serve the stale entries
+  EXPECT_TRUE(cache.query(150, range, std::ref(lookup)) == au);
+  epochs.invalidate(40, 160);
+  EXPECT_TRUE(cache.query(150, range, std::ref(lookup)) == nz);
+  // the new entry of [40, 160] answers for 50, the stale gap is not used
+  EXPECT_TRUE(cache.query(50, range, std::ref(lookup)) == nz);
+  EXPECT_EQ(lookup.lookups, 3u);
+  EXPECT_TRUE(cache.query(20, range, std::ref(lookup)) == ipq::Location());
+  EXPECT_EQ(range.end, 39u);
+  EXPECT_EQ(lookup.lookups, 4u);
+  // an update elsewhere leaves the entries
+  epochs.invalidate(0x10000000, 0x20000000);
+  EXPECT_TRUE(cache.query(60, range, std::ref(lookup)) == nz);
+  EXPECT_TRUE(cache.query(10, range, std::ref(lookup)) == ipq::Location());
+  EXPECT_EQ(lookup.lookups, 4u);
+}
+
+TEST(RangeCache, LikeTreeUnderUpdates) {
+  std::mt19937 gen(5);
+  Tree tree;
+  ipq::RangeCacheEpochs epochs;
+  // a small cache of /20 blocks, so that entries are pushed out
+  ipq::RangeCache cache(epochs, 20, 64);
+  TreeLookup lookup{tree};
+  // skewed queries over a few /16s
+  auto random_ip = [&]() {
+    ipq::Ip ip = (gen() % 4) << 16 | (gen() & 0xffff);
+    return gen() % 4 ? ip & 0x3ffff : ip;
+  };
+  for (int step = 0; step < 2000; ++step) {
+    ipq::Ip start = random_ip(), end = start + gen() % 5000;
+    if (step % 5 == 0) {
+      tree.remove(start, end);
+    } else {
+      tree.update(start, end, ipq::Location(step, 0));
+    }
+    epochs.invalidate(start, end);
+    for (int q = 0; q < 50; ++q) {
+      ipq::Ip ip = random_ip();
+      ipq::IpRange range;
+      ipq::Location* expected = tree.find(ip);
+      ASSERT_TRUE(cache.query(ip, range, std::ref(lookup)) ==
+                  (expected ? *expected : ipq::Location()));
+      ASSERT_LE(range.start, ip);
+      ASSERT_GE(range.end, ip);
+    }
+  }
+  EXPECT_GT(cache.stats().hits, 0u);
+  EXPECT_LT(lookup.lookups, 2000u * 50);
+}
+
+TEST(RangeCache, BatchQueryOverRcuStore) {
+  ipq::RcuStore store;
+  ipq::RangeCacheEpochs epochs;
+  auto reader = store.reader();
+  ASSERT_TRUE(reader);
+  ipq::RangeCache cache(epochs);
+  std::mt19937 gen(3);
+  std::vector<ipq::Ip> ips(256);
+  std::vector<ipq::Location> locs(ips.size());
+  std::vector<ipq::IpRange> ranges(ips.size());
+  for (int step = 1; step <= 300; ++step) {
+    ipq::Ip start = gen() % 200000, end = start + gen() % 2000;
+    store.updateBlocking(start, end, ipq::Location(step, 0));
+    epochs.invalidate(start, end);
+    for (auto& ip : ips) {
+      ip = gen() % 210000;
+    }
+    size_t looked_up = 0;
+    cache.query(ips, locs.data(), ranges.data(),
+                [&](ipq::ArrayRef<ipq::Ip> misses, ipq::Location* out,
+                    ipq::IpRange* miss_ranges) {
+                  looked_up += misses.size();
+                  reader->query(misses, out, miss_ranges);
+                });
+    ASSERT_LE(looked_up, ips.size());
+    for (size_t i = 0; i < ips.size(); ++i) {
+      ASSERT_TRUE(locs[i] == store.query(ips[i]));
+      ASSERT_LE(ranges[i].start, ips[i]);
+      ASSERT_GE(ranges[i].end, ips[i]);
+    }
+  }
+  EXPECT_GT(cache.stats().hits, 0u);
+}
+
+TEST(RangeCache, ReadersSeeUpdatesOnceInvalidated) {
+  ipq::RcuStore store;
+  ipq::RangeCacheEpochs epochs;
+  const ipq::Ip Space = 1 << 20;
+  store.updateBlocking(0, Space - 1, ipq::Location(0, 0));
+  std::atomic<bool> done{false};
+  std::atomic<int> failures{0};
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 3; ++r) {
+    readers.emplace_back([&, r]() {
+      auto reader = store.reader();
+      ipq::RangeCache cache(epochs, 24, 256);
+      std::mt19937 gen(r);
+      auto lookup = [&](ipq::Ip ip, ipq::IpRange& range) {
+        ipq::Location loc;
+        reader->query(ipq::ArrayRef<ipq::Ip>(&ip, 1), &loc, &range);
+        return loc;
+      };
+      ipq::IpRange range;
+      while (!done) {
+        cache.query(gen() % Space, range, lookup);
+      }
+      // every ip now answers with the last version
+      for (ipq::Ip ip = 0; ip < Space; ip += 997) {
+        failures += !(cache.query(ip, range, lookup) == store.query(ip));
+      }
+    });
+  }
+  std::mt19937 gen(9);
+  for (int step = 1; step <= 1000; ++step) {
+    ipq::Ip start = gen() % Space;
+    ipq::Ip end = std::min<ipq::Ip>(Space - 1, start + gen() % 4000);
+    store.updateBlocking(start, end, ipq::Location(step, 0));
+    epochs.invalidate(start, end);
+  }
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  EXPECT_EQ(failures, 0);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
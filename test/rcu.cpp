@@ -0,0 +1,203 @@
+#include "rcu.hpp"
+#include "rcu_store.hpp"
+
+#include "gtest/gtest.h"
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+
+std::random_device rd;
+
+const int Readers = 4;
+
+// a version whose elements all hold its number, counting live versions
+struct Version {
+  static std::atomic<int> live;
+  std::vector<uint64_t> values;
+  explicit Version(uint64_t number) : values(64, number) { ++live; }
+  ~Version() {
+    // a reader still looking at it would see the change
+    std::fill(values.begin(), values.end(), UINT64_MAX);
+    --live;
+  }
+};
+std::atomic<int> Version::live{0};
+
+TEST(RcuCell, ReadersSeeWholeVersions) {
+  {
+    ipq::RcuCell<Version> cell(std::make_unique<const Version>(0));
+    std::atomic<bool> done{false};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < Readers; ++r) {
+      readers.emplace_back([&]() {
+        auto reader = cell.reader();
+        ASSERT_TRUE(reader);
+        uint64_t last = 0;
+        while (!done) {
+          auto version = reader->read();
+          uint64_t number = version->values.front();
+          // versions are seen in publication order, and never freed early
+          ASSERT_GE(number, last);
+          for (uint64_t value : version->values) {
+            ASSERT_EQ(value, number);
+          }
+          last = number;
+        }
+      });
+    }
+    const uint64_t versions = 20000;
+    for (uint64_t v = 1; v <= versions; ++v) {
+      cell.publish(std::make_unique<const Version>(v));
+    }
+    done = true;
+    for (auto& reader : readers) {
+      reader.join();
+    }
+    cell.synchronize();
+    EXPECT_EQ(Version::live, 1);
+    EXPECT_EQ(cell.get()->values.front(), versions);
+  }
+  EXPECT_EQ(Version::live, 0);
+}
+
+TEST(RcuCell, ReaderSlots) {
+  ipq::RcuCell<Version, 2> cell(std::make_unique<const Version>(0));
+  auto first = cell.reader();
+  {
+    auto second = cell.reader();
+    ASSERT_TRUE(first && second);
+    EXPECT_FALSE(cell.reader());
+  }
+  // a slot is free again once its reader is gone
+  EXPECT_TRUE(cell.reader());
+  {
+    auto version = first->read();
+    cell.publish(std::make_unique<const Version>(1));
+    // the old version is kept while it is read
+    EXPECT_EQ(cell.reclaim(), 1u);
+    EXPECT_EQ(version->values.front(), 0u);
+  }
+  EXPECT_EQ(cell.reclaim(), 0u);
+}
+
+TEST(RcuStore, ConcurrentReaders) {
+  using Reference = ipq::IntervalTree<
+      ipq::Ip, ipq::Location,
+      std::map<ipq::Ip, std::pair<ipq::Ip, ipq::Location>>>;
+  ipq::RcuStore store(64);
+  Reference reference;
+  store.updateBlocking(0, (1 << 16) - 1, ipq::Location(0, 0));
+  reference.update(0, (1 << 16) - 1, ipq::Location(0, 0));
+  std::atomic<bool> done{false};
+  // the writer only raises the locations of [0, 2^16), in every point
+  std::vector<std::thread> readers;
+  for (int r = 0; r < Readers; ++r) {
+    readers.emplace_back([&]() {
+      auto reader = store.reader();
+      ASSERT_TRUE(reader);
+      std::mt19937 gen(rd());
+      std::uniform_int_distribution<ipq::Ip> ip_dist(0, (1 << 16) - 1);
+      std::vector<uint64_t> seen(1 << 16, 0);
+      std::vector<ipq::Ip> ips(8);
+      std::vector<ipq::Location> locs(ips.size());
+      while (!done) {
+        for (auto& ip : ips) {
+          ip = ip_dist(gen);
+        }
+        reader->query(ips, locs.data());
+        for (size_t i = 0; i < ips.size(); ++i) {
+          ASSERT_FALSE(locs[i] == ipq::Location());
+          uint64_t level = locs[i].getProvinceCode();
+          ASSERT_GE(level, seen[ips[i]]);
+          seen[ips[i]] = level;
+        }
+      }
+    });
+  }
+  std::mt19937 gen(rd());
+  std::uniform_int_distribution<ipq::Ip> ip_dist(0, (1 << 16) - 1);
+  for (uint64_t level = 1; level <= 3000; ++level) {
+    ipq::Ip start = ip_dist(gen);
+    ipq::Ip end = std::min<ipq::Ip>(start + ip_dist(gen) % 500, (1 << 16) - 1);
+    if (level % 10 == 0) {
+      // a whole new level at once, as one batch of many ranges
+      std::vector<ipq::IpRangeUpdate> batch;
+      for (ipq::Ip ip = 0; ip < (1 << 16); ip += 1024) {
+        batch.push_back({ip, ip + 1023, ipq::Location(level, 0)});
+        reference.update(ip, ip + 1023, ipq::Location(level, 0));
+      }
+      store.batchUpdateBlocking(batch);
+    } else {
+      // a point's location is raised unless it is above level already
+      std::vector<std::tuple<ipq::Ip, ipq::Ip, ipq::Location>> raised;
+      reference.for_each_overlapping(
+          start, end, [&](ipq::Ip s, ipq::Ip e, ipq::Location& loc) {
+            if (loc.getProvinceCode() < level) {
+              raised.emplace_back(std::max(s, start), std::min(e, end),
+                                  ipq::Location(level, 0));
+            }
+          });
+      for (auto& range : raised) {
+        reference.update(std::get<0>(range), std::get<1>(range),
+                         std::get<2>(range));
+        store.updateBlocking(std::get<0>(range), std::get<1>(range),
+                             std::get<2>(range));
+      }
+    }
+  }
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  for (ipq::Ip ip = 0; ip < (1 << 16) + 10; ++ip) {
+    ipq::Location* expected = reference.find(ip);
+    ASSERT_TRUE(store.query(ip) == (expected ? *expected : ipq::Location()));
+  }
+}
+
+TEST(RcuStore, RangeBounds) {
+  using Reference = ipq::IntervalTree<
+      ipq::Ip, ipq::Location,
+      std::map<ipq::Ip, std::pair<ipq::Ip, ipq::Location>>>;
+  // a new location for every update, so that the ranges of the reference are
+  // the largest ranges of one location
+  ipq::RcuStore store(50);
+  Reference reference;
+  auto reader = store.reader();
+  ASSERT_TRUE(reader);
+  std::mt19937 gen(rd());
+  std::uniform_int_distribution<ipq::Ip> ip_dist(0, 20000), len_dist(0, 800);
+  std::vector<ipq::Ip> ips(64);
+  std::vector<ipq::Location> locs(ips.size());
+  std::vector<ipq::IpRange> ranges(ips.size());
+  for (uint64_t level = 1; level <= 2000; ++level) {
+    ipq::Ip start = ip_dist(gen), end = start + len_dist(gen);
+    if (level % 7 == 0) {
+      reference.remove(start, end);
+      store.batchUpdateBlocking({ipq::IpRangeUpdate{start, end, std::nullopt}});
+    } else {
+      reference.update(start, end, ipq::Location(level, 0));
+      store.updateBlocking(start, end, ipq::Location(level, 0));
+    }
+    for (auto& ip : ips) {
+      ip = ip_dist(gen);
+    }
+    reader->query(ips, locs.data(), ranges.data());
+    for (size_t i = 0; i < ips.size(); ++i) {
+      // the range of ip, or the gap around it
+      ipq::Ip start, end;
+      ipq::Location* loc = reference.find_range(ips[i], start, end);
+      ASSERT_TRUE(locs[i] == (loc ? *loc : ipq::Location()));
+      ASSERT_EQ(ranges[i].start, start);
+      ASSERT_EQ(ranges[i].end, end);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
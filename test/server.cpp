@@ -0,0 +1,343 @@
+#include "line_protocol.hpp"
+#include "server.hpp"
+#include "storage_engines.hpp"
+#include "uring.hpp"
+#include "uring_server.hpp"
+
+#include "gtest/gtest.h"
+#include <arpa/inet.h>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+// a blocking client connection
+class Client {
+  int fd_ = -1;
+  std::string buffered_;
+
+ public:
+  explicit Client(uint16_t port) {
+    fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    EXPECT_EQ(::connect(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)),
+              0);
+  }
+  explicit Client(const std::string& path) {
+    fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    EXPECT_EQ(::connect(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)),
+              0);
+  }
+  ~Client() { ::close(fd_); }
+
+  void send(const std::string& data) {
+    for (size_t sent = 0; sent < data.size();) {
+      ssize_t n = ::send(fd_, data.data() + sent, data.size() - sent,
+                         MSG_NOSIGNAL);
+      ASSERT_GT(n, 0);
+      sent += n;
+    }
+  }
+
+  void shutdownWrite() { ::shutdown(fd_, SHUT_WR); }
+
+  // the next line without its newline, false at the end of the stream
+  bool readLine(std::string& line) {
+    size_t eol;
+    while ((eol = buffered_.find('\n')) == buffered_.npos) {
+      char buf[4096];
+      ssize_t n = ::recv(fd_, buf, sizeof(buf), 0);
+      if (n <= 0) {
+        return false;
+      }
+      buffered_.append(buf, n);
+    }
+    line = buffered_.substr(0, eol);
+    buffered_.erase(0, eol + 1);
+    return true;
+  }
+
+  std::string readLine() {
+    std::string line;
+    EXPECT_TRUE(readLine(line));
+    return line;
+  }
+};
+
+// answers every line with the line in upper case, closes on "bye"
+size_t upper(std::string_view in, std::string& out) {
+  size_t consumed = 0, eol;
+  while ((eol = in.find('\n', consumed)) != in.npos) {
+    std::string_view line = in.substr(consumed, eol - consumed);
+    consumed = eol + 1;
+    if (line == "bye") {
+      return ipq::Server::Close;
+    }
+    for (char c : line) {
+      out += char(std::toupper(c));
+    }
+    out += '\n';
+  }
+  return consumed;
+}
+
+ipq::Server::HandlerFactoryTy upperFactory() {
+  return [](unsigned) { return ipq::Server::HandlerTy(upper); };
+}
+
+// every test runs on the epoll server and the io_uring one
+template <typename ServerTy>
+class ServerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    if (std::is_same<ServerTy, ipq::UringServer>::value) {
+      ipq::Uring ring;
+      std::string error;
+      if (!ring.init(8, 8, error)) {
+        GTEST_SKIP() << error;
+      }
+    }
+  }
+};
+
+using ServerTypes = ::testing::Types<ipq::Server, ipq::UringServer>;
+TYPED_TEST_SUITE(ServerTest, ServerTypes);
+
+TYPED_TEST(ServerTest, PipelinedAndSplitRequests) {
+  TypeParam server;
+  std::string error;
+  ASSERT_TRUE(server.start("tcp:127.0.0.1:0", 2, upperFactory(), error))
+      << error;
+  ASSERT_NE(server.port(), 0);
+  Client client(server.port());
+  client.send("ab");
+  client.send("c\nde");
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  client.send("f\nx\ny\n");
+  EXPECT_EQ(client.readLine(), "ABC");
+  EXPECT_EQ(client.readLine(), "DEF");
+  EXPECT_EQ(client.readLine(), "X");
+  EXPECT_EQ(client.readLine(), "Y");
+  // the responses before the close are sent, nothing after it
+  client.send("z\nbye\nw\n");
+  EXPECT_EQ(client.readLine(), "Z");
+  std::string line;
+  EXPECT_FALSE(client.readLine(line));
+}
+
+TYPED_TEST(ServerTest, ShutdownByClient) {
+  TypeParam server;
+  std::string error;
+  ASSERT_TRUE(server.start("tcp::0", 1, upperFactory(), error)) << error;
+  Client client(server.port());
+  client.send("a\nb\nincomplete");
+  client.shutdownWrite();
+  EXPECT_EQ(client.readLine(), "A");
+  EXPECT_EQ(client.readLine(), "B");
+  std::string line;
+  EXPECT_FALSE(client.readLine(line));
+}
+
+TYPED_TEST(ServerTest, ManyConnections) {
+  TypeParam server;
+  std::string error;
+  ASSERT_TRUE(server.start("tcp:127.0.0.1:0", 4, upperFactory(), error))
+      << error;
+  std::vector<std::thread> clients;
+  for (int c = 0; c < 16; ++c) {
+    clients.emplace_back([&server, c]() {
+      Client client(server.port());
+      std::string requests;
+      for (int i = 0; i < 1000; ++i) {
+        requests += "c" + std::to_string(c) + "r" + std::to_string(i) + "\n";
+      }
+      client.send(requests);
+      for (int i = 0; i < 1000; ++i) {
+        ASSERT_EQ(client.readLine(),
+                  "C" + std::to_string(c) + "R" + std::to_string(i));
+      }
+    });
+  }
+  for (auto& client : clients) {
+    client.join();
+  }
+}
+
+TYPED_TEST(ServerTest, SlowReader) {
+  TypeParam server;
+  std::string error;
+  ASSERT_TRUE(server.start("tcp:127.0.0.1:0", 1, upperFactory(), error))
+      << error;
+  Client client(server.port());
+  // far more output than the socket buffers and the pending output limit
+  const int lines = 400000;
+  std::string line(63, 'x');
+  std::thread writer([&]() {
+    std::string requests;
+    for (int i = 0; i < lines; ++i) {
+      requests += line + "\n";
+    }
+    client.send(requests);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  std::string expected(63, 'X'), got;
+  for (int i = 0; i < lines; ++i) {
+    ASSERT_TRUE(client.readLine(got));
+    ASSERT_EQ(got, expected);
+  }
+  writer.join();
+}
+
+TYPED_TEST(ServerTest, InvalidEndpoint) {
+  TypeParam server;
+  std::string error;
+  EXPECT_FALSE(server.start("udp:1.2.3.4:5", 1, upperFactory(), error));
+  EXPECT_FALSE(error.empty());
+  EXPECT_FALSE(server.start("tcp:127.0.0.1:x", 1, upperFactory(), error));
+  EXPECT_FALSE(server.start("tcp:8080", 1, upperFactory(), error));
+  EXPECT_FALSE(server.start("unix:/nonexistent/dir/sock", 1, upperFactory(),
+                            error));
+  auto none = [](unsigned) { return ipq::Server::HandlerTy(); };
+  EXPECT_FALSE(server.start("tcp:127.0.0.1:0", 1, none, error));
+}
+
+TEST(LineProtocol, ParseCommand) {
+  using Kind = ipq::Command::Kind;
+  auto cmd = ipq::Command::parse("query 1.2.3.4");
+  EXPECT_EQ(cmd.kind, Kind::Query);
+  EXPECT_EQ(cmd.ip1, 0x01020304u);
+  cmd = ipq::Command::parse(" update\t10 20 AU Australia Queensland Brisbane\r");
+  EXPECT_EQ(cmd.kind, Kind::Update);
+  EXPECT_EQ(cmd.ip1, 10u);
+  EXPECT_EQ(cmd.ip2, 20u);
+  EXPECT_EQ(cmd.city, "Brisbane");
+  EXPECT_EQ(ipq::Command::parse("delete 0.0.0.0 4294967295").kind,
+            Kind::Delete);
+  EXPECT_EQ(ipq::Command::parse("  ").kind, Kind::Empty);
+  EXPECT_EQ(ipq::Command::parse("quit").kind, Kind::Quit);
+  cmd = ipq::Command::parse("query ::ffff:1.2.3.4");
+  EXPECT_EQ(cmd.kind, Kind::Query);
+  EXPECT_EQ(cmd.ip1, 0x01020304u);
+  cmd = ipq::Command::parse("query 2001:db8::1");
+  EXPECT_EQ(cmd.kind, Kind::Invalid);
+  EXPECT_STREQ(cmd.error, "ipv6 address not supported");
+  cmd = ipq::Command::parse("range 10.0.0.1");
+  EXPECT_EQ(cmd.kind, Kind::Range);
+  EXPECT_EQ(cmd.ip1, 0x0a000001u);
+  for (const char* bad :
+       {"query", "range", "range 1 2", "query 1.2.3", "query 1.2.3.4.5", "query 256.0.0.1",
+        "query 4294967296", "query 1.2.3.4x", "query -1", "delete 5 4",
+        "update 1 2 AU", "select 1", "query 1 2 3 4 5 6 7 8", "query 01.2.3.4",
+        "overlap 1 2", "flush"}) {
+    EXPECT_EQ(ipq::Command::parse(bad).kind, Kind::Invalid) << bad;
+  }
+}
+
+TYPED_TEST(ServerTest, LineProtocolOverUnixSocket) {
+  ipq::LocationNames names;
+  ipq::ServingState state(names);
+  state.engine->updateBlocking(
+      100, 200, names.location("AU", "Australia", "QLD", "Brisbane"));
+  std::string path = "/tmp/ipq_server_test_" + std::to_string(::getpid());
+  TypeParam server;
+  std::string error;
+  ASSERT_TRUE(server.start("unix:" + path, 3, ipq::lineProtocol(state), error))
+      << error;
+  Client client(path), other(path);
+  client.send("query 150\nquery 0.0.0.99\nquery bad\n\nfrobnicate\n");
+  EXPECT_EQ(client.readLine(), "AU\tAustralia\tQLD\tBrisbane");
+  EXPECT_EQ(client.readLine(), "not found");
+  EXPECT_EQ(client.readLine(), "error: invalid ip");
+  EXPECT_EQ(client.readLine(),
+            "error: unknown command or wrong number of arguments");
+  // an update is seen by the queries after it, on every connection
+  client.send(
+      "update 50 120 NZ NewZealand Auckland Auckland\nquery 110\n"
+      "delete 180 300\nquery 190\nquery 150\n");
+  EXPECT_EQ(client.readLine(), "ok");
+  EXPECT_EQ(client.readLine(), "NZ\tNewZealand\tAuckland\tAuckland");
+  EXPECT_EQ(client.readLine(), "ok");
+  EXPECT_EQ(client.readLine(), "not found");
+  EXPECT_EQ(client.readLine(), "AU\tAustralia\tQLD\tBrisbane");
+  other.send("query 60\nquit\n");
+  EXPECT_EQ(other.readLine(), "NZ\tNewZealand\tAuckland\tAuckland");
+  std::string line;
+  EXPECT_FALSE(other.readLine(line));
+  // a line longer than any request closes the connection
+  client.send(std::string(8192, 'q'));
+  EXPECT_EQ(client.readLine(), "error: line too long");
+  EXPECT_FALSE(client.readLine(line));
+  server.stop();
+  EXPECT_NE(::access(path.c_str(), F_OK), 0);
+}
+
+TYPED_TEST(ServerTest, LineProtocolRangesThroughCache) {
+  ipq::LocationNames names;
+  ipq::ServingState state(names);
+  state.cache_prefix = 24;
+  state.engine->updateBlocking(
+      100, 200, names.location("AU", "Australia", "QLD", "Brisbane"));
+  TypeParam server;
+  std::string error;
+  ASSERT_TRUE(server.start("tcp:127.0.0.1:0", 1, ipq::lineProtocol(state),
+                           error))
+      << error;
+  Client client(server.port());
+  client.send("range 150\nquery 150\nquery 160\nrange 99\nrange 201\n");
+  EXPECT_EQ(client.readLine(), "0.0.0.100\t0.0.0.200\tAU\tAustralia\tQLD\tBrisbane");
+  EXPECT_EQ(client.readLine(), "AU\tAustralia\tQLD\tBrisbane");
+  EXPECT_EQ(client.readLine(), "AU\tAustralia\tQLD\tBrisbane");
+  EXPECT_EQ(client.readLine(), "0.0.0.0\t0.0.0.99\tnot found");
+  // the largest gap, beyond the block the cache keeps
+  EXPECT_EQ(client.readLine(), "0.0.0.201\t255.255.255.255\tnot found");
+  client.send("query 170\n");
+  EXPECT_EQ(client.readLine(), "AU\tAustralia\tQLD\tBrisbane");
+  // the cached ranges are dropped by the update
+  client.send("update 50 120 NZ NewZealand Auckland Auckland\nquery 110\n"
+              "range 150\nquery 20\n");
+  EXPECT_EQ(client.readLine(), "ok");
+  EXPECT_EQ(client.readLine(), "NZ\tNewZealand\tAuckland\tAuckland");
+  EXPECT_EQ(client.readLine(), "0.0.0.121\t0.0.0.200\tAU\tAustralia\tQLD\tBrisbane");
+  EXPECT_EQ(client.readLine(), "not found");
+  server.stop();
+  // the loop added its cache stats when it ended
+  EXPECT_GT(state.cache_stats.hits, 0u);
+  EXPECT_GT(state.cache_stats.misses, 0u);
+}
+
+TYPED_TEST(ServerTest, LineProtocolOverLockedEngine) {
+  // stl has no readers, the loops query it one at a time
+  ipq::LocationNames names;
+  ipq::ServingState state(names, ipq::StorageEngines::instance().create("stl"));
+  ASSERT_FALSE(state.engine->hasReaders());
+  state.engine->updateBlocking(
+      100, 200, names.location("AU", "Australia", "QLD", "Brisbane"));
+  TypeParam server;
+  std::string error;
+  ASSERT_TRUE(server.start("tcp:127.0.0.1:0", 2, ipq::lineProtocol(state),
+                           error))
+      << error;
+  Client client(server.port()), other(server.port());
+  client.send("query 150\nrange 99\n");
+  EXPECT_EQ(client.readLine(), "AU\tAustralia\tQLD\tBrisbane");
+  EXPECT_EQ(client.readLine(), "0.0.0.0\t0.0.0.99\tnot found");
+  client.send("update 50 120 NZ NewZealand Auckland Auckland\n");
+  EXPECT_EQ(client.readLine(), "ok");
+  other.send("query 60\nquery 150\n");
+  EXPECT_EQ(other.readLine(), "NZ\tNewZealand\tAuckland\tAuckland");
+  EXPECT_EQ(other.readLine(), "AU\tAustralia\tQLD\tBrisbane");
+  server.stop();
+}
@@ -0,0 +1,104 @@
+#include "sharded_store.hpp"
+#include "spsc_queue.hpp"
+
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+
+int NMAX = 3000;
+
+std::random_device rd;
+
+using Reference =
+    ipq::IntervalTree<ipq::Ip, ipq::Location,
+                      std::map<ipq::Ip, std::pair<ipq::Ip, ipq::Location>>>;
+
+TEST(SpscQueue, InOrder) {
+  ipq::SpscQueue<uint64_t> queue(5);
+  const uint64_t items = 1000000;
+  std::thread producer([&]() {
+    for (uint64_t i = 0; i < items; ++i) {
+      while (!queue.push(i)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+  uint64_t item, expected = 0;
+  while (expected < items) {
+    if (queue.pop(item)) {
+      ASSERT_EQ(item, expected++);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  EXPECT_TRUE(queue.empty());
+  EXPECT_FALSE(queue.pop(item));
+}
+
+// ranges around the shard boundaries of up to 16 shards
+ipq::Ip randomIp(std::mt19937& gen) {
+  std::uniform_int_distribution<ipq::Ip> shard_dist(0, 16), offset_dist(0, 5000);
+  uint64_t boundary = uint64_t(shard_dist(gen)) << 28;
+  int64_t ip = int64_t(boundary) + offset_dist(gen) - 2500;
+  return ipq::Ip(std::min<int64_t>(std::max<int64_t>(ip, 0), UINT32_MAX));
+}
+
+TEST(ShardedStore, SameAsIntervalTree) {
+  for (int shard_bits : {0, 1, 3, 4}) {
+    SCOPED_TRACE(shard_bits);
+    std::mt19937 gen(rd());
+    std::uniform_int_distribution<ipq::Ip> len_dist(0, 3000);
+    std::uniform_int_distribution<int> loc_dist(0, 5), op_dist(0, 4);
+    ipq::ShardedStore store(shard_bits);
+    EXPECT_EQ(store.shards(), 1u << shard_bits);
+    Reference reference;
+    for (int i = 0; i < NMAX; ++i) {
+      std::vector<ipq::IpRangeUpdate> batch;
+      for (int j = i % 10 ? 1 : 20; j > 0; --j) {
+        ipq::Ip start = randomIp(gen);
+        ipq::Ip end = start + std::min(len_dist(gen), UINT32_MAX - start);
+        if (op_dist(gen)) {
+          batch.push_back({start, end, ipq::Location(loc_dist(gen), 0)});
+        } else {
+          batch.push_back({start, end, std::nullopt});
+        }
+      }
+      reference.batch_update(batch);
+      store.batchUpdateBlocking(batch);
+      std::vector<ipq::Ip> ips(50);
+      for (auto& ip : ips) {
+        ip = randomIp(gen);
+      }
+      std::vector<ipq::Location> locs(ips.size());
+      store.queryBatch(ips, locs.data());
+      for (size_t j = 0; j < ips.size(); ++j) {
+        ipq::Location* expected = reference.find(ips[j]);
+        ASSERT_TRUE(locs[j] == (expected ? *expected : ipq::Location()));
+      }
+      ipq::Location* expected = reference.find(ips[0]);
+      ASSERT_TRUE(store.query(ips[0]) ==
+                  (expected ? *expected : ipq::Location()));
+    }
+  }
+}
+
+TEST(ShardedStore, UpdateAcrossAllShards) {
+  ipq::ShardedStore store(4);
+  store.updateBlocking(0, UINT32_MAX, ipq::Location(1, 1));
+  store.batchUpdateBlocking({{(1u << 28) - 1, 3u << 28, std::nullopt}});
+  EXPECT_TRUE(store.query(0) == ipq::Location(1, 1));
+  EXPECT_TRUE(store.query((1u << 28) - 2) == ipq::Location(1, 1));
+  EXPECT_TRUE(store.query((1u << 28) - 1) == ipq::Location());
+  EXPECT_TRUE(store.query(2u << 28) == ipq::Location());
+  EXPECT_TRUE(store.query((3u << 28) + 1) == ipq::Location(1, 1));
+  EXPECT_TRUE(store.query(UINT32_MAX) == ipq::Location(1, 1));
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,209 @@
+#include "ip.hpp"
+#include "ipqdb.hpp"
+#include "location_names.hpp"
+#include "shared_db.hpp"
+
+#include "gtest/gtest.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+class SharedDbTest : public ::testing::Test {
+ protected:
+  ipq::LocationNames names;
+  ipq::Location au, nz;
+  std::string name;
+  ipq::SharedDbPublisher publisher;
+
+  void SetUp() override {
+    au = names.location("AU", "Australia", "QLD", "Brisbane");
+    nz = names.location("NZ", "New Zealand", "AKL", "Auckland");
+    name = "ipq_shared_db_test_" + std::to_string(::getpid());
+  }
+
+  void TearDown() override { publisher.unpublish(); }
+
+  // AU for [100, 200], loc for [1000, 2000]
+  std::vector<char> image(const ipq::Location& loc) {
+    ipq::IpqdbWriter writer;
+    writer.add(100, 200, au);
+    writer.add(1000, 2000, loc);
+    return writer.image(names);
+  }
+
+  void publish(const ipq::Location& loc) {
+    std::vector<char> data = image(loc);
+    std::string error;
+    ASSERT_TRUE(publisher.publish(std::string_view(data.data(), data.size()),
+                                  error))
+        << error;
+  }
+
+  static bool exists(const std::string& path) {
+    int fd = shm_open(path.c_str(), O_RDONLY, 0);
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    return fd >= 0;
+  }
+
+  static ipq::Location find(const ipq::SharedDb& db, ipq::Ip ip) {
+    ipq::FrozenDb frozen;
+    std::string error;
+    EXPECT_TRUE(frozen.attach(db.image().data(), db.image().size(), error,
+                              false))
+        << error;
+    ipq::Location loc;
+    return frozen.find(ip, loc) ? loc : ipq::Location();
+  }
+};
+
+TEST_F(SharedDbTest, PublishAndAttach) {
+  std::string error;
+  ASSERT_TRUE(publisher.open(name, error)) << error;
+  ipq::SharedDb db;
+  // nothing published yet
+  EXPECT_FALSE(db.attach(name, error));
+  publish(nz);
+  ASSERT_TRUE(db.attach(name, error)) << error;
+  EXPECT_EQ(db.generation(), 1u);
+  EXPECT_FALSE(db.changed());
+  EXPECT_TRUE(find(db, 150) == au);
+  EXPECT_TRUE(find(db, 1500) == nz);
+  EXPECT_TRUE(find(db, 500) == ipq::Location());
+  // the names come with the image
+  ipq::FrozenDb frozen;
+  ASSERT_TRUE(frozen.attach(db.image().data(), db.image().size(), error));
+  ipq::LocationNames loaded;
+  frozen.loadNames(loaded);
+  EXPECT_EQ(loaded.countryName(nz.getProvinceCode()), "New Zealand");
+  // the image is sealed, not even its owner can change it
+  int fd = ::open(publisher.imagePath().c_str(), O_RDWR);
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ(::pwrite(fd, "x", 1, 0), -1);
+  EXPECT_EQ(errno, EPERM);
+  EXPECT_EQ(::ftruncate(fd, 1 << 20), -1);
+  EXPECT_EQ(::mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0),
+            MAP_FAILED);
+  ::close(fd);
+}
+
+TEST_F(SharedDbTest, GenerationSwap) {
+  std::string error;
+  ASSERT_TRUE(publisher.open(name, error)) << error;
+  publish(nz);
+  ipq::SharedDb db;
+  ASSERT_TRUE(db.attach(name, error)) << error;
+  std::string_view old_image = db.image();
+  std::string old_path = publisher.imagePath();
+  publish(au);
+  EXPECT_EQ(publisher.generation(), 2u);
+  EXPECT_TRUE(db.changed());
+  // the previous image is closed by the loader but stays mapped until
+  // refresh
+  EXPECT_NE(publisher.imagePath(), old_path);
+  EXPECT_TRUE(find(db, 1500) == nz);
+  EXPECT_EQ(db.image().data(), old_image.data());
+  ASSERT_TRUE(db.refresh(error)) << error;
+  EXPECT_EQ(db.generation(), 2u);
+  EXPECT_FALSE(db.changed());
+  EXPECT_TRUE(find(db, 1500) == au);
+  // a new loader goes on from the generation published
+  ipq::SharedDbPublisher next;
+  ASSERT_TRUE(next.open(name, error)) << error;
+  EXPECT_EQ(next.generation(), 2u);
+  publisher.unpublish();
+  EXPECT_FALSE(exists("/" + name));
+  // the worker keeps its mapping
+  EXPECT_TRUE(find(db, 150) == au);
+}
+
+TEST_F(SharedDbTest, WorkerProcessFollowsGenerations) {
+  std::string error;
+  ASSERT_TRUE(publisher.open(name, error)) << error;
+  publish(nz);
+  int to_worker[2], to_loader[2];
+  ASSERT_EQ(::pipe(to_worker), 0);
+  ASSERT_EQ(::pipe(to_loader), 0);
+  pid_t pid = ::fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    // the worker answers 1500 before and after the loader's swap
+    ipq::SharedDb db;
+    char answer[2] = {'x', 'x'}, go;
+    if (db.attach(name, error)) {
+      answer[0] = find(db, 1500) == nz ? 'n' : '?';
+    }
+    if (::write(to_loader[1], answer, 1) != 1 ||
+        ::read(to_worker[0], &go, 1) != 1) {
+      ::_exit(2);
+    }
+    if (db.changed() && db.refresh(error)) {
+      answer[1] = find(db, 1500) == au ? 'a' : '?';
+    }
+    ::_exit(::write(to_loader[1], answer + 1, 1) == 1 ? 0 : 2);
+  }
+  char answer[2] = {0, 0};
+  EXPECT_EQ(::read(to_loader[0], answer, 1), 1);
+  publish(au);
+  EXPECT_EQ(::write(to_worker[1], "g", 1), 1);
+  EXPECT_EQ(::read(to_loader[0], answer + 1, 1), 1);
+  int status;
+  ASSERT_EQ(::waitpid(pid, &status, 0), pid);
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  EXPECT_EQ(answer[0], 'n');
+  EXPECT_EQ(answer[1], 'a');
+  for (int fd : {to_worker[0], to_worker[1], to_loader[0], to_loader[1]}) {
+    ::close(fd);
+  }
+}
+
+TEST_F(SharedDbTest, UnsealedImageRefused) {
+  // a control segment naming an image that could still change
+  std::string path = "/" + name;
+  int control_fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  ASSERT_GE(control_fd, 0);
+  ASSERT_EQ(::ftruncate(control_fd, sizeof(ipq::shareddb::Control)), 0);
+  auto control = static_cast<ipq::shareddb::Control*>(
+      ::mmap(nullptr, sizeof(ipq::shareddb::Control), PROT_READ | PROT_WRITE,
+             MAP_SHARED, control_fd, 0));
+  ASSERT_NE(control, MAP_FAILED);
+  ::close(control_fd);
+  std::vector<char> data = image(nz);
+  int fd = memfd_create("unsealed", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(::write(fd, data.data(), data.size()), ssize_t(data.size()));
+  ipq::SharedDb db;
+  std::string error;
+  // a control segment not set up yet is not a foreign one
+  EXPECT_FALSE(db.attach(name, error));
+  EXPECT_NE(error.find("nothing published"), std::string::npos) << error;
+  std::memcpy(control->magic, ipq::shareddb::Magic, 8);
+  control->version = ipq::shareddb::Version;
+  control->generation = 1;
+  control->size = data.size();
+  control->pid = ::getpid();
+  control->fd = fd;
+  EXPECT_FALSE(db.attach(name, error));
+  EXPECT_NE(error.find("not sealed"), std::string::npos) << error;
+  ASSERT_EQ(::fcntl(fd, F_ADD_SEALS, ipq::shareddb::Seals), 0);
+  EXPECT_TRUE(db.attach(name, error)) << error;
+  EXPECT_TRUE(find(db, 1500) == nz);
+  ::munmap(control, sizeof(ipq::shareddb::Control));
+  ::close(fd);
+  shm_unlink(path.c_str());
+}
+
+TEST_F(SharedDbTest, MissingOrInvalidName) {
+  ipq::SharedDb db;
+  std::string error;
+  EXPECT_FALSE(db.attach(name, error));
+  EXPECT_FALSE(error.empty());
+  EXPECT_FALSE(db.attach("a/b", error));
+  EXPECT_FALSE(publisher.open("", error));
+}
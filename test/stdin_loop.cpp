@@ -0,0 +1,81 @@
+#include "gtest/gtest.h"
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+// the path of btree_ipq, set by the build
+#ifndef IPQ_BINARY
+#error IPQ_BINARY must be defined
+#endif
+
+class StdinLoopTest : public ::testing::Test {
+ protected:
+  std::string csv_path, in_path;
+
+  void SetUp() override {
+    std::string prefix =
+        "/tmp/ipq_stdin_loop_test_" + std::to_string(::getpid());
+    csv_path = prefix + ".csv";
+    in_path = prefix + ".txt";
+    std::ofstream(csv_path, std::ios::binary)
+        << "\"100\",\"119\",\"AU\",\"Australia\",\"QLD\",\"Brisbane\"\n"
+           "\"120\",\"199\",\"CN\",\"China\",\"Beijing\",\"Beijing\"\n"
+           "\"200\",\"299\",\"US\",\"United States\",\"CA\",\"Los Angeles\"\n";
+  }
+
+  void TearDown() override {
+    ::unlink(csv_path.c_str());
+    ::unlink(in_path.c_str());
+  }
+
+  // what ipq prints for the commands in input, with its exit status
+  std::string run(const std::string& input, int& status) {
+    std::ofstream(in_path, std::ios::binary) << input;
+    std::string command =
+        std::string(IPQ_BINARY) + ' ' + csv_path + " < " + in_path;
+    FILE* pipe = ::popen(command.c_str(), "r");
+    EXPECT_NE(pipe, nullptr);
+    std::string output;
+    char buffer[4096];
+    size_t n;
+    while (pipe && (n = std::fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+      output.append(buffer, n);
+    }
+    status = pipe ? ::pclose(pipe) : -1;
+    return output;
+  }
+};
+
+constexpr const char* Loaded = "ip location informations read: 3\n";
+constexpr const char* Unchanged =
+    "0.0.0.100 0.0.0.119 country code: AU province: QLD city: Brisbane\n"
+    "0.0.0.120 0.0.0.199 country code: CN province: Beijing city: Beijing\n"
+    "0.0.0.200 0.0.1.43 country code: US province: CA city: Los Angeles\n"
+    "ranges found: 3\n";
+
+TEST_F(StdinLoopTest, InvertedRangesLeaveTheTreeUnchanged) {
+  int status;
+  std::string output = run(
+      "update 150 120 DE Germany Berlin Berlin\n"
+      "delete 250 210\n"
+      "overlap 150 120\n"
+      "batch 2\n"
+      "update 150 120 DE Germany Berlin Berlin\n"
+      "delete 250 210\n"
+      "overlap 0 1000\n",
+      status);
+  EXPECT_EQ(status, 0);
+  std::string inverted = "range start is greater than range end\n";
+  EXPECT_EQ(output, Loaded + inverted + inverted + inverted + inverted +
+                        inverted + "updates applied: 0\n" + Unchanged);
+}
+
+TEST_F(StdinLoopTest, InvalidBatchCount) {
+  int status;
+  std::string output =
+      run("batch abc\nbatch 99999999999\noverlap 0 1000\n", status);
+  EXPECT_EQ(status, 0);
+  EXPECT_EQ(output, std::string(Loaded) + "invalid count: abc\n" +
+                        "invalid count: 99999999999\n" + Unchanged);
+}
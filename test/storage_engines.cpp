@@ -0,0 +1,153 @@
+#include "storage_engines.hpp"
+
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <random>
+#include <vector>
+
+int NMAX = 2000;
+
+std::random_device rd;
+
+// the ranges are kept near both ends of the ip space
+const ipq::Ip Span = 1 << 16;
+
+ipq::Ip randomIp(std::mt19937& gen) {
+  std::uniform_int_distribution<ipq::Ip> dist(0, 2 * Span - 1);
+  ipq::Ip ip = dist(gen);
+  return ip < Span ? ip : UINT32_MAX - (ip - Span);
+}
+
+ipq::IpRangeUpdate randomUpdate(std::mt19937& gen) {
+  std::uniform_int_distribution<ipq::Ip> len_dist(0, 3000);
+  std::uniform_int_distribution<int> loc_dist(0, 5), op_dist(0, 4);
+  ipq::Ip start = randomIp(gen);
+  ipq::Ip end = start + std::min(len_dist(gen), UINT32_MAX - start);
+  if (start < Span) {
+    end = std::min(end, Span - 1);
+  }
+  if (!op_dist(gen)) {
+    return {start, end, std::nullopt};
+  }
+  return {start, end, ipq::Location(loc_dist(gen), loc_dist(gen))};
+}
+
+TEST(StorageEngines, SameAsReference) {
+  auto& engines = ipq::StorageEngines::instance().engines();
+  ASSERT_GE(engines.size(), 3u);
+  for (auto& entry : engines) {
+    SCOPED_TRACE(entry.name);
+    std::mt19937 gen(rd());
+    ipq::StlEngine reference;
+    auto engine = entry.create();
+    ASSERT_TRUE(engine);
+    for (int i = 0; i < NMAX; ++i) {
+      if (i % 50 == 0) {
+        std::vector<ipq::IpRangeUpdate> batch;
+        for (int j = 0; j < 20; ++j) {
+          batch.push_back(randomUpdate(gen));
+        }
+        reference.batch_update(batch);
+        engine->batchUpdateBlocking(batch);
+      } else {
+        auto update = randomUpdate(gen);
+        if (update.val) {
+          reference.update(update.start, update.end, *update.val);
+          engine->updateBlocking(update.start, update.end, *update.val);
+        } else {
+          reference.remove(update.start, update.end);
+          engine->batchUpdateBlocking({update});
+        }
+      }
+      std::vector<ipq::Ip> ips;
+      for (int j = 0; j < 10; ++j) {
+        ips.push_back(randomIp(gen));
+      }
+      std::vector<ipq::Location> locs(ips.size());
+      engine->query(ips, locs.data());
+      for (size_t j = 0; j < ips.size(); ++j) {
+        ipq::Location* expected = reference.find(ips[j]);
+        ipq::Location found = engine->query(ips[j]);
+        ASSERT_TRUE(found == (expected ? *expected : ipq::Location()));
+        ASSERT_TRUE(locs[j] == found);
+      }
+    }
+  }
+}
+
+TEST(StorageEngines, RangeBounds) {
+  // these engines may give smaller ranges and gaps than the largest ones
+  const std::vector<std::string> partial = {"segment", "sharded"};
+  for (auto& entry : ipq::StorageEngines::instance().engines()) {
+    SCOPED_TRACE(entry.name);
+    bool largest = std::find(partial.begin(), partial.end(), entry.name) ==
+                   partial.end();
+    std::mt19937 gen(rd());
+    ipq::StlEngine reference;
+    auto engine = entry.create();
+    for (int i = 0; i < NMAX / 4; ++i) {
+      auto update = randomUpdate(gen);
+      reference.batch_update({update});
+      engine->batchUpdateBlocking({update});
+      std::vector<ipq::Ip> ips;
+      for (int j = 0; j < 10; ++j) {
+        ips.push_back(randomIp(gen));
+      }
+      std::vector<ipq::Location> locs(ips.size());
+      std::vector<ipq::IpRange> ranges(ips.size());
+      engine->query(ips, locs.data(), ranges.data());
+      for (size_t j = 0; j < ips.size(); ++j) {
+        ipq::IpRange range;
+        ipq::Location found = engine->query(ips[j], range);
+        ASSERT_TRUE(locs[j] == found);
+        ASSERT_EQ(ranges[j].start, range.start);
+        ASSERT_EQ(ranges[j].end, range.end);
+        ASSERT_LE(range.start, ips[j]);
+        ASSERT_GE(range.end, ips[j]);
+        // every ip of the range has the answer of ips[j]
+        uint64_t covered = 0;
+        reference.for_each_overlapping(
+            range.start, range.end,
+            [&](ipq::Ip start, ipq::Ip end, ipq::Location& loc) {
+              EXPECT_TRUE(loc == found);
+              covered += uint64_t(std::min(end, range.end)) -
+                         std::max(start, range.start) + 1;
+            });
+        if (found == ipq::Location()) {
+          ASSERT_EQ(covered, 0u);
+          ipq::Ip start, end;
+          reference.find_range(ips[j], start, end);
+          if (largest) {
+            ASSERT_EQ(range.start, start);
+            ASSERT_EQ(range.end, end);
+          }
+        } else {
+          ASSERT_EQ(covered, uint64_t(range.end) - range.start + 1);
+        }
+      }
+    }
+  }
+}
+
+TEST(StorageEngines, Registry) {
+  auto& registry = ipq::StorageEngines::instance();
+  EXPECT_FALSE(registry.create("no such engine"));
+  ASSERT_TRUE(registry.find("segment"));
+  EXPECT_FALSE(registry.add("stl", "", nullptr));
+  EXPECT_TRUE(registry.add("test", "an stl engine under another name", []() {
+    return std::unique_ptr<ipq::DataStorateConcept>(
+        new ipq::DataStorageModel<ipq::StlEngine>());
+  }));
+  auto engine = registry.create("test");
+  ASSERT_TRUE(engine);
+  engine->updateBlocking(5, 10, ipq::Location(1, 1));
+  EXPECT_TRUE(engine->query(7) == ipq::Location(1, 1));
+  EXPECT_TRUE(engine->query(11) == ipq::Location());
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
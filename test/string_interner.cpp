@@ -0,0 +1,72 @@
+#include "location_names.hpp"
+#include "string_interner.hpp"
+
+#include "gtest/gtest.h"
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+
+int NMAX = 100000;
+
+std::random_device rd;
+
+TEST(StringInterner, DenseStableIds) {
+  ipq::StringInterner interner;
+  std::map<std::string, uint32_t> expected;
+  std::uniform_int_distribution<int> value_dist(0, NMAX / 4);
+  EXPECT_EQ(interner.find("x"), interner.NotFound);
+  for (int i = 0; i < NMAX; ++i) {
+    std::string str = "name " + std::to_string(value_dist(rd));
+    auto res = expected.emplace(str, expected.size());
+    EXPECT_EQ(interner.intern(str), res.first->second);
+  }
+  EXPECT_EQ(interner.size(), expected.size());
+  for (auto& entry : expected) {
+    EXPECT_EQ(interner.find(entry.first), entry.second);
+    EXPECT_EQ(interner.get(entry.second), entry.first);
+  }
+  EXPECT_EQ(interner.find("not interned"), interner.NotFound);
+  EXPECT_EQ(interner.intern(""), expected.size());
+  EXPECT_EQ(interner.get(expected.size()), "");
+}
+
+TEST(PairInterner, DenseStableIds) {
+  ipq::PairInterner interner;
+  std::map<std::pair<uint32_t, uint32_t>, uint32_t> expected;
+  std::uniform_int_distribution<uint32_t> value_dist(0, 300);
+  for (int i = 0; i < NMAX; ++i) {
+    auto key = std::make_pair(value_dist(rd), value_dist(rd));
+    auto res = expected.emplace(key, expected.size());
+    EXPECT_EQ(interner.intern(key.first, key.second), res.first->second);
+  }
+  for (auto& entry : expected) {
+    EXPECT_EQ(interner.find(entry.first.first, entry.first.second),
+              entry.second);
+    EXPECT_EQ(interner.get(entry.second), entry.first);
+  }
+  EXPECT_EQ(interner.find(1000, 1000), interner.NotFound);
+}
+
+TEST(LocationNames, SharesNames) {
+  ipq::LocationNames names;
+  auto tokyo = names.location("JP", "Japan", "Tokyo", "Tokyo");
+  auto osaka = names.location("JP", "Nippon", "Osaka", "Osaka");
+  auto melbourne = names.location("AU", "Australia", "Victoria", "Melbourne");
+  EXPECT_EQ(tokyo.getProvinceCode(), osaka.getProvinceCode());
+  EXPECT_NE(tokyo.getCountryCode(), osaka.getCountryCode());
+  EXPECT_EQ(names.countryName(osaka.getProvinceCode()), "Japan");
+  EXPECT_EQ(names.countryCode(melbourne.getProvinceCode()), "AU");
+  EXPECT_EQ(names.province(melbourne.getCountryCode()), "Victoria");
+  EXPECT_EQ(names.cityName(melbourne.getCountryCode()), "Melbourne");
+  EXPECT_EQ(names.findCity("Tokyo", "Tokyo"), tokyo.getCountryCode());
+  EXPECT_EQ(names.findCity("Tokyo", "Osaka"), names.NotFound);
+  EXPECT_EQ(names.findCountry("CN"), names.NotFound);
+  EXPECT_EQ(names.countries(), 2u);
+  EXPECT_EQ(names.cities(), 3u);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}